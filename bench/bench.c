@@ -0,0 +1,94 @@
+/*
+ * This module contains helpers shared by the benchmarks
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+
+/*
+ * The benchmarks do not run curses, so there is nothing to tear down.
+ * charalloc() and friends call this on failure.
+ */
+void finish()
+{
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Return a monotonic timestamp in seconds.
+ */
+double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Generate a file of about size bytes whose lines are linelen characters
+ * long on average. Return the path of the file, which the caller should
+ * unlink() and free().
+ */
+char *make_sample(size_t size, size_t linelen)
+{
+	static const char alphabet[] = 
+		"abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ 0123456789\t";
+	const char *tmpdir;
+	char *path;
+	char *line;
+	size_t written = 0;
+	size_t len;
+	size_t i;
+	FILE *fs;
+	int fd;
+
+	if ((tmpdir = getenv("TMPDIR")) == NULL)
+		tmpdir = "/tmp";
+	path = charalloc(strlen(tmpdir) + sizeof("/veer-bench.XXXXXX"));
+	sprintf(path, "%s/veer-bench.XXXXXX", tmpdir);
+	if ((fd = mkstemp(path)) < 0 || (fs = fdopen(fd, "w")) == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	srand(1);
+	line = charalloc(2 * linelen + 1);
+	while (written < size) {
+		len = linelen > 0 ? (size_t)rand() % (2 * linelen) : 0;
+		for (i = 0; i < len; i++)
+			line[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+		line[len++] = '\n';
+		fwrite(line, 1, len, fs);
+		written += len;
+	}
+	free(line);
+	fclose(fs);
+
+	return path;
+}
+
+/*
+ * Print the throughput of processing bytes in secs seconds.
+ */
+void print_rate(const char *what, size_t bytes, double secs)
+{
+	printf("%-24s %10.3f s %10.1f MB/s\n", what, secs,
+			bytes / (1024.0 * 1024.0) / secs);
+}
+
+/*
+ * Wait until buf is loaded.
+ */
+void wait_loaded(Buffer *buf)
+{
+	while (buf->loader != NULL) {
+		/* Leave the worker the processor, as the editor waits for input */
+		if (!loader_idle())
+			sched_yield();
+	}
+}
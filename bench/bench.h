@@ -0,0 +1,15 @@
+/*
+ * Helpers shared by the benchmarks
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "proto.h"
+
+double now();
+char *make_sample(size_t size, size_t linelen);
+void print_rate(const char *what, size_t bytes, double secs);
+void wait_loaded(Buffer *buf);
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * decodebench - measure how fast a compressed file is opened
+ *
+ * Usage: decodebench [-s MB] [-l LEN] [FILE]
+ *
+ * Without FILE, a sample of MB megabytes (256 by default) whose lines are
+ * LEN characters long on average (60 by default) is generated and saved
+ * with write_buffer() compressed as every codec this build knows. Every
+ * compressed file, or FILE, is then decoded on its own with a decoder,
+ * and opened with open_buffer() until the loader is done, which splits
+ * the text into lines while it is being decoded. The second should take
+ * hardly longer than the first. A sample opened afresh is checked to hold
+ * what was generated.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Number of characters decoded at a time when only decoding */
+#define DECODE_BLOCK 	(1024 * 1024)
+
+static const Codec codecs[] = { CODEC_GZIP, CODEC_XZ, CODEC_ZSTD };
+
+#define NCODECS 	(sizeof(codecs) / sizeof(codecs[0]))
+
+/*
+ * Decode the file at path without keeping any of it and return how many
+ * characters it holds, or 0 if it is not compressed.
+ */
+static size_t decode_only(const char *path)
+{
+	Decoder *dec;
+	char *block;
+	size_t size = 0;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	if ((dec = decoder_open(codec_of(fd), fd)) == NULL) {
+		close(fd);
+		return 0;
+	}
+	block = charalloc(DECODE_BLOCK);
+	while ((n = decoder_read(dec, block, DECODE_BLOCK)) > 0)
+		size += n;
+	if (n < 0)
+		fprintf(stderr, "%s: %s\n", path, strerror(error));
+	free(block);
+	decoder_close(dec);
+	close(fd);
+	return size;
+}
+
+/*
+ * Time decoding the file at path alone and opening it. If plain is not
+ * NULL, it is what the file should hold.
+ */
+static void run(const char *path, const Buffer *plain)
+{
+	struct stat filestat;
+	Buffer *buf;
+	double start;
+	size_t size;
+
+	stat(path, &filestat);
+	start = now();
+	if ((size = decode_only(path)) == 0) {
+		fprintf(stderr, "%s: not compressed\n", path);
+		exit(EXIT_FAILURE);
+	}
+	printf("%s (%lld bytes, %.1f%%)\n", path, (long long)filestat.st_size,
+			filestat.st_size * 100.0 / size);
+	print_rate("  decoding alone", size, now() - start);
+
+	start = now();
+	buf = open_buffer(path);
+	printf("  open_buffer() returned after %.3f ms\n", (now() - start) * 1e3);
+	wait_loaded(buf);
+	print_rate("  opening", size, now() - start);
+
+	if (buf->origsize != size || (plain != NULL &&
+				(plain->origsize != size ||
+				 memcmp(plain->orig, buf->orig, size) != 0))) {
+		fprintf(stderr, "%s: the text differs\n", path);
+		exit(EXIT_FAILURE);
+	}
+	delete_buffer(buf);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	size_t size = 256;
+	size_t linelen = 60;
+	char *path;
+	char *out;
+	Buffer *plain;
+	FILE *fs;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "s:l:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			linelen = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s MB] [-l LEN] [FILE]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc) {
+		run(argv[optind], NULL);
+		return EXIT_SUCCESS;
+	}
+
+	path = make_sample(size * 1024 * 1024, linelen);
+	plain = open_buffer(path);
+	wait_loaded(plain);
+	out = charalloc(strlen(path) + sizeof(".zstd"));
+	for (i = 0; i < NCODECS; i++) {
+		sprintf(out, "%s.%s", path, codec_name(codecs[i]));
+		plain->codec = codecs[i];
+		if ((fs = fopen(out, "w")) == NULL) {
+			perror(out);
+			return EXIT_FAILURE;
+		}
+		if (write_buffer(plain, fs) != 0) {
+			/* This build does not know the codec */
+			fclose(fs);
+			unlink(out);
+			continue;
+		}
+		fclose(fs);
+		run(out, plain);
+		unlink(out);
+	}
+
+	delete_buffer(plain);
+	unlink(path);
+	free(path);
+	free(out);
+	return EXIT_SUCCESS;
+}
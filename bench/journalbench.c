@@ -0,0 +1,103 @@
+/*
+ * journalbench - measure what the swap journal costs
+ *
+ * Usage: journalbench [-s MB] [-n EDITS]
+ *
+ * A sample of MB megabytes (16 by default) is opened and EDITS keys (a
+ * million by default) are typed into it through do_key(): mostly
+ * characters, with an enter every 64 of them and a backspace every 16.
+ * This is done twice, once without a journal and once with one, to tell
+ * how much journaling adds to a key. The buffer is then left as if the
+ * editor had died, and the journal is replayed on the sample opened
+ * afresh.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Type edits keys into buf and return how long that took.
+ */
+static double type(Buffer *buf, size_t edits)
+{
+	double start = now();
+	size_t i;
+
+	for (i = 0; i < edits; i++) {
+		if (i % 64 == 63)
+			do_key(buf, CARRIAGE_RET);
+		else if (i % 16 == 15)
+			do_key(buf, KEY_BACKSPACE);
+		else
+			do_key(buf, 'a' + i % 26);
+	}
+	return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	size_t size = 16;
+	size_t edits = 1000000;
+	char *path;
+	char *own;
+	Buffer *buf;
+	double plain;
+	double journaled;
+	double start;
+	size_t n;
+
+	while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			edits = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s MB] [-n EDITS]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	path = make_sample(size * 1024 * 1024, 60);
+	printf("typing %zu keys into %s (%zu MB)\n", edits, path, size);
+
+	/* A buffer without a path has no journal */
+	buf = open_buffer(path);
+	wait_loaded(buf);
+	own = buf->path;
+	buf->path = NULL;
+	plain = type(buf, edits);
+	buf->path = own;
+	delete_buffer(buf);
+
+	buf = open_buffer(path);
+	wait_loaded(buf);
+	journaled = type(buf, edits);
+	printf("  %-20s %8.3f us per key\n", "without journal",
+			plain / edits * 1e6);
+	printf("  %-20s %8.3f us per key\n", "with journal",
+			journaled / edits * 1e6);
+
+	/* As if the editor died: the journal is written out and left behind */
+	journal_close(buf, FALSE);
+
+	buf = open_buffer(path);
+	wait_loaded(buf);
+	if (!journal_found(buf)) {
+		fprintf(stderr, "no journal found for %s\n", path);
+		return EXIT_FAILURE;
+	}
+	start = now();
+	n = journal_replay(buf);
+	printf("  replayed %zu edits in %.3f s\n", n, now() - start);
+	delete_buffer(buf);
+
+	unlink(path);
+	free(path);
+	return EXIT_SUCCESS;
+}
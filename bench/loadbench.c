@@ -0,0 +1,138 @@
+/*
+ * loadbench - measure how fast a file is read into a buffer
+ *
+ * Usage: loadbench [-s MB] [-l LEN] [FILE]
+ *
+ * Without FILE, a sample of MB megabytes (64 by default) whose lines are
+ * LEN characters long on average (60 by default) is generated and removed
+ * afterwards. The fgetc() loop the editor used to load files with is
+ * timed next to read_into_buffer() for comparison, which includes the
+ * time the loader takes to split the file in the background.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * The former read_into_buffer(): one fgetc() per byte, a scratch buffer
+ * grown BUFFER_SIZE bytes at a time and a second copy per line made by
+ * push_back_line().
+ */
+static void fgetc_into_buffer(Buffer *nbuf, FILE *fs)
+{
+	int ch;
+	size_t i = 0;
+	char *buf;
+	Line *line;
+	size_t buffer_mem = BUFFER_SIZE;
+
+	buf = charalloc(BUFFER_SIZE);
+	buf[0] = '\0';
+	line = new_line(nbuf);
+
+	while ((ch = fgetc(fs)) != EOF) {
+		if (i == (buffer_mem - 1)) {
+			buffer_mem += BUFFER_SIZE;
+			buf = charrealloc(buf, buffer_mem);
+		}
+		buf[i++] = (char)ch;
+		buf[i] = '\0';
+		if ((char)ch == '\n') {
+			line->text = buf;
+			line->len = i;
+			line->memsize = buffer_mem;
+			push_back_line(nbuf, line);
+
+			memset(buf, 0, i + 1);
+			buffer_mem = BUFFER_SIZE;
+			i = 0;
+		}
+	}
+	if (nbuf->firstln == NULL || buf[0] != '\0') {
+		line->text = buf;
+		line->len = i;
+		line->memsize = buffer_mem;
+		push_back_line(nbuf, line);
+	}
+	free(buf);
+	/* buf was not allocated from the pool */
+	line->text = NULL;
+	line->memsize = 0;
+	delete_line(nbuf, line);
+}
+
+static size_t count_lines(const Buffer *buf)
+{
+	const Line *it;
+	size_t n = 0;
+
+	for (it = buf->firstln; it != NULL; it = it->next)
+		n++;
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	size_t size = 64;
+	size_t linelen = 60;
+	char *path;
+	bool generated = FALSE;
+	struct stat filestat;
+	FILE *fs;
+	double start;
+
+	while ((opt = getopt(argc, argv, "s:l:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			linelen = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s MB] [-l LEN] [FILE]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc) {
+		path = argv[optind];
+	} else {
+		path = make_sample(size * 1024 * 1024, linelen);
+		generated = TRUE;
+	}
+	if (stat(path, &filestat) != 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	printf("loading %s (%lld bytes)\n", path, (long long)filestat.st_size);
+
+	if ((fs = fopen(path, "r")) == NULL) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	start = now();
+	fgetc_into_buffer(push_back_buffer(path), fs);
+	print_rate("fgetc loop", filestat.st_size, now() - start);
+	fclose(fs);
+
+	start = now();
+	open_buffer(path);
+	printf("open_buffer() returned after %.3f ms\n", (now() - start) * 1e3);
+	while (lastbuf->loader != NULL) {
+		loader_idle();
+	}
+	print_rate("read_into_buffer", filestat.st_size, now() - start);
+	printf("%zu lines, %zu allocations avoided by the pool\n", 
+			count_lines(lastbuf), pool_avoided(&lastbuf->pool));
+
+	if (generated) {
+		unlink(path);
+		free(path);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+/*
+ * regexbench - measure how fast regular expressions are matched
+ *
+ * Usage: regexbench [-s MB] [-l LEN] [-r REPS]
+ *
+ * A sample of MB megabytes (64 by default) whose lines are LEN characters
+ * long on average (60 by default) is generated, and the lines that match
+ * each of a few patterns are counted, once with regex_exec() and once
+ * with the regexec() of the C library, best of REPS runs (3 by default).
+ * Both must count the same lines.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <regex.h>
+#include <unistd.h>
+
+static const char *patterns[] = {
+	"veer",
+	"[0-9][0-9][0-9]",
+	"^[A-Z]+ ",
+	" [a-z]+[0-9]$",
+	"(ab|cd|ef)+g",
+	"alpha|bravo|charlie|delta|echo|foxtrot|golf|hotel",
+	"[[:upper:]][[:lower:]]*\t[[:digit:]]",
+	"x.*y.*z.*Q.*W",
+	"@",
+};
+
+/*
+ * Read the file at path into memory and store its size in *size.
+ */
+static char *read_sample(const char *path, size_t *size)
+{
+	FILE *fs;
+	char *text;
+	long len;
+
+	if ((fs = fopen(path, "r")) == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	fseek(fs, 0, SEEK_END);
+	len = ftell(fs);
+	rewind(fs);
+	text = charalloc(len + 1);
+	if (fread(text, 1, len, fs) != (size_t)len) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fs);
+	*size = len;
+	return text;
+}
+
+/*
+ * Count the lines of text that re matches.
+ */
+static size_t count_veer(Regex *re, const char *text, size_t size)
+{
+	const char *p = text;
+	const char *end = text + size;
+	const char *eol;
+	size_t beg;
+	size_t mend;
+	size_t count = 0;
+
+	for (; p < end; p = eol + 1) {
+		if ((eol = memchr(p, '\n', end - p)) == NULL)
+			eol = end;
+		if (regex_exec(re, p, eol - p, 0, &beg, &mend))
+			count++;
+	}
+	return count;
+}
+
+/*
+ * Count the lines of text, every one of which ends with a '\0' instead
+ * of a '\n', that re matches.
+ */
+static size_t count_posix(regex_t *re, const char *text, size_t size)
+{
+	const char *p = text;
+	const char *end = text + size;
+	size_t count = 0;
+
+	for (; p < end; p += strlen(p) + 1) {
+		if (regexec(re, p, 0, NULL, 0) == 0)
+			count++;
+	}
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	size_t size = 64;
+	size_t linelen = 60;
+	int reps = 3;
+	char *path;
+	char *text;
+	char *ztext;
+	char label[64];
+	const char *error;
+	Regex *re;
+	regex_t posix;
+	double start;
+	double best;
+	double t;
+	size_t veer = 0;
+	size_t libc = 0;
+	size_t i;
+	int r;
+
+	while ((opt = getopt(argc, argv, "s:l:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			linelen = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s MB] [-l LEN] [-r REPS]\n",
+					argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	path = make_sample(size * 1024 * 1024, linelen);
+	text = read_sample(path, &size);
+	unlink(path);
+	free(path);
+
+	/* regexec() wants strings */
+	ztext = charalloc(size);
+	for (i = 0; i < size; i++)
+		ztext[i] = (text[i] == '\n') ? '\0' : text[i];
+
+	printf("matching %zu bytes, best of %d\n", size, reps);
+
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		if ((re = regex_compile(patterns[i], &error)) == NULL) {
+			fprintf(stderr, "`%s': %s\n", patterns[i], error);
+			return EXIT_FAILURE;
+		}
+		if (regcomp(&posix, patterns[i], REG_EXTENDED | REG_NOSUB) != 0) {
+			fprintf(stderr, "`%s': regcomp failed\n", patterns[i]);
+			return EXIT_FAILURE;
+		}
+
+		best = 1e9;
+		for (r = 0; r < reps; r++) {
+			start = now();
+			veer = count_veer(re, text, size);
+			if ((t = now() - start) < best)
+				best = t;
+		}
+		snprintf(label, sizeof(label), "%.16s, veer", patterns[i]);
+		print_rate(label, size, best);
+
+		best = 1e9;
+		for (r = 0; r < reps; r++) {
+			start = now();
+			libc = count_posix(&posix, ztext, size);
+			if ((t = now() - start) < best)
+				best = t;
+		}
+		snprintf(label, sizeof(label), "%.16s, regexec", patterns[i]);
+		print_rate(label, size, best);
+
+		if (veer != libc) {
+			fprintf(stderr, "`%s': %zu lines match, regexec says %zu\n",
+					patterns[i], veer, libc);
+			return EXIT_FAILURE;
+		}
+		regex_free(re);
+		regfree(&posix);
+	}
+
+	free(ztext);
+	free(text);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,437 @@
+/*
+ * replaybench - measure how long every key takes
+ *
+ * Usage: replaybench [-s MB] [-l LEN] [SCRIPT...]
+ *
+ * A sample of MB megabytes (64 by default, about a million lines) whose
+ * lines are LEN characters long on average (60 by default) is generated,
+ * and scripts of keys are replayed on it through do_key(), which is where
+ * do_input() sends them too. Every script gets the sample opened afresh.
+ * For every kind of key the median, 99th percentile and longest time it
+ * took are reported, along with the number of allocations it made on
+ * average.
+ *
+ * A script is a list of keys separated by white space: any printable
+ * character but [ and ] stands for itself, and space, tab, enter,
+ * backspace, up, down, left, right, home, end, undo and redo for those
+ * keys. paste:N pastes N characters of lines of LEN characters and save
+ * saves the buffer. A key, or a list of keys in [ ], followed by *N is
+ * repeated N times. SCRIPT is a file holding a script; without any, the
+ * built-in scenarios below are replayed.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Where the kinds of keys that are not keys of their own are counted */
+#define KIND_TYPE 	0
+#define KIND_PASTE 	1
+
+typedef struct Step {
+	int key;
+	size_t arg;
+	size_t reps;
+} Step;
+
+typedef struct Script {
+	Step *steps;
+	size_t n;
+	size_t cap;
+} Script;
+
+/* The times one kind of key took and the allocations it made */
+typedef struct Stats {
+	double *times;
+	size_t n;
+	size_t cap;
+	size_t allocs;
+} Stats;
+
+static const struct {
+	const char *name;
+	int key;
+} keys[] = {
+	{ "type", 0 },
+	{ "paste", PASTE_BEGIN },
+	{ "save", DO_SAVE },
+	{ "space", ' ' },
+	{ "tab", '\t' },
+	{ "enter", CARRIAGE_RET },
+	{ "backspace", KEY_BACKSPACE },
+	{ "up", KEY_UP },
+	{ "down", KEY_DOWN },
+	{ "left", KEY_LEFT },
+	{ "right", KEY_RIGHT },
+	{ "home", KEY_HOME },
+	{ "end", KEY_END },
+	{ "undo", DO_UNDO },
+	{ "redo", DO_REDO },
+};
+
+#define NKINDS 	(sizeof(keys) / sizeof(keys[0]))
+
+static const struct {
+	const char *name;
+	const char *script;
+} scenarios[] = {
+	{ "typing in a long line",
+		"down*10 end x*20000 home right*10000 x*10000 left*5000 x*5000" },
+	{ "enter and backspace",
+		"down*100 right*20 [enter backspace]*50000 end enter*20000 "
+		"backspace*20000" },
+	{ "scrolling", "down*1000000 up*1000000" },
+	{ "paste", "down*1000 paste:4096*200 paste:1048576*8 undo*8 redo*8" },
+	{ "save", "[x save]*5" },
+};
+
+/* Number of allocations made so far */
+static size_t allocs;
+
+#ifdef __GLIBC__
+/* Count the allocations of the editor, the C library included */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static void add_step(Script *script, int key, size_t arg, size_t reps)
+{
+	if (script->n == script->cap) {
+		script->cap = (script->cap == 0) ? 64 : 2 * script->cap;
+		script->steps = realloc(script->steps, script->cap * sizeof(Step));
+		if (script->steps == NULL) {
+			fprintf(stderr, "%s: realloc failed\n", __func__);
+			exit(EXIT_FAILURE);
+		}
+	}
+	script->steps[script->n].key = key;
+	script->steps[script->n].arg = arg;
+	script->steps[script->n].reps = reps;
+	script->n++;
+}
+
+/*
+ * Read the *N after a key at *p, if any, and return N.
+ */
+static size_t parse_reps(const char **p)
+{
+	char *end;
+	size_t reps = 1;
+
+	if (**p == '*') {
+		reps = strtoul(*p + 1, &end, 10);
+		*p = end;
+	}
+	return reps;
+}
+
+/*
+ * Add the keys at *p to script, up to the ] that closes the list if
+ * nested is TRUE.
+ */
+static void parse(Script *script, const char **p, bool nested)
+{
+	const char *tok;
+	size_t len;
+	size_t start;
+	size_t reps;
+	size_t arg;
+	size_t i;
+	int key;
+
+	while (TRUE) {
+		while (**p == ' ' || **p == '\t' || **p == '\n')
+			(*p)++;
+		if (**p == '\0' || **p == ']') {
+			if ((**p == ']') != nested) {
+				fprintf(stderr, "unbalanced [ ] in script\n");
+				exit(EXIT_FAILURE);
+			}
+			if (nested)
+				(*p)++;
+			return;
+		}
+
+		if (**p == '[') {
+			(*p)++;
+			start = script->n;
+			parse(script, p, TRUE);
+			len = script->n - start;
+			for (reps = parse_reps(p); reps > 1; reps--) {
+				for (i = 0; i < len; i++) {
+					add_step(script, script->steps[start + i].key,
+							script->steps[start + i].arg,
+							script->steps[start + i].reps);
+				}
+			}
+			continue;
+		}
+
+		tok = *p;
+		while (**p != '\0' && **p != ' ' && **p != '\t' && **p != '\n' &&
+				**p != '*' && **p != '[' && **p != ']')
+			(*p)++;
+		len = *p - tok;
+		key = -1;
+		arg = 0;
+		if (len == 1) {
+			key = (unsigned char)*tok;
+		}
+		else if (len > 6 && strncmp(tok, "paste:", 6) == 0) {
+			key = PASTE_BEGIN;
+			arg = strtoul(tok + 6, NULL, 10);
+		}
+		else {
+			for (i = KIND_PASTE + 1; i < NKINDS; i++) {
+				if (strlen(keys[i].name) == len &&
+						strncmp(tok, keys[i].name, len) == 0)
+					key = keys[i].key;
+			}
+		}
+		if (key < 0) {
+			fprintf(stderr, "`%.*s': no such key\n", (int)len, tok);
+			exit(EXIT_FAILURE);
+		}
+		add_step(script, key, arg, parse_reps(p));
+	}
+}
+
+/*
+ * Return where the times of key are counted.
+ */
+static size_t kind_of(int key)
+{
+	size_t i;
+
+	for (i = KIND_PASTE; i < NKINDS; i++) {
+		if (keys[i].key == key)
+			return i;
+	}
+	return KIND_TYPE;
+}
+
+static void add_time(Stats *stats, double t, size_t nallocs)
+{
+	if (stats->n == stats->cap) {
+		stats->cap = (stats->cap == 0) ? 1024 : 2 * stats->cap;
+		stats->times = realloc(stats->times, stats->cap * sizeof(double));
+		if (stats->times == NULL) {
+			fprintf(stderr, "%s: realloc failed\n", __func__);
+			exit(EXIT_FAILURE);
+		}
+	}
+	stats->times[stats->n++] = t;
+	stats->allocs += nallocs;
+}
+
+/*
+ * Make a text of size characters to paste, lines of linelen characters.
+ */
+static char *make_paste(size_t size, size_t linelen)
+{
+	char *text;
+	size_t i;
+
+	text = charalloc(size > 0 ? size : 1);
+	for (i = 0; i < size; i++)
+		text[i] = (i % (linelen + 1) == linelen) ? '\n' : 'a' + i % 26;
+	return text;
+}
+
+/*
+ * Replay script on buf, adding the time every key took to stats.
+ */
+static void replay(Buffer *buf, const Script *script, const char *paste,
+		Stats *stats)
+{
+	const Step *step;
+	double start;
+	size_t before;
+	size_t i;
+	size_t r;
+
+	for (i = 0; i < script->n; i++) {
+		step = &script->steps[i];
+		for (r = 0; r < step->reps; r++) {
+			before = allocs;
+			start = now();
+			if (step->key == PASTE_BEGIN)
+				insert_str(buf, paste, step->arg);
+			else if (step->key == DO_SAVE)
+				save_buffer(buf);
+			else
+				do_key(buf, step->key);
+			add_time(&stats[kind_of(step->key)], now() - start,
+					allocs - before);
+		}
+	}
+}
+
+static int compare(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, Stats *stats)
+{
+	Stats *s;
+	size_t i;
+
+	printf("%s\n", name);
+	printf("  %-10s %9s %10s %10s %10s %10s\n", "key", "count", "p50 us",
+			"p99 us", "max us", "allocs");
+	for (i = 0; i < NKINDS; i++) {
+		s = &stats[i];
+		if (s->n == 0)
+			continue;
+		qsort(s->times, s->n, sizeof(double), compare);
+		printf("  %-10s %9zu %10.2f %10.2f %10.2f %10.2f\n", keys[i].name,
+				s->n, s->times[(s->n - 1) / 2] * 1e6,
+				s->times[(s->n - 1) * 99 / 100] * 1e6,
+				s->times[s->n - 1] * 1e6, (double)s->allocs / s->n);
+		free(s->times);
+	}
+}
+
+/*
+ * Read the file at path into a string.
+ */
+static char *read_script(const char *path)
+{
+	FILE *fs;
+	char *text;
+	long len;
+
+	if ((fs = fopen(path, "r")) == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	fseek(fs, 0, SEEK_END);
+	len = ftell(fs);
+	rewind(fs);
+	text = charalloc(len + 1);
+	if (fread(text, 1, len, fs) != (size_t)len) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	text[len] = '\0';
+	fclose(fs);
+	return text;
+}
+
+/*
+ * Open path, replay script on it and report how it went.
+ */
+static void run(const char *path, const char *name, const Script *script,
+		size_t linelen)
+{
+	Stats stats[NKINDS];
+	char *paste;
+	size_t most = 0;
+	size_t i;
+	Buffer *buf;
+
+	for (i = 0; i < script->n; i++) {
+		if (script->steps[i].key == PASTE_BEGIN && script->steps[i].arg > most)
+			most = script->steps[i].arg;
+	}
+	paste = make_paste(most, linelen);
+	memset(stats, 0, sizeof(stats));
+
+	buf = open_buffer(path);
+	wait_loaded(buf);
+	replay(buf, script, paste, stats);
+	delete_buffer(buf);
+
+	report(name, stats);
+	free(paste);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	size_t size = 64;
+	size_t linelen = 60;
+	char *path;
+	char *text;
+	const char *p;
+	const char **names;
+	Script *scripts;
+	size_t nscripts;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "s:l:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			linelen = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s MB] [-l LEN] [SCRIPT...]\n",
+					argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* Every script is parsed before anything is replayed */
+	nscripts = (optind < argc) ? (size_t)(argc - optind) :
+		sizeof(scenarios) / sizeof(scenarios[0]);
+	scripts = calloc(nscripts, sizeof(Script));
+	names = calloc(nscripts, sizeof(char *));
+	if (scripts == NULL || names == NULL) {
+		fprintf(stderr, "%s: calloc failed\n", __func__);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < nscripts; i++) {
+		if (optind < argc) {
+			names[i] = argv[optind + i];
+			text = read_script(names[i]);
+			p = text;
+			parse(&scripts[i], &p, FALSE);
+			free(text);
+		}
+		else {
+			names[i] = scenarios[i].name;
+			p = scenarios[i].script;
+			parse(&scripts[i], &p, FALSE);
+		}
+	}
+
+	path = make_sample(size * 1024 * 1024, linelen);
+	printf("replaying on %s (%zu MB)\n", path, size);
+	for (i = 0; i < nscripts; i++) {
+		run(path, names[i], &scripts[i], linelen);
+		free(scripts[i].steps);
+	}
+
+	free(scripts);
+	free(names);
+	unlink(path);
+	free(path);
+	return EXIT_SUCCESS;
+}
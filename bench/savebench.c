@@ -0,0 +1,129 @@
+/*
+ * savebench - measure how fast a buffer is saved
+ *
+ * Usage: savebench [-s MB] [-l LEN] [FILE]
+ *
+ * FILE, or a generated sample of MB megabytes (1000 by default, which
+ * keeps it just below LAZY_THRESHOLD so that every line is made) whose
+ * lines are LEN characters long on average (60 by default), is loaded
+ * and written back next to itself: once with the fputc() loop the editor
+ * used to save with, then with write_buffer() under every sync policy.
+ * The last run modifies every 8th line first, so that lines no longer
+ * point into the original text one after another.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * The former save_buffer(): one fputc() per character.
+ */
+static void fputc_buffer(Buffer *buf, FILE *fs)
+{
+	Line *it;
+	size_t i;
+
+	for (it = buf->firstln; it != NULL; it = it->next) {
+		for (i = 0; i < it->len; i++) {
+			fputc(it->text[i], fs);
+		}
+	}
+}
+
+/*
+ * Save buf to path through open_file() and commit_temp() as the editor
+ * does, under policy, and print the rate.
+ */
+static void save(Buffer *buf, const char *path, Sync policy,
+		const char *what, size_t size)
+{
+	FILE *fs;
+	double start;
+
+	unlink(path);
+	sync_policy = policy;
+	start = now();
+	if ((fs = open_file(path, "w")) == NULL ||
+			commit_temp(fs, write_buffer(buf, fs) != 0) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(error));
+		exit(EXIT_FAILURE);
+	}
+	print_rate(what, size, now() - start);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	size_t size = 1000;
+	size_t linelen = 60;
+	char *path;
+	char *out;
+	bool generated = FALSE;
+	struct stat filestat;
+	FILE *fs;
+	Buffer *buf;
+	Line *it;
+	size_t n = 0;
+	double start;
+
+	while ((opt = getopt(argc, argv, "s:l:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			linelen = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s MB] [-l LEN] [FILE]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc) {
+		path = argv[optind];
+	} else {
+		path = make_sample(size * 1024 * 1024, linelen);
+		generated = TRUE;
+	}
+	if (stat(path, &filestat) != 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	out = charalloc(strlen(path) + sizeof(".saved"));
+	sprintf(out, "%s.saved", path);
+
+	printf("saving %s (%lld bytes)\n", path, (long long)filestat.st_size);
+
+	buf = open_buffer(path);
+	wait_loaded(buf);
+
+	if ((fs = fopen(out, "w")) == NULL) {
+		perror(out);
+		return EXIT_FAILURE;
+	}
+	start = now();
+	fputc_buffer(buf, fs);
+	fclose(fs);
+	print_rate("fputc loop", filestat.st_size, now() - start);
+
+	save(buf, out, SYNC_NONE, "writev, no sync", filestat.st_size);
+	save(buf, out, SYNC_FILE, "writev, sync file", filestat.st_size);
+	save(buf, out, SYNC_ALL, "writev, sync all", filestat.st_size);
+
+	for (it = buf->firstln; it != NULL; it = it->next) {
+		if (n++ % 8 == 0)
+			own_line(buf, it, it->len);
+	}
+	save(buf, out, SYNC_FILE, "1/8 modified, sync file", filestat.st_size);
+
+	unlink(out);
+	free(out);
+	if (generated) {
+		unlink(path);
+		free(path);
+	}
+	return EXIT_SUCCESS;
+}
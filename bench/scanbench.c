@@ -0,0 +1,163 @@
+/*
+ * scanbench - measure how fast line breaks are found
+ *
+ * Usage: scanbench [-s MB] [-l LEN] [-r REPS]
+ *
+ * A text of MB megabytes (256 by default) whose lines are LEN characters
+ * long on average (60 by default) is made in memory, with a few "\r\n"
+ * line ends and NUL bytes thrown in, and scanned REPS times (5 by default)
+ * with every scanner the CPU supports. A memchr() loop, which is how lines
+ * used to be split, is timed next to them. The best time of each is
+ * reported, along with what the scan found, which must be the same for
+ * every scanner.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *names[] = { "scalar", "sse2", "avx2" };
+
+/*
+ * Make a text of size bytes in memory.
+ */
+static char *make_text(size_t size, size_t linelen)
+{
+	char *text;
+	size_t i;
+	size_t next = 0;
+
+	text = charalloc(size);
+	srand(1);
+	for (i = 0; i < size; i++) {
+		if (i == next) {
+			text[i] = '\n';
+			if (i > 0 && rand() % 64 == 0)
+				text[i - 1] = '\r';
+			next = i + 1 + rand() % (2 * linelen + 1);
+		}
+		else {
+			text[i] = (rand() % 65536 == 0) ? '\0' : 'a' + i % 26;
+		}
+	}
+	return text;
+}
+
+/*
+ * Split text into lines the way read_into_buffer() does.
+ */
+static void scan_all(Scan *scan, const char *text, size_t size)
+{
+	size_t nl[SCAN_BATCH];
+	size_t off = 0;
+	size_t n;
+
+	scan_init(scan);
+	do {
+		n = scan_lines(scan, text + off, size - off, nl, SCAN_BATCH);
+		if (n > 0)
+			off += nl[n - 1];
+	} while (n == SCAN_BATCH);
+	scan_finish(scan);
+}
+
+static size_t memchr_all(const char *text, size_t size)
+{
+	const char *p = text;
+	const char *end = text + size;
+	size_t lines = 0;
+
+	while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+		p++;
+		lines++;
+	}
+	return lines;
+}
+
+static void report(const char *what, size_t size, double best)
+{
+	printf("%-10s %8.3f ms %8.2f GB/s\n", what, best * 1e3,
+			size / 1e9 / best);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	size_t size = 256;
+	size_t linelen = 60;
+	int reps = 5;
+	char *text;
+	Scan scan;
+	Scan first;
+	bool have_first = FALSE;
+	double start;
+	double best;
+	double t;
+	size_t lines = 0;
+	size_t i;
+	int r;
+
+	while ((opt = getopt(argc, argv, "s:l:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			linelen = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s MB] [-l LEN] [-r REPS]\n",
+					argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	size *= 1024 * 1024;
+	text = make_text(size, linelen);
+	scan_init(&first);
+
+	printf("scanning %zu bytes, best of %d\n", size, reps);
+
+	best = 1e9;
+	for (r = 0; r < reps; r++) {
+		start = now();
+		lines = memchr_all(text, size);
+		if ((t = now() - start) < best)
+			best = t;
+	}
+	report("memchr", size, best);
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (scan_select(names[i]) != 0) {
+			printf("%-10s not supported\n", names[i]);
+			continue;
+		}
+		best = 1e9;
+		for (r = 0; r < reps; r++) {
+			start = now();
+			scan_all(&scan, text, size);
+			if ((t = now() - start) < best)
+				best = t;
+		}
+		report(names[i], size, best);
+
+		if (!have_first) {
+			first = scan;
+			have_first = TRUE;
+		}
+		if (scan.lines != lines || scan.lines != first.lines ||
+				scan.longest != first.longest ||
+				scan.crlf != first.crlf || scan.nuls != first.nuls) {
+			fprintf(stderr, "%s: found something else\n", names[i]);
+			return EXIT_FAILURE;
+		}
+	}
+	printf("%zu lines, longest %zu, %zu end with \"\\r\\n\", %zu NUL bytes\n",
+			first.lines, first.longest, first.crlf, first.nuls);
+
+	free(text);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/*
+ * searchbench - measure how fast a buffer is searched
+ *
+ * Usage: searchbench [-s MB] [-l LEN] [-r REPS]
+ *
+ * A sample of MB megabytes (1000 by default) whose lines are LEN
+ * characters long on average (60 by default) is generated with a pattern
+ * that occurs nowhere else on its last line. It is opened once as usual
+ * and once lazily, and with the cursor on the first line the pattern is
+ * searched for forward, which goes through the whole buffer, and then a
+ * pattern that is not there at all. Every matcher the CPU supports is
+ * timed, best of REPS runs (3 by default).
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NEEDLE 	"veer-search-needle"
+
+static const char *names[] = { "bmh", "sse2", "avx2" };
+
+/*
+ * Time searching buf for text from its first line, and check that the
+ * match is where it should be.
+ */
+static void run(Buffer *buf, const char *what, const char *text,
+		size_t expect, size_t size, int reps)
+{
+	char label[64];
+	double start;
+	double best;
+	double t;
+	size_t n = 0;
+	size_t x;
+	bool found = FALSE;
+	size_t i;
+	int r;
+
+	search_set(text);
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (search_select(names[i]) != 0)
+			continue;
+		best = 1e9;
+		for (r = 0; r < reps; r++) {
+			start = now();
+			x = 0;
+			found = search_buffer(buf, DOWN, TRUE, &n, &x);
+			if ((t = now() - start) < best)
+				best = t;
+		}
+		if ((expect == 0) ? found : (!found || n != expect || x != 0)) {
+			fprintf(stderr, "%s: %s found the wrong thing\n", what,
+					names[i]);
+			exit(EXIT_FAILURE);
+		}
+		snprintf(label, sizeof(label), "%s, %s", what, names[i]);
+		print_rate(label, size, best);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	size_t size = 1000;
+	size_t linelen = 60;
+	int reps = 3;
+	char *path;
+	Buffer *buf;
+	FILE *fs;
+	long size_written;
+	size_t lines;
+
+	while ((opt = getopt(argc, argv, "s:l:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			linelen = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s MB] [-l LEN] [-r REPS]\n",
+					argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	path = make_sample(size * 1024 * 1024, linelen);
+	if ((fs = fopen(path, "a")) == NULL) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	fputs(NEEDLE "\n", fs);
+	size_written = ftell(fs);
+	fclose(fs);
+
+	printf("searching %s (%ld bytes)\n", path, size_written);
+
+	buf = open_buffer(path);
+	wait_loaded(buf);
+	lines = line_number(buf, buf->lastln);
+	run(buf, "needle", NEEDLE, lines, size_written, reps);
+	run(buf, "no match", NEEDLE "?", 0, size_written, reps);
+
+	/* Nothing but the first screenful is split into lines */
+	lazy_all = TRUE;
+	buf = open_buffer(path);
+	run(buf, "lazy needle", NEEDLE, lines, size_written, reps);
+	run(buf, "lazy no match", NEEDLE "?", 0, size_written, reps);
+
+	unlink(path);
+	free(path);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,550 @@
+/*
+ * This module reads and writes compressed files. Whether a file is
+ * compressed is told by its first bytes, not by its name: gzip, xz and
+ * zstd are known, as far as configure found their libraries. A decoder
+ * turns a file into text a block at a time and an encoder turns text
+ * into a file, so that neither holds more than a block of compressed
+ * data. Concatenated streams, as left by appending to a compressed log,
+ * are decoded one after the other.
+ */
+
+#include "proto.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA_H
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+/* Number of compressed bytes read or written at a time */
+#define CODEC_BLOCK 	(256 * 1024)
+/* Most text handed to a library at a time, its sizes may be 32-bit */
+#define CODEC_PIECE 	((size_t)1 << 30)
+/* How hard saved files are compressed, what the tools do by default */
+#define GZIP_LEVEL 		6
+#define XZ_PRESET 		6
+#define ZSTD_LEVEL 		3
+
+struct Decoder {
+	Codec codec;
+	int fd;
+	/* [inpos, inlen) of in has been read but not decoded yet */
+	unsigned char *in;
+	size_t inpos;
+	size_t inlen;
+	bool eof;
+	/* Whether the last stream read has been decoded to its end */
+	bool whole;
+	size_t consumed;
+	union {
+#ifdef HAVE_ZLIB_H
+		z_stream gz;
+#endif
+#ifdef HAVE_LZMA_H
+		lzma_stream xz;
+#endif
+#ifdef HAVE_ZSTD_H
+		ZSTD_DStream *zstd;
+#endif
+		int none;
+	} s;
+};
+
+struct Encoder {
+	Codec codec;
+	unsigned char *out;
+	union {
+#ifdef HAVE_ZLIB_H
+		z_stream gz;
+#endif
+#ifdef HAVE_LZMA_H
+		lzma_stream xz;
+#endif
+#ifdef HAVE_ZSTD_H
+		ZSTD_CStream *zstd;
+#endif
+		int none;
+	} s;
+};
+
+static const char *names[] = { "none", "gzip", "xz", "zstd" };
+
+static int fill(Decoder *dec);
+static ssize_t step(Decoder *dec, unsigned char *out, size_t size);
+static int encode(Encoder *enc, int fd, const char *text, size_t len,
+		bool finish);
+static int write_out(int fd, const unsigned char *out, size_t len);
+
+/*
+ * Return how the file open as fd is compressed, looking at its first
+ * bytes. A file compressed in a way this build cannot read is CODEC_NONE.
+ */
+Codec codec_of(int fd)
+{
+	unsigned char magic[6];
+	ssize_t n;
+
+	n = pread(fd, magic, sizeof(magic), 0);
+#ifdef HAVE_ZLIB_H
+	if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+		return CODEC_GZIP;
+#endif
+#ifdef HAVE_LZMA_H
+	if (n >= 6 && memcmp(magic, "\xfd" "7zXZ\0", 6) == 0)
+		return CODEC_XZ;
+#endif
+#ifdef HAVE_ZSTD_H
+	if (n >= 4 && memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0)
+		return CODEC_ZSTD;
+#endif
+	(void)n;
+	return CODEC_NONE;
+}
+
+const char *codec_name(Codec codec)
+{
+	return names[codec];
+}
+
+/*
+ * Start decoding the file open as fd, which is compressed as codec, from
+ * where fd is at. fd stays open once the decoder is closed. Return NULL
+ * if the library could not be set up.
+ */
+Decoder *decoder_open(Codec codec, int fd)
+{
+	Decoder *dec;
+	int ok = FALSE;
+
+	dec = malloc(sizeof(Decoder));
+	if (dec == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	dec->codec = codec;
+	dec->fd = fd;
+	dec->in = (unsigned char *)charalloc(CODEC_BLOCK);
+	dec->inpos = 0;
+	dec->inlen = 0;
+	dec->eof = FALSE;
+	dec->whole = FALSE;
+	dec->consumed = 0;
+
+	switch (codec) {
+#ifdef HAVE_ZLIB_H
+	case CODEC_GZIP:
+		memset(&dec->s.gz, 0, sizeof(z_stream));
+		/* 32 tells zlib to expect a gzip header */
+		ok = inflateInit2(&dec->s.gz, 15 + 32) == Z_OK;
+		break;
+#endif
+#ifdef HAVE_LZMA_H
+	case CODEC_XZ:
+		memset(&dec->s.xz, 0, sizeof(lzma_stream));
+		ok = lzma_stream_decoder(&dec->s.xz, UINT64_MAX,
+				LZMA_CONCATENATED) == LZMA_OK;
+		break;
+#endif
+#ifdef HAVE_ZSTD_H
+	case CODEC_ZSTD:
+		dec->s.zstd = ZSTD_createDStream();
+		ok = dec->s.zstd != NULL &&
+			!ZSTD_isError(ZSTD_initDStream(dec->s.zstd));
+		break;
+#endif
+	default:
+		break;
+	}
+	if (!ok) {
+		dec->codec = CODEC_NONE;
+		decoder_close(dec);
+		return NULL;
+	}
+	return dec;
+}
+
+void decoder_close(Decoder *dec)
+{
+	switch (dec->codec) {
+#ifdef HAVE_ZLIB_H
+	case CODEC_GZIP:
+		inflateEnd(&dec->s.gz);
+		break;
+#endif
+#ifdef HAVE_LZMA_H
+	case CODEC_XZ:
+		lzma_end(&dec->s.xz);
+		break;
+#endif
+#ifdef HAVE_ZSTD_H
+	case CODEC_ZSTD:
+		ZSTD_freeDStream(dec->s.zstd);
+		break;
+#endif
+	default:
+		break;
+	}
+	free(dec->in);
+	free(dec);
+}
+
+/*
+ * Decode up to size more characters of text into out. Return how many
+ * there were, 0 at the end of the file or -1 if the file could not be
+ * read or is cut short or corrupt.
+ */
+ssize_t decoder_read(Decoder *dec, char *out, size_t size)
+{
+	size_t before;
+	ssize_t n;
+
+	while (TRUE) {
+		if (dec->inpos == dec->inlen && !dec->eof && fill(dec) != 0)
+			return -1;
+		if (dec->inpos == dec->inlen && dec->eof && dec->whole)
+			return 0;
+		before = dec->inpos;
+		if ((n = step(dec, (unsigned char *)out, size)) != 0)
+			return n;
+		/* Nothing came out and nothing went in */
+		if (dec->inpos == before && !dec->whole) {
+			error = EIO;
+			return -1;
+		}
+	}
+}
+
+/*
+ * Return how many bytes of the file have been decoded so far.
+ */
+size_t decoder_consumed(const Decoder *dec)
+{
+	return dec->consumed;
+}
+
+/*
+ * Read the next block of the file.
+ */
+static int fill(Decoder *dec)
+{
+	ssize_t n;
+
+	do {
+		n = read(dec->fd, dec->in, CODEC_BLOCK);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		error = errno;
+		return -1;
+	}
+	dec->inpos = 0;
+	dec->inlen = (size_t)n;
+	dec->eof = (n == 0);
+	return 0;
+}
+
+/*
+ * Have the library decode what has been read into out, which has room
+ * for size characters. Return how many came out or -1 on error.
+ */
+static ssize_t step(Decoder *dec, unsigned char *out, size_t size)
+{
+	size_t avail = dec->inlen - dec->inpos;
+	size_t made = 0;
+	size_t used = 0;
+
+	switch (dec->codec) {
+#ifdef HAVE_ZLIB_H
+	case CODEC_GZIP: {
+		z_stream *gz = &dec->s.gz;
+		int ret;
+
+		/* Another stream follows the one that ended */
+		if (dec->whole) {
+			inflateReset(gz);
+			dec->whole = FALSE;
+		}
+		gz->next_in = dec->in + dec->inpos;
+		gz->avail_in = (uInt)avail;
+		gz->next_out = out;
+		gz->avail_out = (uInt)((size > CODEC_PIECE) ? CODEC_PIECE : size);
+		made = gz->avail_out;
+		ret = inflate(gz, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+			error = EIO;
+			return -1;
+		}
+		dec->whole = (ret == Z_STREAM_END);
+		used = avail - gz->avail_in;
+		made -= gz->avail_out;
+		break;
+	}
+#endif
+#ifdef HAVE_LZMA_H
+	case CODEC_XZ: {
+		lzma_stream *xz = &dec->s.xz;
+		lzma_ret ret;
+
+		xz->next_in = dec->in + dec->inpos;
+		xz->avail_in = avail;
+		xz->next_out = out;
+		xz->avail_out = size;
+		/* Only then does liblzma tell whether the last stream is whole */
+		ret = lzma_code(xz, dec->eof ? LZMA_FINISH : LZMA_RUN);
+		if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+			error = EIO;
+			return -1;
+		}
+		dec->whole = (ret == LZMA_STREAM_END);
+		used = avail - xz->avail_in;
+		made = size - xz->avail_out;
+		break;
+	}
+#endif
+#ifdef HAVE_ZSTD_H
+	case CODEC_ZSTD: {
+		ZSTD_inBuffer in = { dec->in + dec->inpos, avail, 0 };
+		ZSTD_outBuffer ob = { out, size, 0 };
+		size_t ret;
+
+		ret = ZSTD_decompressStream(dec->s.zstd, &ob, &in);
+		if (ZSTD_isError(ret)) {
+			error = EIO;
+			return -1;
+		}
+		/* 0 is returned once a frame is decoded and flushed */
+		dec->whole = (ret == 0);
+		used = in.pos;
+		made = ob.pos;
+		break;
+	}
+#endif
+	default:
+		(void)avail;
+		(void)out;
+		(void)size;
+		break;
+	}
+
+	dec->inpos += used;
+	dec->consumed += used;
+	return (ssize_t)made;
+}
+
+/*
+ * Start a file compressed as codec. Return NULL if the library could not
+ * be set up.
+ */
+Encoder *encoder_open(Codec codec)
+{
+	Encoder *enc;
+	int ok = FALSE;
+
+	enc = malloc(sizeof(Encoder));
+	if (enc == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	enc->codec = codec;
+	enc->out = (unsigned char *)charalloc(CODEC_BLOCK);
+
+	switch (codec) {
+#ifdef HAVE_ZLIB_H
+	case CODEC_GZIP:
+		memset(&enc->s.gz, 0, sizeof(z_stream));
+		/* 16 tells zlib to write a gzip header */
+		ok = deflateInit2(&enc->s.gz, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+				Z_DEFAULT_STRATEGY) == Z_OK;
+		break;
+#endif
+#ifdef HAVE_LZMA_H
+	case CODEC_XZ:
+		memset(&enc->s.xz, 0, sizeof(lzma_stream));
+		ok = lzma_easy_encoder(&enc->s.xz, XZ_PRESET,
+				LZMA_CHECK_CRC64) == LZMA_OK;
+		break;
+#endif
+#ifdef HAVE_ZSTD_H
+	case CODEC_ZSTD:
+		enc->s.zstd = ZSTD_createCStream();
+		ok = enc->s.zstd != NULL &&
+			!ZSTD_isError(ZSTD_initCStream(enc->s.zstd, ZSTD_LEVEL));
+		break;
+#endif
+	default:
+		break;
+	}
+	if (!ok) {
+		enc->codec = CODEC_NONE;
+		encoder_close(enc);
+		return NULL;
+	}
+	return enc;
+}
+
+void encoder_close(Encoder *enc)
+{
+	switch (enc->codec) {
+#ifdef HAVE_ZLIB_H
+	case CODEC_GZIP:
+		deflateEnd(&enc->s.gz);
+		break;
+#endif
+#ifdef HAVE_LZMA_H
+	case CODEC_XZ:
+		lzma_end(&enc->s.xz);
+		break;
+#endif
+#ifdef HAVE_ZSTD_H
+	case CODEC_ZSTD:
+		ZSTD_freeCStream(enc->s.zstd);
+		break;
+#endif
+	default:
+		break;
+	}
+	free(enc->out);
+	free(enc);
+}
+
+/*
+ * Compress len characters of text and write whatever comes out to fd.
+ * Return 0 on success or -1 on error.
+ */
+int encoder_write(Encoder *enc, int fd, const char *text, size_t len)
+{
+	size_t n;
+
+	while (len > 0) {
+		n = (len > CODEC_PIECE) ? CODEC_PIECE : len;
+		if (encode(enc, fd, text, n, FALSE) != 0)
+			return -1;
+		text += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Write the rest of the compressed file to fd. Return 0 on success or -1
+ * on error.
+ */
+int encoder_finish(Encoder *enc, int fd)
+{
+	return encode(enc, fd, NULL, 0, TRUE);
+}
+
+/*
+ * Feed len characters of text to the library, all of what it has left if
+ * finish is TRUE, and write what comes out to fd block by block.
+ */
+static int encode(Encoder *enc, int fd, const char *text, size_t len,
+		bool finish)
+{
+	size_t made = 0;
+	bool done = TRUE;
+
+	do {
+		switch (enc->codec) {
+#ifdef HAVE_ZLIB_H
+		case CODEC_GZIP: {
+			z_stream *gz = &enc->s.gz;
+			int ret;
+
+			if (text != NULL) {
+				/* Suppress compiler warning, the text is only read */
+				gz->next_in = (Bytef *)text;
+				gz->avail_in = (uInt)len;
+				text = NULL;
+			}
+			gz->next_out = enc->out;
+			gz->avail_out = CODEC_BLOCK;
+			ret = deflate(gz, finish ? Z_FINISH : Z_NO_FLUSH);
+			if (ret == Z_STREAM_ERROR) {
+				error = EIO;
+				return -1;
+			}
+			made = CODEC_BLOCK - gz->avail_out;
+			done = finish ? ret == Z_STREAM_END :
+				gz->avail_in == 0 && gz->avail_out != 0;
+			break;
+		}
+#endif
+#ifdef HAVE_LZMA_H
+		case CODEC_XZ: {
+			lzma_stream *xz = &enc->s.xz;
+			lzma_ret ret;
+
+			if (text != NULL) {
+				xz->next_in = (const uint8_t *)text;
+				xz->avail_in = len;
+				text = NULL;
+			}
+			xz->next_out = enc->out;
+			xz->avail_out = CODEC_BLOCK;
+			ret = lzma_code(xz, finish ? LZMA_FINISH : LZMA_RUN);
+			if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+				error = EIO;
+				return -1;
+			}
+			made = CODEC_BLOCK - xz->avail_out;
+			done = finish ? ret == LZMA_STREAM_END :
+				xz->avail_in == 0 && xz->avail_out != 0;
+			break;
+		}
+#endif
+#ifdef HAVE_ZSTD_H
+		case CODEC_ZSTD: {
+			ZSTD_inBuffer in = { text, len, 0 };
+			ZSTD_outBuffer ob = { enc->out, CODEC_BLOCK, 0 };
+			size_t ret;
+
+			ret = finish ? ZSTD_endStream(enc->s.zstd, &ob) :
+				ZSTD_compressStream(enc->s.zstd, &ob, &in);
+			if (ZSTD_isError(ret)) {
+				error = EIO;
+				return -1;
+			}
+			text += in.pos;
+			len -= in.pos;
+			made = ob.pos;
+			/* When finishing, ret is what is left to be flushed */
+			done = finish ? ret == 0 : len == 0;
+			break;
+		}
+#endif
+		default:
+			(void)text;
+			(void)len;
+			(void)finish;
+			break;
+		}
+		if (write_out(fd, enc->out, made) != 0)
+			return -1;
+	} while (!done);
+
+	return 0;
+}
+
+static int write_out(int fd, const unsigned char *out, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, out, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error = errno;
+			return -1;
+		}
+		out += n;
+		len -= n;
+	}
+	return 0;
+}
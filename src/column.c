@@ -0,0 +1,290 @@
+/*
+ * This module converts between the index of a character of the current
+ * line and the screen column it is shown at. Only tabs make the two
+ * differ, so the columns of a buffer cache where the tabs of its current
+ * line are and which column the text after each of them starts at. Both
+ * conversions are then a binary search over the tabs.
+ *
+ * Like the text of the current line, the cache has a split at the place
+ * the line was last edited at. The tabs after the split are stored
+ * relative to dpos and dcol, which is what keeps editing cheap: a new
+ * character moves every tab after it one character to the right, but
+ * only changes the column of the first of them; the columns of the rest
+ * change by the same multiple of 8.
+ */
+
+#include "proto.h"
+#include <string.h>
+
+#define TAB_WIDTH 	8
+
+static void build(Buffer *buf);
+static size_t tab_pos(const Columns *cols, size_t k);
+static size_t tab_col(const Columns *cols, size_t k);
+static size_t tabs_before(const Columns *cols, size_t i);
+static size_t tabs_upto(const Columns *cols, size_t x);
+static size_t tab_end(const Columns *cols, size_t k, size_t pos);
+static void move_split(Columns *cols, size_t k);
+static void fix_split(Columns *cols);
+static void grow(Columns *cols);
+
+/*
+ * Position of the k-th tab of the cached line.
+ */
+static size_t tab_pos(const Columns *cols, size_t k)
+{
+	return k < cols->split ? cols->pos[k] : cols->pos[k] + cols->dpos;
+}
+
+/*
+ * Column the text after the k-th tab of the cached line starts at.
+ */
+static size_t tab_col(const Columns *cols, size_t k)
+{
+	return k < cols->split ? cols->col[k] : cols->col[k] + cols->dcol;
+}
+
+/*
+ * Number of tabs before the i-th character.
+ */
+static size_t tabs_before(const Columns *cols, size_t i)
+{
+	size_t lo = 0;
+	size_t hi = cols->ntabs;
+	size_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (tab_pos(cols, mid) < i)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Number of tabs the text after which starts at or before column x.
+ */
+static size_t tabs_upto(const Columns *cols, size_t x)
+{
+	size_t lo = 0;
+	size_t hi = cols->ntabs;
+	size_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (tab_col(cols, mid) <= x)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void grow(Columns *cols)
+{
+	cols->cap = (cols->cap == 0) ? 16 : 2 * cols->cap;
+	cols->pos = realloc(cols->pos, cols->cap * sizeof(size_t));
+	cols->col = realloc(cols->col, cols->cap * sizeof(size_t));
+	if (cols->pos == NULL || cols->col == NULL) {
+		fprintf(stderr, "%s: realloc failed\n", __func__);
+		finish();
+	}
+}
+
+/*
+ * Cache the tabs of the current line of buf.
+ */
+static void build(Buffer *buf)
+{
+	Columns *cols = &buf->columns;
+	size_t col = 0;
+	size_t i;
+	char c;
+
+	cols->ntabs = 0;
+	for (i = 0; i < buf->curln->len; i++) {
+		c = CURLN_CHAR(buf, i);
+		if (c == '\n')
+			break;
+		if (c == '\t') {
+			col += TAB_WIDTH - col % TAB_WIDTH;
+			if (cols->ntabs == cols->cap)
+				grow(cols);
+			cols->pos[cols->ntabs] = i;
+			cols->col[cols->ntabs] = col;
+			cols->ntabs++;
+		}
+		else {
+			col++;
+		}
+	}
+	cols->end = i;
+	cols->split = cols->ntabs;
+	cols->dpos = 0;
+	cols->dcol = 0;
+	cols->line = buf->curln;
+}
+
+/*
+ * Move the split of cols in front of the k-th tab.
+ */
+static void move_split(Columns *cols, size_t k)
+{
+	for (; cols->split < k; cols->split++) {
+		cols->pos[cols->split] += cols->dpos;
+		cols->col[cols->split] += cols->dcol;
+	}
+	for (; cols->split > k; cols->split--) {
+		cols->pos[cols->split - 1] -= cols->dpos;
+		cols->col[cols->split - 1] -= cols->dcol;
+	}
+}
+
+/*
+ * Return the column the text after a tab at pos starts at, if the k-th
+ * tab, which must be before the split, is the one after which it comes.
+ */
+static size_t tab_end(const Columns *cols, size_t k, size_t pos)
+{
+	size_t start = 0;
+	size_t col = 0;
+
+	if (k > 0) {
+		start = cols->pos[k - 1] + 1;
+		col = cols->col[k - 1];
+	}
+	col += pos - start;
+	return col + TAB_WIDTH - col % TAB_WIDTH;
+}
+
+/*
+ * Recompute dcol after the text right before the split has changed. Only
+ * the first tab after the split needs to be looked at.
+ */
+static void fix_split(Columns *cols)
+{
+	size_t k = cols->split;
+
+	if (k < cols->ntabs)
+		cols->dcol = tab_end(cols, k, tab_pos(cols, k)) - cols->col[k];
+}
+
+/*
+ * Return the column the i-th character of the current line of buf is
+ * shown at.
+ */
+size_t column_of(Buffer *buf, size_t i)
+{
+	Columns *cols = &buf->columns;
+	size_t k;
+
+	if (cols->line != buf->curln)
+		build(buf);
+	if (i > cols->end)
+		i = cols->end;
+	if ((k = tabs_before(cols, i)) == 0)
+		return i;
+	return tab_col(cols, k - 1) + (i - tab_pos(cols, k - 1) - 1);
+}
+
+/*
+ * Return the index of the character of the current line of buf that is
+ * shown at column x, or the end of the line if it is shorter than that.
+ */
+size_t index_at(Buffer *buf, size_t x)
+{
+	Columns *cols = &buf->columns;
+	size_t start = 0;
+	size_t col = 0;
+	size_t limit;
+	size_t k;
+
+	if (cols->line != buf->curln)
+		build(buf);
+	if ((k = tabs_upto(cols, x)) > 0) {
+		start = tab_pos(cols, k - 1) + 1;
+		col = tab_col(cols, k - 1);
+	}
+	/* Up to the next tab, which covers every column before its end */
+	limit = (k < cols->ntabs) ? tab_pos(cols, k) : cols->end;
+	if (start + (x - col) > limit)
+		return limit;
+	return start + (x - col);
+}
+
+/*
+ * Record that c has been inserted into the current line of buf as its
+ * i-th character.
+ */
+void column_insert(Buffer *buf, size_t i, char c)
+{
+	Columns *cols = &buf->columns;
+	size_t k;
+
+	if (cols->line != buf->curln)
+		return;
+	k = tabs_before(cols, i);
+	move_split(cols, k);
+
+	if (c == '\t') {
+		if (cols->ntabs == cols->cap)
+			grow(cols);
+		memmove(cols->pos + k + 1, cols->pos + k,
+				(cols->ntabs - k) * sizeof(size_t));
+		memmove(cols->col + k + 1, cols->col + k,
+				(cols->ntabs - k) * sizeof(size_t));
+		cols->ntabs++;
+		/* The new tab goes in front of the split */
+		cols->pos[k] = i;
+		cols->col[k] = tab_end(cols, k, i);
+		cols->split++;
+	}
+	cols->dpos++;
+	cols->end++;
+	fix_split(cols);
+}
+
+/*
+ * Record that c, the i-th character of the current line of buf, has been
+ * deleted.
+ */
+void column_delete(Buffer *buf, size_t i, char c)
+{
+	Columns *cols = &buf->columns;
+	size_t k;
+
+	if (cols->line != buf->curln)
+		return;
+	k = tabs_before(cols, i);
+	move_split(cols, k);
+
+	if (c == '\t') {
+		memmove(cols->pos + k, cols->pos + k + 1,
+				(cols->ntabs - k - 1) * sizeof(size_t));
+		memmove(cols->col + k, cols->col + k + 1,
+				(cols->ntabs - k - 1) * sizeof(size_t));
+		cols->ntabs--;
+	}
+	cols->dpos--;
+	cols->end--;
+	fix_split(cols);
+}
+
+/*
+ * Forget the cache if it is about line, which is changed or freed by
+ * other means than column_insert() and column_delete().
+ */
+void column_forget(Buffer *buf, const Line *line)
+{
+	if (buf->columns.line == line)
+		buf->columns.line = NULL;
+}
+
+void column_destroy(Buffer *buf)
+{
+	free(buf->columns.pos);
+	free(buf->columns.col);
+	memset(&buf->columns, 0, sizeof(Columns));
+}
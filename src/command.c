@@ -0,0 +1,280 @@
+/*
+ * This module contains the commands that ask the user something or that
+ * switch between buffers. They work on the current buffer and leave the
+ * editing itself to the core.
+ */
+
+#include "proto.h"
+#include <string.h>
+#include <sys/stat.h>
+
+/* Where the cursor was when the search being typed started */
+static struct {
+	size_t n;
+	int x;
+	size_t top;
+	Direction dir;
+} origin;
+
+static void go_back();
+static void search_changed(const char *text);
+
+/*
+ * Save buf, asking for a path if it has none and before overwriting a
+ * file. Answering no forgets the path.
+ */
+void save_as(Buffer *buf)
+{
+	struct stat filestat;
+
+	if (read_only(buf))
+		return;
+	if (buf->path == NULL) {
+		buf->path = prompt_str("File name to save: ");
+		if (buf->path == NULL)
+			return;
+	}
+
+	if (stat(buf->path, &filestat) == 0 && S_ISREG(filestat.st_mode) &&
+			prompt_ync("`%s' already exists, overwrite?", buf->path) != YES) {
+		free(buf->path);
+		buf->path = NULL;
+		return;
+	}
+	save_buffer(buf);
+}
+
+void do_save()
+{
+	save_as(curbuf);
+}
+
+/*
+ * Close the current buffer, asking to save it first if it is modified.
+ * Closing the only buffer exits the program.
+ */
+void close_buffer()
+{
+	Buffer *buf = curbuf;
+
+	if (buf->modified) {
+		switch (prompt_ync("Save modified buffer `%s`?",
+					buf->path != NULL ? buf->path : "Untitled")) {
+		case YES:
+			save_as(buf);
+			if (buf->modified)
+				return;
+			break;
+		case NO:
+			break;
+		default:
+			return;
+		}
+	}
+	if (firstbuf == lastbuf) {
+		journal_close(buf, TRUE);
+		finish();
+	}
+
+	curbuf = (buf->next != NULL) ? buf->next : buf->prev;
+	/* A search may still be reading the text */
+	findall_forget(buf);
+	follow_stop(buf);
+	delete_buffer(buf);
+	display_buffer();
+}
+
+void do_prev_buf()
+{
+	if (curbuf != firstbuf) {
+		curbuf = curbuf->prev;
+		display_buffer();
+	}
+}
+
+void do_next_buf()
+{
+	if (curbuf != lastbuf) {
+		curbuf = curbuf->next;
+		display_buffer();
+	}
+}
+
+/*
+ * Ask for a line number and go there.
+ */
+void do_goto_line()
+{
+	char *answer;
+	char *end;
+	unsigned long n;
+
+	answer = prompt_str("Go to line: ");
+	if (answer == NULL)
+		return;
+
+	n = strtoul(answer, &end, 10);
+	if (end == answer || *end != '\0') {
+		print_msg_prompt("`%s' is not a line number", answer);
+	}
+	else {
+		go_to(curbuf, n, 0);
+	}
+	free(answer);
+}
+
+/*
+ * Move the cursor of the current buffer back to where the search being
+ * typed started, with the same line at the top of the screen.
+ */
+static void go_back()
+{
+	size_t rows = LINES - MAINWIN_OFFSET;
+
+	go_to(curbuf, origin.n, origin.x);
+	if (origin.n >= origin.top && origin.n - origin.top < rows &&
+			line_number(curbuf, curbuf->topln) != origin.top) {
+		curbuf->topln = line_at(curbuf, origin.top);
+		curbuf->y_pos = origin.n - line_number(curbuf, curbuf->topln);
+		display_buffer();
+	}
+}
+
+/*
+ * Called by prompt_str_live() whenever the pattern being typed changes:
+ * search for it from where the search started.
+ */
+static void search_changed(const char *text)
+{
+	size_t n;
+	size_t x = origin.x;
+
+	go_back();
+	if (*text == '\0')
+		return;
+	search_set(text);
+	if (search_buffer(curbuf, origin.dir, TRUE, &n, &x))
+		go_to(curbuf, n, x);
+	else
+		beep();
+}
+
+/*
+ * Ask for a pattern and search for it as it is typed. Entering nothing
+ * searches for the previous pattern again, from after the cursor.
+ */
+void do_search(Direction dir)
+{
+	char *answer;
+	size_t n;
+	size_t x;
+
+	collapse_gap(curbuf);
+	origin.n = line_number(curbuf, curbuf->curln);
+	origin.x = curbuf->x_pos;
+	origin.top = line_number(curbuf, curbuf->topln);
+	origin.dir = dir;
+
+	answer = prompt_str_live(search_changed,
+			(dir == DOWN) ? "Search: " : "Search backward: ");
+	if (answer == NULL) {
+		go_back();
+		return;
+	}
+
+	if (*answer == '\0') {
+		free(answer);
+		if (search_text() == NULL)
+			return;
+		x = curbuf->x_pos;
+		if (search_buffer(curbuf, dir, FALSE, &n, &x))
+			go_to(curbuf, n, x);
+		else
+			print_msg_prompt("`%s' not found", search_text());
+		return;
+	}
+
+	n = line_number(curbuf, curbuf->curln);
+	if (n == origin.n && curbuf->x_pos == origin.x) {
+		x = origin.x;
+		if (!search_buffer(curbuf, dir, TRUE, &n, &x))
+			print_msg_prompt("`%s' not found", answer);
+	}
+	free(answer);
+}
+
+/*
+ * Ask for a regular expression and go to its next match after the
+ * cursor, wrapping around the end of the buffer.
+ */
+void do_regex_search()
+{
+	static char *last;
+	const char *error;
+	char *answer;
+	Regex *re;
+	size_t n;
+	size_t x;
+	bool found;
+
+	answer = prompt_str("Regex search: ");
+	if (answer == NULL)
+		return;
+	/* Nothing searches for the previous one again */
+	if (*answer == '\0' && last != NULL) {
+		free(answer);
+		answer = charalloc(strlen(last) + 1);
+		strcpy(answer, last);
+	}
+	if ((re = regex_compile(answer, &error)) == NULL) {
+		print_msg_prompt("`%s': %s", answer, error);
+		free(answer);
+		return;
+	}
+	free(last);
+	last = answer;
+
+	found = regex_search(curbuf, re, &n, &x);
+	regex_free(re);
+
+	if (found)
+		go_to(curbuf, n, (int)x);
+	else
+		print_msg_prompt("`%s' not found", last);
+}
+
+/*
+ * Ask for a regular expression and what to replace it with, and replace
+ * every match in the buffer in one go.
+ */
+void do_regex_replace()
+{
+	const char *error;
+	char *pattern;
+	char *with;
+	size_t count;
+	Regex *re;
+
+	if (read_only(curbuf))
+		return;
+	pattern = prompt_str("Replace regex: ");
+	if (pattern == NULL)
+		return;
+	if ((re = regex_compile(pattern, &error)) == NULL) {
+		print_msg_prompt("`%s': %s", pattern, error);
+		free(pattern);
+		return;
+	}
+	with = prompt_str("Replace `%s' with: ", pattern);
+	if (with == NULL) {
+		regex_free(re);
+		free(pattern);
+		return;
+	}
+
+	count = regex_replace(curbuf, re, with);
+	regex_free(re);
+	print_msg_prompt("Replaced %zu matches of `%s'", count, pattern);
+	free(pattern);
+	free(with);
+}
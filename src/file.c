@@ -8,36 +8,106 @@
 #include <sys/types.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+/* Size of the blocks read() pulls from files that cannot be mapped */
+#define READ_BLOCK_SIZE	(64 * 1024)
+/* Number of pieces of text gathered into a single writev() */
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define WRITE_IOVS		IOV_MAX
+#else
+#define WRITE_IOVS		1024
+#endif
+
+/* The temporary file opened by open_file() in "w" mode and its target */
+static char *temp_path = NULL;
+static char *target_path = NULL;
+
+static void init_text(Buffer *buf);
+static void free_text(Buffer *buf);
+static void append_line(Buffer *buf, const char *text, size_t len);
+static int map_original(Buffer *buf, int fd);
+static void read_original(Buffer *buf, int fd);
+static void decode_original(Buffer *buf, int fd);
+static void split_original(Buffer *buf);
+static FILE *open_temp(const char *path, const struct stat *filestat);
+static int write_text(Buffer *buf, int fd, Encoder *enc);
+static int gather(int fd, Encoder *enc, struct iovec *iov, int *iovcnt,
+		const char *text, size_t len);
+static int write_all(int fd, Encoder *enc, struct iovec *iov, int iovcnt);
+static int sync_dir(const char *path);
 
 /*
- * Open a new buffer according to path.
+ * Open a new buffer according to path and return it.
  */
-void open_buffer(const char *path)
+Buffer *open_buffer(const char *path)
 {
+	long start = stats_clock();
+	Buffer *buf;
 	FILE *fs;
 
 	/* No path was given. Just create a blank buffer.*/
 	if (path == NULL) {
-		push_back_buffer(NULL);
-		push_back_line(NULL);
+		buf = push_back_buffer(NULL);
+		push_back_line(buf, NULL);
 	} 
 	/* A path was given */
 	else {
 		fs = open_file(path, "r");
 		if (fs != NULL) {
-			push_back_buffer(path);
-			read_into_buffer(fs);
+			buf = push_back_buffer(path);
+			read_into_buffer(buf, fs);
+			fclose(fs);
+			/* The loader counts the time it takes itself */
+			if (buf->loader == NULL)
+				stats_add(STAT_LOAD, start);
 		} 
 		/*
 		 * File does not exist, opening a new buffer with the given path.
 		 * Later when saving the buffer, we check if path is valid or not.
 		 */
 		else {
-			push_back_buffer(path);
-			push_back_line(NULL);
+			buf = push_back_buffer(path);
+			push_back_line(buf, NULL);
 		}
 	}
-	curbuf = firstbuf;
+	return buf;
+}
+
+/*
+ * Set buf up to hold no text yet.
+ */
+static void init_text(Buffer *buf)
+{
+	buf->firstln = NULL;
+	buf->lastln = NULL;
+	buf->curln = NULL;
+	buf->topln = NULL;
+	buf->x_pos = 0;
+	buf->y_pos = 0;
+	buf->visual_x = 0;
+	buf->left_col = 0;
+	buf->gap = 0;
+	buf->gaplen = 0;
+	buf->modified = FALSE;
+	buf->orig = NULL;
+	buf->origsize = 0;
+	buf->orig_mapped = FALSE;
+	buf->orig_dev = 0;
+	buf->orig_ino = 0;
+	buf->codec = CODEC_NONE;
+	pool_init(&buf->pool);
+	memset(&buf->index, 0, sizeof(Index));
+	memset(&buf->columns, 0, sizeof(Columns));
+	scan_init(&buf->scan);
+	buf->lazy = NULL;
+	buf->loader = NULL;
+	buf->undo = NULL;
 }
 
 /*
@@ -59,21 +129,17 @@ Buffer *new_buffer()
 		buf->id = 0;
 	}
 	buf->path = NULL;
-	buf->firstln = NULL;
-	buf->lastln = NULL;
-	buf->curln = NULL;
-	buf->topln = NULL;
-	buf->x_pos = 0;
-	buf->y_pos = 0;
-	buf->visual_x = 0;
-	buf->modified = FALSE;
-	buf->prev = NULL;
+	init_text(buf);
+	buf->results = NULL;
+	buf->journal = NULL;
+	buf->follow = NULL;
 	buf->prev = NULL;
+	buf->next = NULL;
 
 	return buf;
 }
 
-void push_back_buffer(const char *path)
+Buffer *push_back_buffer(const char *path)
 {
 	Buffer *nbuf;
 
@@ -98,13 +164,245 @@ void push_back_buffer(const char *path)
 	}
 	/* Make the new buffer the last buffer */
 	lastbuf = nbuf;
-	/* Make current buffer the last buffer */
-	curbuf = nbuf;
+
+	return nbuf;
+}
+
+/*
+ * Free all of the lines of buf and its original text. Line nodes and
+ * short text go back with the pool in one go.
+ */
+static void free_text(Buffer *buf)
+{
+	Line *it;
+
+	/* The loader is still reading the original text */
+	if (buf->loader != NULL)
+		loader_close(buf);
+
+	/* Only text longer than POOL_TEXT_MAX lives outside of the pool */
+	for (it = buf->firstln; it != NULL; it = it->next) {
+		if (it->memsize > POOL_TEXT_MAX)
+			free(it->text);
+	}
+	pool_destroy(&buf->pool);
+	index_destroy(buf);
+	column_destroy(buf);
+	undo_destroy(buf);
+	if (buf->lazy != NULL)
+		lazy_close(buf);
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+	if (buf->orig_mapped)
+		munmap(buf->orig, buf->origsize);
+	else
+#endif
+		free(buf->orig);
+}
+
+/*
+ * Unlink buf from the list of buffers and free it along with all of its
+ * lines.
+ */
+void delete_buffer(Buffer *buf)
+{
+	if (buf->prev != NULL)
+		buf->prev->next = buf->next;
+	else
+		firstbuf = buf->next;
+	if (buf->next != NULL)
+		buf->next->prev = buf->prev;
+	else
+		lastbuf = buf->prev;
+
+	free_text(buf);
+	/* Whatever was not saved has been thrown away */
+	journal_close(buf, TRUE);
+	free(buf->path);
+	free(buf);
+}
+
+/*
+ * Read the file of buf again, throwing away what buf holds. The file is
+ * read into memory rather than mapped, for it may be truncated under our
+ * feet. Return 0 on success or -1 if the file cannot be opened, in which
+ * case buf is left as it is.
+ */
+int reload_buffer(Buffer *buf)
+{
+	FILE *fs;
+
+	assert(buf->path != NULL);
+
+	if ((fs = open_file(buf->path, "r")) == NULL)
+		return -1;
+	free_text(buf);
+	init_text(buf);
+	read_original(buf, fileno(fs));
+	split_original(buf);
+	fclose(fs);
+	render->all(buf);
+	return 0;
+}
+
+/*
+ * Copy the original text of buf into memory if it is mapped, so that
+ * truncating the file cannot pull the pages from under its lines. buf
+ * must not be lazy or loading.
+ */
+void copy_original(Buffer *buf)
+{
+	char *text;
+	Line *it;
+
+	if (!buf->orig_mapped)
+		return;
+	text = charalloc(buf->origsize);
+	memcpy(text, buf->orig, buf->origsize);
+	for (it = buf->firstln; it != NULL; it = it->next) {
+		if (it->memsize == 0 && it->text >= buf->orig &&
+				it->text <= buf->orig + buf->origsize)
+			it->text = text + (it->text - buf->orig);
+	}
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+	munmap(buf->orig, buf->origsize);
+#endif
+	buf->orig = text;
+	buf->orig_mapped = FALSE;
+}
+
+/*
+ * Create a temporary file in the directory of the file path refers to,
+ * with the permissions and, if possible, the owner of that file if it
+ * exists (filestat), to be renamed over it by commit_temp().
+ */
+static FILE *open_temp(const char *path, const struct stat *filestat)
+{
+	const char *name;
+	mode_t mask;
+	FILE *fs;
+	int fd;
+
+	/* Write through symbolic links rather than replacing them */
+	if (filestat == NULL || (target_path = realpath(path, NULL)) == NULL) {
+		target_path = charalloc(strlen(path) + 1);
+		strcpy(target_path, path);
+	}
+	name = file_name(target_path);
+	temp_path = charalloc(strlen(target_path) + sizeof("..XXXXXX"));
+	sprintf(temp_path, "%.*s.%s.XXXXXX", (int)(name - target_path), 
+			target_path, name);
+
+	if ((fd = mkstemp(temp_path)) < 0) {
+		error = errno;
+		goto failure;
+	}
+	/* mkstemp() creates the file with 0600 */
+	if (filestat != NULL) {
+		/* Only root can give a file away, the group may still be kept */
+		if (fchown(fd, filestat->st_uid, filestat->st_gid) != 0)
+			fchown(fd, -1, filestat->st_gid);
+		fchmod(fd, filestat->st_mode & 07777);
+	}
+	else {
+		mask = umask(0);
+		umask(mask);
+		fchmod(fd, 0666 & ~mask);
+	}
+	if ((fs = fdopen(fd, "w")) == NULL) {
+		error = errno;
+		close(fd);
+		unlink(temp_path);
+		goto failure;
+	}
+	return fs;
+
+failure:
+	free(temp_path);
+	free(target_path);
+	temp_path = target_path = NULL;
+	errno = error;
+	return NULL;
+}
+
+/*
+ * Close fs, which was opened by open_file() in "w" mode, and move the
+ * temporary file in place, syncing it to the disk first as sync_policy
+ * says. If failed is TRUE, writing to fs went wrong and the temporary
+ * file is only removed. Return 0 on success or -1 on error, in which case
+ * the temporary file is removed.
+ */
+int commit_temp(FILE *fs, bool failed)
+{
+	int retval = failed ? -1 : 0;
+
+	if (retval == 0 && ferror(fs) != 0) {
+		error = EIO;
+		retval = -1;
+	}
+	/* Without it a crash may leave an empty file behind the rename */
+	if (retval == 0 && sync_policy != SYNC_NONE && fsync(fileno(fs)) != 0) {
+		error = errno;
+		retval = -1;
+	}
+	if (fclose(fs) != 0 && retval == 0) {
+		error = errno;
+		retval = -1;
+	}
+	if (retval == 0 && rename(temp_path, target_path) != 0) {
+		error = errno;
+		retval = -1;
+	}
+	/* The rename itself is only durable once the directory is synced */
+	if (retval == 0 && sync_policy == SYNC_ALL && sync_dir(target_path) != 0) {
+		error = errno;
+		retval = -1;
+	}
+	if (retval != 0) {
+		unlink(temp_path);
+	}
+	free(temp_path);
+	free(target_path);
+	temp_path = target_path = NULL;
+
+	return retval;
+}
+
+/*
+ * Sync the directory that holds the file path refers to.
+ */
+static int sync_dir(const char *path)
+{
+	const char *name = file_name(path);
+	char *dir;
+	int fd;
+	int retval;
+
+	if (name == path) {
+		dir = charalloc(2);
+		strcpy(dir, ".");
+	}
+	else {
+		dir = charalloc(name - path + 1);
+		memcpy(dir, path, name - path);
+		dir[name - path] = '\0';
+	}
+	fd = open(dir, O_RDONLY);
+	free(dir);
+	if (fd < 0)
+		return -1;
+	retval = fsync(fd);
+	close(fd);
+
+	return retval;
 }
 
 /*
  * Check if path is a valid path or not.
  * Return a filestream if path is valid or null otherwise.
+ *
+ * In "w" mode the stream is a new temporary file next to path, which is
+ * renamed over path by commit_temp(); the file itself is never truncated.
  */
 FILE *open_file(const char *path, const char *mode)
 {
@@ -143,23 +441,16 @@ FILE *open_file(const char *path, const char *mode)
 			goto error_handling;
 		}
 		else if (S_ISREG(filestat.st_mode)) {
-			fs = fopen(path, mode);
+			if (strcmp(mode, "w") == 0) {
+				fs = open_temp(path, &filestat);
+			}
+			else {
+				fs = fopen(path, mode);
+			}
 			if (fs == NULL) {
 				error = errno;
 				goto error_handling;
 			}
-			if (strcmp(mode, "w") == 0) {
-				switch (prompt_ync("`%s' already exists, overwrite?", path)) {
-				case YES:
-					break;
-				case NO:
-					return NULL;
-				case CANCEL:
-					return NULL;
-				default:
-					return NULL;
-				}
-			}
 			return fs;
 		}
 	}
@@ -168,7 +459,7 @@ FILE *open_file(const char *path, const char *mode)
 			return NULL;
 		}
 		else if (strcmp(mode, "w") == 0) {
-			fs = fopen(path, mode);
+			fs = open_temp(path, NULL);
 			if (fs == NULL) {
 				error = errno;
 				goto error_handling;
@@ -180,161 +471,340 @@ FILE *open_file(const char *path, const char *mode)
 error_handling:
 	if (strerr == NULL) {
 		strerr = "'%s': %s";
-		print_msg_prompt(strerr, path, strerror(error));
+		render_msg(strerr, path, strerror(error));
 	}
 	else {
-		print_msg_prompt(strerr, path);
+		render_msg(strerr, path);
 	}
 
 	return fs;
 }
 
 /*
- * Read in the entire file associated with fs
+ * Read in the entire file associated with fs. The contents are kept as the
+ * original text of buf: regular files are mapped into memory, anything
+ * that cannot be mapped (e.g. the files under /proc, which report a zero
+ * size) is read in large blocks instead. Lines point straight into the
+ * original text and are only copied once they are modified.
+ *
+ * A mapped file is split into lines in the background by the loader, so
+ * that this returns before the file has been read from the disk. So is a
+ * compressed file, which the loader decodes while it is being split.
  */
-void read_into_buffer(FILE *fs)
+void read_into_buffer(Buffer *buf, FILE *fs)
 {
-	int ch;
-	int i = 0;
-	char *buf;
-	Line *line;
-	size_t buffer_mem = BUFFER_SIZE;
+	int fd;
 
 	assert(fs != NULL);
 
-	buf = charalloc(BUFFER_SIZE);
-	buf[0] = '\0';
-	line = new_line();
+	fd = fileno(fs);
+	buf->codec = codec_of(fd);
+	if (buf->codec != CODEC_NONE) {
+		if (loader_decode(buf, fd) == 0)
+			return;
+		decode_original(buf, fd);
+	}
+	else if (map_original(buf, fd) != 0) {
+		read_original(buf, fd);
+	}
+	else if (lazy_all || buf->origsize >= LAZY_THRESHOLD) {
+		lazy_open(buf);
+		return;
+	}
+	else if (loader_open(buf) == 0) {
+		return;
+	}
+	split_original(buf);
+}
 
-	/* Read the whole file into the buffer */
-	while ((ch = fgetc(fs)) != EOF) {
-		/* First we check if there is enough room for storing characters */
-		if (i == (buffer_mem - 1)) {
-			buffer_mem += BUFFER_SIZE;
-			buf = charrealloc(buf, buffer_mem);
+/*
+ * Split all of the original text of buf into lines.
+ */
+static void split_original(Buffer *buf)
+{
+	size_t nl[SCAN_BATCH];
+	size_t off = 0;
+	size_t prev;
+	size_t n;
+	size_t i;
+
+	/* Find line boundaries in a single pass */
+	do {
+		n = scan_lines(&buf->scan, buf->orig + off, 
+				buf->origsize - off, nl, SCAN_BATCH);
+		for (i = 0, prev = 0; i < n; prev = nl[i++]) {
+			append_line(buf, buf->orig + off + prev, nl[i] - prev);
 		}
+		off += prev;
+	} while (n == SCAN_BATCH);
+	scan_finish(&buf->scan);
+	/* The last line does not end with '\n' */
+	if (off < buf->origsize) {
+		append_line(buf, buf->orig + off, buf->origsize - off);
+	}
+	/* An empty file still has one (empty) line */
+	if (buf->firstln == NULL) {
+		push_back_line(buf, NULL);
+	}
+}
+
+/*
+ * Map the file associated with fd as the original text of buf.
+ * Return 0 on success or -1 if the file cannot be mapped.
+ *
+ * The mapping is private, yet truncating the file under our feet would
+ * still pull the pages away. save_buffer() never truncates a file, it
+ * renames a new one over it.
+ */
+static int map_original(Buffer *buf, int fd)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+	struct stat filestat;
+	char *map;
+	size_t size;
 
-		/* Store ch and null-terminate buf */
-		buf[i++] = (char)ch;
-		buf[i] = '\0';
+	if (fstat(fd, &filestat) != 0 || !S_ISREG(filestat.st_mode) ||
+			filestat.st_size <= 0) {
+		return -1;
+	}
+	size = (size_t)filestat.st_size;
 
-		/* A new line */
-		if ((char)ch == '\n') {
-			line->text = buf;
-			line->len = i;
-			line->memsize = buffer_mem;
-			push_back_line(line);
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+#ifdef HAVE_MADVISE
+	madvise(map, size, MADV_SEQUENTIAL);
+#endif
+
+	buf->orig = map;
+	buf->origsize = size;
+	buf->orig_mapped = TRUE;
+	buf->orig_dev = filestat.st_dev;
+	buf->orig_ino = filestat.st_ino;
+
+	return 0;
+#else
+	return -1;
+#endif
+}
 
-			memset(buf, 0, i + 1);
-			buffer_mem = BUFFER_SIZE;
-			i = 0;
+/*
+ * Read the file associated with fd block by block into the original text
+ * of buf.
+ */
+static void read_original(Buffer *buf, int fd)
+{
+	char *text = NULL;
+	size_t size = 0;
+	size_t mem = 0;
+	ssize_t nread;
+
+	while (TRUE) {
+		if (size + READ_BLOCK_SIZE > mem) {
+			mem = (mem == 0) ? READ_BLOCK_SIZE : 2 * mem;
+			text = charrealloc(text, mem);
+		}
+		nread = read(fd, text + size, mem - size);
+		if (nread == 0) {
+			break;
 		}
+		else if (nread < 0) {
+			if (errno == EINTR)
+				continue;
+			error = errno;
+			render_msg("Read error: %s", strerror(error));
+			break;
+		}
+		size += nread;
 	}
-	/*
-	 * If we have an empty file or if we only have one line and 
-	 * it does not have '\n' at its end, handle it. It also handles
-	 * the lastln line of the file.
-	 */
-	if (curbuf->firstln == NULL || buf[0] != '\0') {
-		line->text = buf;
-		line->len = i;
-		line->memsize = buffer_mem;
-		push_back_line(line);
+
+	if (size == 0) {
+		free(text);
+		text = NULL;
 	}
-	delete_line(line);
+	buf->orig = text;
+	buf->origsize = size;
+	buf->orig_mapped = FALSE;
 }
 
 /*
- * Initialize line.
+ * Decode the file associated with fd, which is compressed as the codec of
+ * buf says, into the original text of buf. The file is read as it is if
+ * it cannot be decoded at all.
  */
-Line *new_line()
+static void decode_original(Buffer *buf, int fd)
+{
+	Decoder *dec;
+	char *text = NULL;
+	size_t size = 0;
+	size_t mem = 0;
+	ssize_t n;
+
+	if ((dec = decoder_open(buf->codec, fd)) == NULL) {
+		render_msg("Could not decompress `%s'", file_name(buf->path));
+		buf->codec = CODEC_NONE;
+		read_original(buf, fd);
+		return;
+	}
+	while (TRUE) {
+		if (size + READ_BLOCK_SIZE > mem) {
+			mem = (mem == 0) ? READ_BLOCK_SIZE : 2 * mem;
+			text = charrealloc(text, mem);
+		}
+		n = decoder_read(dec, text + size, mem - size);
+		if (n == 0) {
+			break;
+		}
+		else if (n < 0) {
+			render_msg("Could not decompress `%s': %s",
+					file_name(buf->path), strerror(error));
+			break;
+		}
+		size += n;
+	}
+	decoder_close(dec);
+
+	if (size == 0) {
+		free(text);
+		text = NULL;
+	}
+	buf->orig = text;
+	buf->origsize = size;
+	buf->orig_mapped = FALSE;
+}
+
+/*
+ * Make sure line, which belongs to buf, owns its text and has room for at
+ * least size characters. A line that points into the original text gets
+ * a copy of it.
+ */
+void own_line(Buffer *buf, Line *line, size_t size)
+{
+	char *text;
+
+	if (size < line->len)
+		size = line->len;
+
+	if (line->memsize == 0) {
+		text = text_alloc(&buf->pool, &size);
+		memcpy(text, line->text, line->len);
+		line->text = text;
+		line->memsize = size;
+	}
+	else if (line->memsize < size) {
+		if (size < 2 * line->memsize)
+			size = 2 * line->memsize;
+		line->text = text_realloc(&buf->pool, line->text, line->memsize, &size);
+		line->memsize = size;
+	}
+}
+
+/*
+ * Make a new line out of len characters of the original text and push it
+ * at the back of the linked list. The text is not copied.
+ */
+static void append_line(Buffer *buf, const char *text, size_t len)
+{
+	Line *nline;
+
+	nline = new_line(buf);
+	/* Suppress compiler warning, the original text is never written to */
+	nline->text = (char *)text;
+	nline->len = len;
+
+	link_line(buf, nline);
+}
+
+/*
+ * Initialize line. The node comes from the pool of buf.
+ */
+Line *new_line(Buffer *buf)
 {
 	Line *line;
 
-	line = malloc(sizeof(Line));
+	line = pool_line(&buf->pool);
 
 	line->text = NULL;
 	line->len = 0;
 	line->memsize = 0;
-	line->line_no = 0;
+	line->block = NULL;
 	line->next = NULL;
 	line->prev = NULL;
 
 	return line;
 }
 
-void delete_line(Line *line)
+void delete_line(Buffer *buf, Line *line)
 {
-	free(line->text);
-	free(line);
+	column_forget(buf, line);
+	text_free(&buf->pool, line->text, line->memsize);
+	pool_free_line(&buf->pool, line);
 }
 
 /*
  * Make a new line with text of len characters. Push the new line at 
  * the back of the linked list.
  */
-void push_back_line(const Line *line)
+void push_back_line(Buffer *buf, const Line *line)
 {
 	Line *nline;
 
-	nline = new_line();
+	nline = new_line(buf);
 	if (line != NULL && line->text != NULL) {
-		nline->text = charalloc(line->memsize);
-		strcpy(nline->text, line->text);
+		nline->memsize = line->memsize > line->len ? line->memsize : line->len;
+		nline->text = text_alloc(&buf->pool, &nline->memsize);
+		memcpy(nline->text, line->text, line->len);
 		nline->len = line->len;
-		nline->memsize = line->memsize;
 	} else {
-		nline->text = charalloc(BUFFER_SIZE);
 		nline->memsize = BUFFER_SIZE;
+		nline->text = text_alloc(&buf->pool, &nline->memsize);
 	}
+	link_line(buf, nline);
+}
 
+/*
+ * Link nline at the back of the linked list of buf.
+ */
+void link_line(Buffer *buf, Line *nline)
+{
 	/* If not the first line, link the last line to the new line */
-	if (curbuf->lastln != NULL) {
-		nline->prev = curbuf->lastln;
+	if (buf->lastln != NULL) {
+		nline->prev = buf->lastln;
 		nline->next = NULL;
-		curbuf->lastln->next = nline;
-
-		/* nline->line_no = curbuf->lastln->line_no + 1; */
+		buf->lastln->next = nline;
 	}
 	/* If the first line, link the first line to the new line */
-	else if (curbuf->firstln == NULL) {
+	else if (buf->firstln == NULL) {
 		nline->prev = NULL;
 		nline->next = NULL;
-		curbuf->firstln = nline;
-		curbuf->topln = nline;
+		buf->firstln = nline;
+		buf->topln = nline;
 		/* Make the current line line the first line */
-		curbuf->curln = nline;
-
-		/* nline->line_no = 1; */
+		buf->curln = nline;
 	}
 	/* Make the new line the last line */
-	curbuf->lastln = nline;
+	buf->lastln = nline;
+	index_append(buf, nline);
 }
 
 /*
- * Make a new line with text of len characters and insert it after the line 
- * pointed by ptr. If ptr points to the last line, call push_back_line() instead.
- * We do not advance curbuf->curln to point to the new line.
+ * Insert nline after the line pointed by ptr. If ptr points to the last
+ * line, call link_line() instead.
+ * We do not advance buf->curln to point to the new line.
  */
-void insert_line(Line *ptr, const Line *line)
+void insert_line(Buffer *buf, Line *ptr, Line *nline)
 {
-	Line *nline;
-
-	if (ptr == curbuf->lastln) {
-		push_back_line(line);
+	if (ptr == buf->lastln) {
+		link_line(buf, nline);
 	}
 	else {
-		nline = new_line();
-		nline->text = charalloc(line->memsize);
-		strcpy(nline->text, line->text);
-		nline->len = line->len;
-		nline->memsize = line->memsize;
-
 		nline->prev = ptr;
 		nline->next = ptr->next;
 
 		ptr->next->prev = nline;
 		ptr->next = nline;
+		index_insert(buf, nline);
 	}
 }
 
@@ -342,59 +812,200 @@ void insert_line(Line *ptr, const Line *line)
  * Delete the line pointed by line, then make curln pointer point to 
  * the *next* line.
  */
-void erase_line(Line *ptr)
+void erase_line(Buffer *buf, Line *ptr)
 {
 	assert(ptr != NULL);
 
+	index_remove(buf, ptr);
 	/* If a middle line */
 	if (ptr->next != NULL) {
 		ptr->prev->next = ptr->next;
 		ptr->next->prev = ptr->prev;
 	}
 	/* If the last line */
-	else if (ptr == curbuf->lastln){
-		curbuf->lastln = ptr->prev;
+	else if (ptr == buf->lastln){
+		buf->lastln = ptr->prev;
 		ptr->prev->next = NULL;
 	}
-	free(ptr->text);
-	free(ptr);
+	delete_line(buf, ptr);
 }
 
 /*
  * Set modified flag if buffer is modified
  */
-void buffer_modified(bool modified)
+void buffer_modified(Buffer *buf, bool modified)
 {
-	curbuf->modified = modified ? TRUE : FALSE;
-	update_statbar();
+	buf->modified = modified ? TRUE : FALSE;
+	render->status(buf);
 }
 
 /*
- * Save buffer to disk.
+ * Return TRUE if buf cannot be modified, in which case the user is told
+ * why; used by the commands that modify a buffer.
  */
-void save_buffer()
+bool read_only(const Buffer *buf)
 {
-	int i;
-	FILE *fs;
+	if (buf->results != NULL) {
+		render_msg("Search results cannot be modified");
+		return TRUE;
+	}
+	if (buf->follow != NULL) {
+		render_msg("`%s' is being followed", file_name(buf->path));
+		return TRUE;
+	}
+	if (view_only) {
+		render_msg("Files are opened to be viewed only");
+		return TRUE;
+	}
+	return still_loading(buf);
+}
+
+/*
+ * Write all of the text of buf to fs, which must not have anything
+ * buffered. Lines are gathered into large writev() calls; the text of
+ * consecutive lines that still point into the original text is contiguous
+ * and goes out as a single piece. A buffer whose file was compressed is
+ * compressed again on the way. Return 0 on success or -1 on error.
+ */
+int write_buffer(Buffer *buf, FILE *fs)
+{
+	int fd = fileno(fs);
+	Encoder *enc;
+	int ret;
+
+	if (buf->codec == CODEC_NONE)
+		return write_text(buf, fd, NULL);
+	if ((enc = encoder_open(buf->codec)) == NULL) {
+		error = ENOMEM;
+		return -1;
+	}
+	ret = write_text(buf, fd, enc);
+	if (ret == 0)
+		ret = encoder_finish(enc, fd);
+	encoder_close(enc);
+	return ret;
+}
+
+/*
+ * Write all of the text of buf to fd, through enc unless it is NULL.
+ * Return 0 on success or -1 on error.
+ */
+static int write_text(Buffer *buf, int fd, Encoder *enc)
+{
+	struct iovec iov[WRITE_IOVS];
+	int iovcnt = 0;
 	Line *it;
 
-	if (curbuf->path == NULL) {
-		curbuf->path = prompt_str("File name to save: ");
-		if (curbuf->path == NULL)
-			return;
+	collapse_gap(buf);
+	/* A lazy buffer only holds the lines between head and tail */
+	if (buf->lazy != NULL && gather(fd, enc, iov, &iovcnt, buf->orig,
+				buf->lazy->head) != 0) {
+		return -1;
+	}
+	for (it = buf->firstln; it != NULL; it = it->next) {
+		if (gather(fd, enc, iov, &iovcnt, it->text, it->len) != 0)
+			return -1;
+	}
+	if (buf->lazy != NULL && gather(fd, enc, iov, &iovcnt, 
+				buf->orig + buf->lazy->tail, 
+				buf->origsize - buf->lazy->tail) != 0) {
+		return -1;
 	}
+	return write_all(fd, enc, iov, iovcnt);
+}
 
-	fs = open_file(curbuf->path, "w");
-	if (fs == NULL) {
-		curbuf->path = NULL;
-		return;
+/*
+ * Add len characters of text to the iovcnt pieces in iov, writing them
+ * all out to fd once iov is full. Return 0 on success or -1 on error.
+ */
+static int gather(int fd, Encoder *enc, struct iovec *iov, int *iovcnt,
+		const char *text, size_t len)
+{
+	struct iovec *last;
+
+	if (len == 0)
+		return 0;
+	if (*iovcnt > 0) {
+		last = &iov[*iovcnt - 1];
+		if ((char *)last->iov_base + last->iov_len == text) {
+			last->iov_len += len;
+			return 0;
+		}
 	}
-	for (it = curbuf->firstln; it != NULL; it = it->next) {
-		for (i = 0; it->text[i] != '\0'; i++)
-			fputc(it->text[i], fs);
+	if (*iovcnt == WRITE_IOVS) {
+		if (write_all(fd, enc, iov, *iovcnt) != 0)
+			return -1;
+		*iovcnt = 0;
 	}
-	fclose(fs);
+	/* Suppress compiler warning, the text is only read */
+	iov[*iovcnt].iov_base = (char *)text;
+	iov[*iovcnt].iov_len = len;
+	(*iovcnt)++;
 
-	buffer_modified(FALSE);
+	return 0;
 }
 
+/*
+ * Write the iovcnt pieces in iov to fd, which may take more than one
+ * writev(), or have enc compress them unless it is NULL. iov is used up
+ * in the process. Return 0 on success or -1 on error.
+ */
+static int write_all(int fd, Encoder *enc, struct iovec *iov, int iovcnt)
+{
+	ssize_t nwritten;
+	int i;
+
+	if (enc != NULL) {
+		for (i = 0; i < iovcnt; i++) {
+			if (encoder_write(enc, fd, iov[i].iov_base, iov[i].iov_len) != 0)
+				return -1;
+		}
+		return 0;
+	}
+
+	while (iovcnt > 0) {
+		nwritten = writev(fd, iov, iovcnt);
+		if (nwritten < 0) {
+			if (errno == EINTR)
+				continue;
+			error = errno;
+			return -1;
+		}
+		/* Skip what has been written, a piece may be left half done */
+		while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+			nwritten -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + nwritten;
+			iov->iov_len -= nwritten;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Save buf to its path, which must be set. Return 0 on success or -1 on
+ * error, which the user is told about.
+ */
+int save_buffer(Buffer *buf)
+{
+	long start = stats_clock();
+	FILE *fs;
+
+	assert(buf->path != NULL);
+
+	if ((fs = open_file(buf->path, "w")) == NULL)
+		return -1;
+	if (commit_temp(fs, write_buffer(buf, fs) != 0) != 0) {
+		render_msg("Could not save `%s': %s", buf->path, strerror(error));
+		return -1;
+	}
+	stats_add(STAT_SAVE, start);
+
+	undo_saved(buf);
+	journal_saved(buf);
+	buffer_modified(buf, FALSE);
+	return 0;
+}
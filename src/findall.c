@@ -0,0 +1,696 @@
+/*
+ * This module searches every buffer at once. The text of the buffers is
+ * cut into chunks on line boundaries, which a pool of worker threads
+ * searches while the editor goes on as usual. What they find is listed
+ * in a results buffer, one buffer after another as soon as all of its
+ * chunks are done; pressing Enter on a hit goes there.
+ *
+ * The workers never look at lines, only at the chunks, which are made
+ * when the search starts. Lines that point into the original text of a
+ * buffer are searched in place, since that text does not change while
+ * the buffer is open; edited lines are copied. The hits are thus about
+ * the text as it was when the search started. Closing a buffer that is
+ * still being searched stops the search.
+ */
+
+#include "proto.h"
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/* Number of bytes a chunk is cut at, it then runs to the end of its line */
+#define FINDALL_CHUNK 	(4 * 1024 * 1024)
+/* Upper bound on the number of workers */
+#define FINDALL_THREADS 	8
+/* Number of hits listed per buffer, the rest are only counted */
+#define FINDALL_HITS 	1000
+/* Number of characters of the line of a hit that are listed */
+#define FINDALL_WIDTH 	160
+
+/* A hit on line line (counted from 0) of a chunk, at x */
+typedef struct Hit {
+	size_t line;
+	size_t x;
+	/* The text of the line is at off in the texts of the chunk */
+	size_t off;
+	size_t len;
+} Hit;
+
+typedef struct Chunk {
+	/* Index of the buffer of the chunk in the targets of the job */
+	size_t target;
+	const char *text;
+	size_t len;
+	/* The text of edited lines is copied here, text then points to it */
+	char *copy;
+	size_t copycap;
+	/* What the search found: the number of '\n' and the matching lines */
+	size_t lines;
+	size_t matches;
+	Hit *hits;
+	size_t nhits;
+	size_t hitcap;
+	char *texts;
+	size_t textlen;
+	size_t textcap;
+} Chunk;
+
+/* A buffer being searched, its chunks are [first, first + nchunks) */
+typedef struct Target {
+	Buffer *buf;
+	size_t first;
+	size_t nchunks;
+	size_t ndone;
+	size_t bytes;
+	size_t done;
+} Target;
+
+typedef struct Job {
+#ifdef HAVE_PTHREAD_H
+	pthread_t threads[FINDALL_THREADS];
+	pthread_mutex_t lock;
+#endif
+	int nthreads;
+	Pattern pat;
+	Chunk *chunks;
+	size_t nchunks;
+	size_t chunkcap;
+	/* The next chunk a worker takes */
+	size_t next;
+	bool stop;
+	Target *targets;
+	size_t ntargets;
+	/* The targets before this one are listed in the results */
+	size_t reported;
+	size_t matches;
+	Buffer *results;
+} Job;
+
+/*
+ * Where the hit on each line of a results buffer is; id is the id of
+ * the buffer of the hit, or -1 if the line is not about a hit.
+ */
+struct Results {
+	struct {
+		int id;
+		size_t n;
+		size_t x;
+	} *hits;
+	size_t nhits;
+	size_t cap;
+};
+
+/* The search running, if any */
+static Job *job;
+
+static void lock(Job *job);
+static void unlock(Job *job);
+static size_t add_chunk(Job *job, const char *text, size_t len);
+static void chunk_orig(Job *job, Buffer *buf, size_t beg, size_t end);
+static void chunk_lines(Job *job, Buffer *buf);
+static void copy_line(Chunk *chunk, const Line *line);
+static void *work(void *arg);
+static const char *skip_lines(const char *p, const char *end,
+		size_t *lines);
+static void search_chunk(Job *job, Chunk *chunk);
+static void add_hit(Chunk *chunk, size_t line, size_t x, const char *text,
+		size_t len);
+static void add_result(Buffer *buf, int id, size_t n, size_t x,
+		const char *fmt, ...);
+static void report(Job *job, const Target *target);
+static void stop(const char *why);
+
+static void lock(Job *job)
+{
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&job->lock);
+#endif
+}
+
+static void unlock(Job *job)
+{
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&job->lock);
+#endif
+}
+
+/*
+ * Add a chunk of len characters at text to the last target of job and
+ * return its index.
+ */
+static size_t add_chunk(Job *job, const char *text, size_t len)
+{
+	Chunk *chunk;
+
+	if (job->nchunks == job->chunkcap) {
+		job->chunkcap = (job->chunkcap == 0) ? 64 : 2 * job->chunkcap;
+		job->chunks = realloc(job->chunks, job->chunkcap * sizeof(Chunk));
+		if (job->chunks == NULL) {
+			fprintf(stderr, "%s: realloc failed\n", __func__);
+			finish();
+		}
+	}
+	chunk = &job->chunks[job->nchunks];
+	memset(chunk, 0, sizeof(Chunk));
+	chunk->target = job->ntargets - 1;
+	chunk->text = text;
+	chunk->len = len;
+	job->targets[job->ntargets - 1].nchunks++;
+	return job->nchunks++;
+}
+
+/*
+ * Cut [beg, end) of the original text of buf into chunks.
+ */
+static void chunk_orig(Job *job, Buffer *buf, size_t beg, size_t end)
+{
+	const char *nl;
+	size_t cut;
+
+	while (beg < end) {
+		cut = end;
+		if (end - beg > FINDALL_CHUNK) {
+			nl = memchr(buf->orig + beg + FINDALL_CHUNK, '\n',
+					end - beg - FINDALL_CHUNK);
+			if (nl != NULL)
+				cut = (size_t)(nl - buf->orig) + 1;
+		}
+		add_chunk(job, buf->orig + beg, cut - beg);
+		beg = cut;
+	}
+}
+
+/*
+ * Append the text of line to the copy of chunk.
+ */
+static void copy_line(Chunk *chunk, const Line *line)
+{
+	if (chunk->len + line->len > chunk->copycap) {
+		chunk->copycap = 2 * (chunk->len + line->len);
+		chunk->copy = charrealloc(chunk->copy, chunk->copycap);
+	}
+	memcpy(chunk->copy + chunk->len, line->text, line->len);
+	chunk->len += line->len;
+	chunk->text = chunk->copy;
+}
+
+/*
+ * Cut the lines of buf into chunks: runs of lines that follow each other
+ * in the original text, and copies of the lines that have been edited.
+ */
+static void chunk_lines(Job *job, Buffer *buf)
+{
+	Chunk *chunk = NULL;
+	Line *it;
+	size_t k;
+
+	collapse_gap(buf);
+	for (it = buf->firstln; it != NULL; it = it->next) {
+		if (it->memsize == 0) {
+			if (chunk == NULL || chunk->copy != NULL ||
+					chunk->len >= FINDALL_CHUNK ||
+					it->text != chunk->text + chunk->len) {
+				k = add_chunk(job, it->text, 0);
+				chunk = &job->chunks[k];
+			}
+			chunk->len += it->len;
+		}
+		else {
+			if (chunk == NULL || chunk->copy == NULL ||
+					chunk->len >= FINDALL_CHUNK) {
+				k = add_chunk(job, NULL, 0);
+				chunk = &job->chunks[k];
+			}
+			copy_line(chunk, it);
+		}
+	}
+}
+
+/*
+ * The workers: take the next chunk until there is none left.
+ */
+static void *work(void *arg)
+{
+	Job *job = arg;
+	Chunk *chunk;
+
+	while (TRUE) {
+		lock(job);
+		chunk = (job->stop || job->next == job->nchunks) ? NULL :
+			&job->chunks[job->next++];
+		unlock(job);
+		if (chunk == NULL)
+			return NULL;
+
+		search_chunk(job, chunk);
+
+		lock(job);
+		job->targets[chunk->target].ndone++;
+		job->targets[chunk->target].done += chunk->len;
+		unlock(job);
+	}
+}
+
+/*
+ * Count the '\n' in [p, end) into *lines. Return where the last line
+ * there starts, i.e. after the last '\n', or p if there is none.
+ */
+static const char *skip_lines(const char *p, const char *end, size_t *lines)
+{
+	size_t nl[SCAN_BATCH];
+	const char *bol = p;
+	size_t n;
+	Scan scan;
+
+	scan_init(&scan);
+	do {
+		n = scan_lines(&scan, p, end - p, nl, SCAN_BATCH);
+		if (n > 0) {
+			p += nl[n - 1];
+			bol = p;
+		}
+	} while (n == SCAN_BATCH);
+	*lines += scan.lines;
+	return bol;
+}
+
+/*
+ * Find the lines of chunk that match, and count all of its lines. A chunk
+ * starts at the beginning of a line.
+ */
+static void search_chunk(Job *job, Chunk *chunk)
+{
+	const char *p = chunk->text;
+	const char *end = chunk->text + chunk->len;
+	const char *hit;
+	const char *bol;
+	const char *eol;
+	size_t line = 0;
+
+	while (p < end && (hit = pattern_find(&job->pat, p, end - p)) != NULL) {
+		bol = skip_lines(p, hit, &line);
+		if ((eol = memchr(hit, '\n', end - hit)) == NULL)
+			eol = end;
+		add_hit(chunk, line, hit - bol, bol, eol - bol);
+		/* Only the first match of a line counts */
+		p = eol;
+		if (p < end) {
+			p++;
+			line++;
+		}
+	}
+	skip_lines(p, end, &line);
+	chunk->lines = line;
+}
+
+static void add_hit(Chunk *chunk, size_t line, size_t x, const char *text,
+		size_t len)
+{
+	Hit *hit;
+
+	if (chunk->matches++ >= FINDALL_HITS)
+		return;
+	if (len > FINDALL_WIDTH)
+		len = FINDALL_WIDTH;
+	if (chunk->nhits == chunk->hitcap) {
+		chunk->hitcap = (chunk->hitcap == 0) ? 16 : 2 * chunk->hitcap;
+		chunk->hits = realloc(chunk->hits, chunk->hitcap * sizeof(Hit));
+		if (chunk->hits == NULL) {
+			fprintf(stderr, "%s: realloc failed\n", __func__);
+			finish();
+		}
+	}
+	if (chunk->textlen + len > chunk->textcap) {
+		chunk->textcap = 2 * (chunk->textlen + len);
+		chunk->texts = charrealloc(chunk->texts, chunk->textcap);
+	}
+	hit = &chunk->hits[chunk->nhits++];
+	hit->line = line;
+	hit->x = x;
+	hit->off = chunk->textlen;
+	hit->len = len;
+	memcpy(chunk->texts + chunk->textlen, text, len);
+	chunk->textlen += len;
+}
+
+/*
+ * Append a line to the results buffer buf, about the hit at x on line
+ * number n of the buffer with the given id, if that is not -1.
+ */
+static void add_result(Buffer *buf, int id, size_t n, size_t x,
+		const char *fmt, ...)
+{
+	Results *results = buf->results;
+	va_list ap;
+	Line *line;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	line = pool_line(&buf->pool);
+	line->memsize = len + 2;
+	line->text = text_alloc(&buf->pool, &line->memsize);
+	va_start(ap, fmt);
+	vsnprintf(line->text, len + 1, fmt, ap);
+	va_end(ap);
+	line->text[len] = '\n';
+	line->len = len + 1;
+	line->block = NULL;
+	line->next = NULL;
+	line->prev = buf->lastln;
+	buf->lastln->next = line;
+	buf->lastln = line;
+	index_append(buf, line);
+
+	if (results->nhits == results->cap) {
+		results->cap *= 2;
+		results->hits = realloc(results->hits,
+				results->cap * sizeof(results->hits[0]));
+		if (results->hits == NULL) {
+			fprintf(stderr, "%s: realloc failed\n", __func__);
+			finish();
+		}
+	}
+	results->hits[results->nhits].id = id;
+	results->hits[results->nhits].n = n;
+	results->hits[results->nhits].x = x;
+	results->nhits++;
+}
+
+/*
+ * List what was found in target, all of whose chunks are done.
+ */
+static void report(Job *job, const Target *target)
+{
+	Buffer *buf = target->buf;
+	const char *path = (buf->path != NULL) ? buf->path : "[Untitled]";
+	const Chunk *chunk;
+	const Hit *hit;
+	size_t n = 1;
+	size_t shown = 0;
+	size_t matches = 0;
+	size_t i;
+	size_t k;
+
+	for (i = 0; i < target->nchunks; i++) {
+		chunk = &job->chunks[target->first + i];
+		for (k = 0; k < chunk->nhits && shown < FINDALL_HITS; k++) {
+			hit = &chunk->hits[k];
+			add_result(job->results, buf->id, n + hit->line, hit->x,
+					"%s:%zu:%zu: %.*s", path, n + hit->line, hit->x + 1,
+					(int)hit->len, chunk->texts + hit->off);
+			shown++;
+		}
+		matches += chunk->matches;
+		n += chunk->lines;
+	}
+	if (matches > shown) {
+		add_result(job->results, -1, 0, 0, "%s: %zu more lines match",
+				path, matches - shown);
+	}
+	job->matches += matches;
+}
+
+/*
+ * Ask for a pattern and search every buffer for it in the background.
+ */
+void do_search_all()
+{
+	Buffer *buf;
+	Buffer *results;
+	Target *target;
+	char *answer;
+	long ncpus;
+	int i;
+
+	/* The text of a compressed file is not all there until it is decoded */
+	for (buf = firstbuf; buf != NULL; buf = buf->next) {
+		if (buf->loader != NULL && loader_decoding(buf) &&
+				still_loading(buf))
+			return;
+	}
+
+	answer = prompt_str("Search all buffers: ");
+	if (answer == NULL)
+		return;
+	if (*answer == '\0') {
+		free(answer);
+		return;
+	}
+	if (job != NULL)
+		stop("stopped by another search");
+
+	job = calloc(1, sizeof(Job));
+	if (job == NULL) {
+		fprintf(stderr, "%s: calloc failed\n", __func__);
+		finish();
+	}
+	pattern_init(&job->pat, answer);
+	for (buf = firstbuf; buf != NULL; buf = buf->next) {
+		if (buf->results == NULL)
+			job->ntargets++;
+	}
+	job->targets = calloc(job->ntargets, sizeof(Target));
+	if (job->targets == NULL) {
+		fprintf(stderr, "%s: calloc failed\n", __func__);
+		finish();
+	}
+
+	/* Cut the buffers into chunks */
+	job->ntargets = 0;
+	for (buf = firstbuf; buf != NULL; buf = buf->next) {
+		if (buf->results != NULL)
+			continue;
+		target = &job->targets[job->ntargets++];
+		target->buf = buf;
+		target->first = job->nchunks;
+		/* Nothing can be edited yet, all of the text is the original */
+		if (buf->loader != NULL) {
+			chunk_orig(job, buf, 0, buf->origsize);
+		}
+		else {
+			if (buf->lazy != NULL)
+				chunk_orig(job, buf, 0, buf->lazy->head);
+			chunk_lines(job, buf);
+			if (buf->lazy != NULL)
+				chunk_orig(job, buf, buf->lazy->tail, buf->origsize);
+		}
+	}
+	for (i = 0; i < (int)job->nchunks; i++)
+		job->targets[job->chunks[i].target].bytes += job->chunks[i].len;
+
+	/* The results go into a new buffer, which is shown right away */
+	results = push_back_buffer(NULL);
+	push_back_line(results, NULL);
+	curbuf = results;
+	results->results = malloc(sizeof(Results));
+	if (results->results == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	results->results->cap = 64;
+	results->results->nhits = 1;
+	results->results->hits = malloc(64 * sizeof(results->results->hits[0]));
+	if (results->results->hits == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	results->results->hits[0].id = -1;
+	own_line(results, results->firstln, strlen(answer) + 64);
+	results->firstln->len = sprintf(results->firstln->text,
+			"Lines matching `%s' in %zu buffers:\n", answer, job->ntargets);
+	job->results = results;
+	free(answer);
+
+	/* Both are chosen once and for all before the workers use them */
+	search_name();
+	scan_name();
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&job->lock, NULL);
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus > FINDALL_THREADS)
+		ncpus = FINDALL_THREADS;
+	if (ncpus > (long)job->nchunks)
+		ncpus = (long)job->nchunks;
+	for (i = 0; i < ncpus; i++) {
+		if (pthread_create(&job->threads[i], NULL, work, job) != 0)
+			break;
+		job->nthreads++;
+	}
+#else
+	(void)ncpus;
+#endif
+	/* Without workers, search in the foreground */
+	if (job->nthreads == 0)
+		work(job);
+
+	display_buffer();
+}
+
+/*
+ * List what the workers have found for the buffers that are done, in
+ * order, and finish the search once all are. Return FALSE if there was
+ * nothing to do.
+ */
+bool findall_idle()
+{
+	static int shown = -1;
+	size_t done;
+	size_t matches;
+	int percent;
+
+	if (job == NULL)
+		return FALSE;
+
+	lock(job);
+	for (done = job->reported; done < job->ntargets &&
+			job->targets[done].ndone == job->targets[done].nchunks; done++)
+		;
+	unlock(job);
+
+	if (done == job->reported) {
+		/* Only the progress may have changed */
+		if ((percent = findall_progress(curbuf)) != shown) {
+			shown = percent;
+			update_statbar();
+		}
+		return FALSE;
+	}
+	for (; job->reported < done; job->reported++)
+		report(job, &job->targets[job->reported]);
+
+	if (job->reported == job->ntargets) {
+		matches = job->matches;
+		stop(NULL);
+		print_msg_prompt("%zu lines match", matches);
+	}
+	display_buffer();
+	return TRUE;
+}
+
+/*
+ * Return TRUE if a search is running.
+ */
+bool findall_busy()
+{
+	return job != NULL;
+}
+
+/*
+ * Return how far the search running has got with buf, in percent, or -1
+ * if buf is not being searched. For the results buffer, this is how far
+ * the whole search has got.
+ */
+int findall_progress(const Buffer *buf)
+{
+	size_t bytes = 0;
+	size_t done = 0;
+	size_t i;
+
+	if (job == NULL)
+		return -1;
+	lock(job);
+	for (i = 0; i < job->ntargets; i++) {
+		if (buf == job->results ||
+				(i >= job->reported && buf == job->targets[i].buf)) {
+			bytes += job->targets[i].bytes;
+			done += job->targets[i].done;
+		}
+	}
+	unlock(job);
+
+	if (buf != job->results && bytes == 0)
+		return -1;
+	return (bytes == 0) ? 100 : (int)((double)done * 100 / bytes);
+}
+
+/*
+ * Stop the search running and free it. why, if not NULL, is noted in the
+ * results.
+ */
+static void stop(const char *why)
+{
+	size_t i;
+	int k;
+
+	lock(job);
+	job->stop = TRUE;
+	unlock(job);
+#ifdef HAVE_PTHREAD_H
+	for (k = 0; k < job->nthreads; k++)
+		pthread_join(job->threads[k], NULL);
+	pthread_mutex_destroy(&job->lock);
+#else
+	(void)k;
+#endif
+
+	if (why != NULL && job->results != NULL)
+		add_result(job->results, -1, 0, 0, "Search %s", why);
+	for (i = 0; i < job->nchunks; i++) {
+		free(job->chunks[i].copy);
+		free(job->chunks[i].hits);
+		free(job->chunks[i].texts);
+	}
+	free(job->chunks);
+	free(job->targets);
+	pattern_free(&job->pat);
+	free(job);
+	job = NULL;
+}
+
+/*
+ * Called when buf is about to be deleted: stop the search if it has not
+ * done with buf yet, and free what buf lists if it is a results buffer.
+ */
+void findall_forget(Buffer *buf)
+{
+	size_t i;
+
+	if (job != NULL) {
+		if (job->results == buf) {
+			job->results = NULL;
+			stop(NULL);
+		}
+		else {
+			for (i = job->reported; i < job->ntargets; i++) {
+				if (job->targets[i].buf == buf) {
+					stop("stopped, a buffer was closed");
+					break;
+				}
+			}
+		}
+	}
+	if (buf->results != NULL) {
+		free(buf->results->hits);
+		free(buf->results);
+		buf->results = NULL;
+	}
+}
+
+/*
+ * Go to the hit on the current line of the results buffer.
+ */
+void findall_goto()
+{
+	Results *results = curbuf->results;
+	Buffer *buf;
+	size_t i = line_number(curbuf, curbuf->curln) - 1;
+
+	if (i >= results->nhits || results->hits[i].id < 0)
+		return;
+	for (buf = firstbuf; buf != NULL; buf = buf->next) {
+		if (buf->id == results->hits[i].id)
+			break;
+	}
+	if (buf == NULL) {
+		print_msg_prompt("The buffer of this hit has been closed");
+		return;
+	}
+	curbuf = buf;
+	go_to(buf, results->hits[i].n, (int)results->hits[i].x);
+}
@@ -0,0 +1,408 @@
+/*
+ * This module follows files as they grow, like tail -f. The file of a
+ * buffer that is followed is watched with inotify; when it is written
+ * to, only what was appended past the end the buffer knows of is read,
+ * and made into lines at the back of the buffer. If the cursor is on the
+ * last line, the buffer is scrolled so that it stays there. A file that
+ * shrinks, or that is replaced by another one as logs are rotated, is
+ * read again from scratch, as is one whose last bytes the buffer knows
+ * of changed, which is how a file truncated and written to again past
+ * where it was looks. A buffer cannot be modified while it is followed,
+ * and its text is copied out of the mapping of its file first, since a
+ * truncated file would take the pages of the mapping with it.
+ *
+ * Without inotify, the files are looked at whenever the editor is idle.
+ */
+
+#include "proto.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+/* Number of bytes read from a file that grew at a time */
+#define FOLLOW_BLOCK 	(64 * 1024)
+/* Number of bytes before the end known of that are checked for changes */
+#define FOLLOW_TAIL 	64
+
+struct Follow {
+	/* The inotify watch of the file, -1 if there is none */
+	int wd;
+	/* How much of the file the buffer holds */
+	off_t offset;
+	dev_t dev;
+	ino_t ino;
+	/* The last taillen bytes of the file before offset */
+	char tail[FOLLOW_TAIL];
+	size_t taillen;
+	/* Whether the file may have changed since it was last looked at */
+	bool changed;
+};
+
+/* The inotify instance all of the watches belong to */
+static int notify = -1;
+
+static void watch(Buffer *buf);
+static bool pinned(Buffer *buf);
+static void pin(Buffer *buf);
+static void append_text(Buffer *buf, const char *text, size_t len);
+static void keep_tail(Follow *f, const char *text, size_t len);
+static bool rewritten(Follow *f, int fd);
+static bool grow(Buffer *buf, int fd, off_t size);
+static bool check(Buffer *buf);
+static void read_events();
+
+/*
+ * Watch the file of buf for writes, for being moved away and for being
+ * removed.
+ */
+static void watch(Buffer *buf)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if (notify < 0)
+		notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (notify >= 0) {
+		buf->follow->wd = inotify_add_watch(notify, buf->path,
+				IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+	}
+#endif
+}
+
+/*
+ * Return TRUE if the cursor of buf is on its last line, which the buffer
+ * then stays pinned to as it grows.
+ */
+static bool pinned(Buffer *buf)
+{
+	return buf->curln == buf->lastln;
+}
+
+/*
+ * Put the cursor of buf at the beginning of its last line, with that line
+ * on the bottom row.
+ */
+static void pin(Buffer *buf)
+{
+	size_t rows = render->rows();
+	size_t n = line_number(buf, buf->lastln);
+	size_t top = (n > rows) ? n - rows + 1 : 1;
+
+	collapse_gap(buf);
+	buf->curln = buf->lastln;
+	buf->topln = line_at(buf, top);
+	buf->y_pos = n - line_number(buf, buf->topln);
+	buf->x_pos = 0;
+	buf->visual_x = 0;
+	render->all(buf);
+}
+
+/*
+ * Add len characters of text to the back of buf: to its last line while
+ * that does not end with '\n', then as lines of their own.
+ */
+static void append_text(Buffer *buf, const char *text, size_t len)
+{
+	Line *last = buf->lastln;
+	const char *end = text + len;
+	const char *nl;
+	Line line;
+	size_t n;
+
+	if (last->len == 0 || last->text[last->len - 1] != '\n') {
+		nl = memchr(text, '\n', len);
+		n = (nl != NULL) ? (size_t)(nl + 1 - text) : len;
+		own_line(buf, last, last->len + n);
+		memcpy(last->text + last->len, text, n);
+		last->len += n;
+		column_forget(buf, last);
+		text += n;
+	}
+
+	line.memsize = 0;
+	while (text < end) {
+		nl = memchr(text, '\n', end - text);
+		line.text = (char *)text;
+		line.len = (nl != NULL) ? (size_t)(nl + 1 - text) :
+			(size_t)(end - text);
+		push_back_line(buf, &line);
+		text += line.len;
+	}
+}
+
+/*
+ * Remember the last bytes of len characters of text that were just read
+ * from the file of f.
+ */
+static void keep_tail(Follow *f, const char *text, size_t len)
+{
+	size_t keep;
+
+	if (len == 0)
+		return;
+	if (len >= FOLLOW_TAIL) {
+		memcpy(f->tail, text + len - FOLLOW_TAIL, FOLLOW_TAIL);
+		f->taillen = FOLLOW_TAIL;
+		return;
+	}
+	keep = (f->taillen < FOLLOW_TAIL - len) ? f->taillen : FOLLOW_TAIL - len;
+	memmove(f->tail, f->tail + f->taillen - keep, keep);
+	memcpy(f->tail + keep, text, len);
+	f->taillen = keep + len;
+}
+
+/*
+ * Return TRUE if the bytes of the file of f, open as fd, right before the
+ * end known of are not what they were when they were read.
+ */
+static bool rewritten(Follow *f, int fd)
+{
+	char bytes[FOLLOW_TAIL];
+
+	if (f->taillen == 0)
+		return FALSE;
+	return pread(fd, bytes, f->taillen, f->offset - f->taillen) !=
+		(ssize_t)f->taillen || memcmp(bytes, f->tail, f->taillen) != 0;
+}
+
+/*
+ * Read what was appended to the file of buf, open as fd, up to size and
+ * add it to buf. Return TRUE if there was anything.
+ */
+static bool grow(Buffer *buf, int fd, off_t size)
+{
+	Follow *f = buf->follow;
+	bool pin_it = pinned(buf);
+	char *block;
+	ssize_t n;
+
+	if (size <= f->offset)
+		return FALSE;
+	collapse_gap(buf);
+	block = charalloc(FOLLOW_BLOCK);
+	while (f->offset < size) {
+		n = pread(fd, block, FOLLOW_BLOCK, f->offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		append_text(buf, block, n);
+		keep_tail(f, block, n);
+		f->offset += n;
+	}
+	free(block);
+
+	if (pin_it)
+		pin(buf);
+	else
+		render->all(buf);
+	return TRUE;
+}
+
+/*
+ * Look at the file of buf again: read what was appended to it, or all of
+ * it if it shrank, was written over or was replaced. Return TRUE if buf
+ * changed.
+ */
+static bool check(Buffer *buf)
+{
+	Follow *f = buf->follow;
+	struct stat filestat;
+	bool truncated;
+	bool repin;
+	bool grew;
+	int fd;
+
+	/* A rotated log may not be there again yet */
+	if ((fd = open(buf->path, O_RDONLY)) < 0)
+		return FALSE;
+	if (fstat(fd, &filestat) != 0) {
+		close(fd);
+		return FALSE;
+	}
+	f->changed = FALSE;
+
+	if (filestat.st_dev == f->dev && filestat.st_ino == f->ino &&
+			filestat.st_size >= f->offset && !rewritten(f, fd)) {
+		grew = grow(buf, fd, filestat.st_size);
+		close(fd);
+		return grew;
+	}
+	close(fd);
+
+	/* A search may still be reading the text that is thrown away */
+	findall_forget(buf);
+	truncated = filestat.st_dev == f->dev && filestat.st_ino == f->ino;
+	repin = pinned(buf);
+	if (reload_buffer(buf) != 0)
+		return FALSE;
+	f->offset = buf->origsize;
+	f->taillen = 0;
+	keep_tail(f, buf->orig, buf->origsize);
+	f->dev = filestat.st_dev;
+	f->ino = filestat.st_ino;
+	if (repin)
+		pin(buf);
+#ifdef HAVE_SYS_INOTIFY_H
+	if (f->wd >= 0)
+		inotify_rm_watch(notify, f->wd);
+#endif
+	watch(buf);
+	render_msg("`%s' was %s, read it again", file_name(buf->path),
+			truncated ? "truncated" : "replaced");
+	return TRUE;
+}
+
+/*
+ * Mark the buffers whose files inotify tells about as changed.
+ */
+static void read_events()
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	/* Aligned for the events */
+	union {
+		struct inotify_event ev;
+		char bytes[4096];
+	} events;
+	const struct inotify_event *ev;
+	Buffer *buf;
+	ssize_t len;
+	char *p;
+
+	while ((len = read(notify, events.bytes, sizeof(events))) > 0) {
+		for (p = events.bytes; p < events.bytes + len;
+				p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			for (buf = firstbuf; buf != NULL; buf = buf->next) {
+				if (buf->follow == NULL || buf->follow->wd != ev->wd)
+					continue;
+				buf->follow->changed = TRUE;
+				/* The file is gone, a new one gets a watch of its own */
+				if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF |
+							IN_IGNORED)) {
+					if (!(ev->mask & IN_IGNORED))
+						inotify_rm_watch(notify, ev->wd);
+					buf->follow->wd = -1;
+				}
+			}
+		}
+	}
+#endif
+}
+
+/*
+ * Start or stop following the file of the current buffer.
+ */
+void do_follow()
+{
+	Buffer *buf = curbuf;
+	struct stat filestat;
+	Follow *f;
+
+	if (buf->follow != NULL) {
+		follow_stop(buf);
+		print_msg_prompt("Stopped following `%s'", file_name(buf->path));
+		return;
+	}
+	if (buf->results != NULL || buf->path == NULL) {
+		print_msg_prompt("Only files can be followed");
+		return;
+	}
+	if (buf->codec != CODEC_NONE) {
+		print_msg_prompt("`%s' is compressed and cannot be followed",
+				file_name(buf->path));
+		return;
+	}
+	if (buf->lazy != NULL) {
+		print_msg_prompt("`%s' is too large to be followed",
+				file_name(buf->path));
+		return;
+	}
+	if (buf->modified) {
+		print_msg_prompt("Save `%s' before following it",
+				file_name(buf->path));
+		return;
+	}
+	if (still_loading(buf))
+		return;
+	if (stat(buf->path, &filestat) != 0) {
+		print_msg_prompt("`%s' is not on the disk", file_name(buf->path));
+		return;
+	}
+
+	f = malloc(sizeof(Follow));
+	if (f == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	f->wd = -1;
+	/* What the buffer holds is the file as it was opened */
+	f->offset = buf->origsize;
+	f->dev = buf->orig_mapped ? buf->orig_dev : filestat.st_dev;
+	f->ino = buf->orig_mapped ? buf->orig_ino : filestat.st_ino;
+	f->taillen = 0;
+	keep_tail(f, buf->orig, buf->origsize);
+	/* It may have grown since */
+	f->changed = TRUE;
+	/* A search may still be reading the mapping that goes away */
+	findall_forget(buf);
+	copy_original(buf);
+	buf->follow = f;
+	watch(buf);
+
+	pin(buf);
+	print_msg_prompt("Following `%s', ^T stops", file_name(buf->path));
+}
+
+/*
+ * Stop following the file of buf, if it is followed.
+ */
+void follow_stop(Buffer *buf)
+{
+	if (buf->follow == NULL)
+		return;
+#ifdef HAVE_SYS_INOTIFY_H
+	if (buf->follow->wd >= 0)
+		inotify_rm_watch(notify, buf->follow->wd);
+#endif
+	free(buf->follow);
+	buf->follow = NULL;
+}
+
+/*
+ * Return TRUE if any buffer is followed.
+ */
+bool follow_busy()
+{
+	Buffer *buf;
+
+	for (buf = firstbuf; buf != NULL; buf = buf->next) {
+		if (buf->follow != NULL)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * Bring the buffers that are followed up to date with their files. Return
+ * FALSE if none of them changed.
+ */
+bool follow_idle()
+{
+	Buffer *buf;
+	bool shown = FALSE;
+
+	if (notify >= 0)
+		read_events();
+	for (buf = firstbuf; buf != NULL; buf = buf->next) {
+		if (buf->follow == NULL)
+			continue;
+		/* Without a watch, a file can only be looked at */
+		if (buf->follow->changed || buf->follow->wd < 0)
+			shown |= check(buf);
+	}
+	return shown;
+}
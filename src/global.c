@@ -4,12 +4,6 @@
 
 #include "proto.h"
 
-WINDOW *mainwin = NULL;
-WINDOW *statbar = NULL;
-WINDOW *bottwin = NULL;
-Curwin curwin;
-
-Buffer *curbuf = NULL;
 Buffer *firstbuf = NULL;
 Buffer *lastbuf = NULL;
 
@@ -17,3 +11,12 @@ Buffer *lastbuf = NULL;
  * by any system call or library function. */
 int error = 0;
 
+
+/* Open every file as a lazy buffer, not only the large ones */
+bool lazy_all = FALSE;
+/* Open every file to be viewed only, see read_only() */
+bool view_only = FALSE;
+/* Memory a lazy buffer may spend on its window */
+size_t lazy_cap = 64 * 1024 * 1024;
+/* How hard save_buffer() makes sure a saved file reaches the disk */
+Sync sync_policy = SYNC_FILE;
@@ -0,0 +1,257 @@
+/*
+ * This module contains the line index of a buffer. Lines are grouped in
+ * blocks of consecutive lines, and a Fenwick tree over the line counts of
+ * the blocks turns "which line is this" and "where is line n" into
+ * O(log n) lookups plus a walk of at most BLOCK_MAX lines.
+ */
+
+#include "proto.h"
+#include <string.h>
+
+/* A block is split in two once it grows past BLOCK_MAX lines */
+#define BLOCK_MAX 	512
+
+static Block *new_block(Buffer *buf, size_t idx);
+static void remove_block(Buffer *buf, Block *block);
+static void split_block(Buffer *buf, Block *block);
+static void add_count(Buffer *buf, Block *block, int delta);
+static void rebuild_tree(Buffer *buf);
+
+/*
+ * Make a new, empty block at position idx of the index of buf.
+ */
+static Block *new_block(Buffer *buf, size_t idx)
+{
+	Index *index = &buf->index;
+	Block *block;
+	size_t i;
+
+	if (index->nblocks == index->cap) {
+		index->cap = (index->cap == 0) ? 64 : 2 * index->cap;
+		index->blocks = realloc(index->blocks, index->cap * sizeof(Block *));
+		index->tree = realloc(index->tree, (index->cap + 1) * sizeof(size_t));
+		if (index->blocks == NULL || index->tree == NULL) {
+			fprintf(stderr, "%s: realloc failed\n", __func__);
+			finish();
+		}
+	}
+	block = malloc(sizeof(Block));
+	if (block == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	block->first = NULL;
+	block->count = 0;
+
+	memmove(index->blocks + idx + 1, index->blocks + idx, 
+			(index->nblocks - idx) * sizeof(Block *));
+	index->blocks[idx] = block;
+	index->nblocks++;
+	for (i = idx; i < index->nblocks; i++) {
+		index->blocks[i]->idx = i;
+	}
+	index->dirty = TRUE;
+
+	return block;
+}
+
+static void remove_block(Buffer *buf, Block *block)
+{
+	Index *index = &buf->index;
+	size_t i;
+
+	index->nblocks--;
+	memmove(index->blocks + block->idx, index->blocks + block->idx + 1, 
+			(index->nblocks - block->idx) * sizeof(Block *));
+	for (i = block->idx; i < index->nblocks; i++) {
+		index->blocks[i]->idx = i;
+	}
+	index->dirty = TRUE;
+	free(block);
+}
+
+/*
+ * Move the second half of block into a block of its own.
+ */
+static void split_block(Buffer *buf, Block *block)
+{
+	Block *nblock;
+	Line *it;
+	size_t i;
+
+	nblock = new_block(buf, block->idx + 1);
+	for (it = block->first, i = 0; i < block->count / 2; i++) {
+		it = it->next;
+	}
+	nblock->first = it;
+	nblock->count = block->count - i;
+	block->count = i;
+	for (i = 0; i < nblock->count; i++, it = it->next) {
+		it->block = nblock;
+	}
+}
+
+/*
+ * Change the line count of block by delta.
+ */
+static void add_count(Buffer *buf, Block *block, int delta)
+{
+	Index *index = &buf->index;
+	size_t i;
+
+	block->count += delta;
+	index->nlines += delta;
+	if (!index->dirty) {
+		for (i = block->idx + 1; i <= index->nblocks; i += i & -i) {
+			index->tree[i] += delta;
+		}
+	}
+}
+
+/*
+ * Rebuild the Fenwick tree from the line counts in O(number of blocks).
+ * tree[i] holds the number of lines in blocks (i - lowbit(i), i].
+ */
+static void rebuild_tree(Buffer *buf)
+{
+	Index *index = &buf->index;
+	size_t i;
+	size_t j;
+
+	for (i = 1; i <= index->nblocks; i++) {
+		index->tree[i] = index->blocks[i - 1]->count;
+	}
+	for (i = 1; i <= index->nblocks; i++) {
+		j = i + (i & -i);
+		if (j <= index->nblocks)
+			index->tree[j] += index->tree[i];
+	}
+	index->dirty = FALSE;
+}
+
+/*
+ * Add line, which was just linked at the back of buf, to the index.
+ */
+void index_append(Buffer *buf, Line *line)
+{
+	Index *index = &buf->index;
+	Block *block;
+
+	if (index->nblocks > 0 && 
+			index->blocks[index->nblocks - 1]->count < BLOCK_MAX / 2) {
+		block = index->blocks[index->nblocks - 1];
+	}
+	else {
+		block = new_block(buf, index->nblocks);
+		block->first = line;
+	}
+	line->block = block;
+	add_count(buf, block, 1);
+}
+
+/*
+ * Add line, which was just linked after line->prev, to the index.
+ */
+void index_insert(Buffer *buf, Line *line)
+{
+	Block *block;
+
+	if (line->prev != NULL) {
+		block = line->prev->block;
+	}
+	else {
+		block = line->next->block;
+		block->first = line;
+	}
+	line->block = block;
+	add_count(buf, block, 1);
+	if (block->count > BLOCK_MAX) {
+		split_block(buf, block);
+	}
+}
+
+/*
+ * Take line, which is about to be unlinked from buf, out of the index.
+ */
+void index_remove(Buffer *buf, Line *line)
+{
+	Block *block = line->block;
+
+	add_count(buf, block, -1);
+	if (block->count == 0) {
+		remove_block(buf, block);
+	}
+	else if (block->first == line) {
+		block->first = line->next;
+	}
+}
+
+/*
+ * Free the index of buf.
+ */
+void index_destroy(Buffer *buf)
+{
+	size_t i;
+
+	for (i = 0; i < buf->index.nblocks; i++) {
+		free(buf->index.blocks[i]);
+	}
+	free(buf->index.blocks);
+	free(buf->index.tree);
+	memset(&buf->index, 0, sizeof(Index));
+}
+
+/*
+ * Return the number of line in buf, counting from 1. Lazy buffers count
+ * the lines before their window as well.
+ */
+size_t line_number(Buffer *buf, const Line *line)
+{
+	const Line *it;
+	size_t n = 0;
+	size_t i;
+
+	if (buf->index.dirty)
+		rebuild_tree(buf);
+
+	/* Lines in the blocks before the block of line */
+	for (i = line->block->idx; i > 0; i -= i & -i) {
+		n += buf->index.tree[i];
+	}
+	for (it = line->block->first; it != line; it = it->next) {
+		n++;
+	}
+	return buf->index.base + n + 1;
+}
+
+/*
+ * Return line number n of buf, counting from 1. n is clamped to the
+ * lines that exist (in the window of a lazy buffer).
+ */
+Line *line_at(Buffer *buf, size_t n)
+{
+	Index *index = &buf->index;
+	Line *it;
+	size_t pos = 0;
+	size_t step;
+
+	n = (n > index->base) ? n - index->base : 1;
+	if (n > index->nlines)
+		n = index->nlines;
+	if (index->dirty)
+		rebuild_tree(buf);
+
+	/* Find the block holding line n by descending the tree */
+	for (step = 1; 2 * step <= index->nblocks; step *= 2)
+		;
+	for (; step > 0; step /= 2) {
+		if (pos + step <= index->nblocks && index->tree[pos + step] < n) {
+			pos += step;
+			n -= index->tree[pos];
+		}
+	}
+	for (it = index->blocks[pos]->first; n > 1; n--) {
+		it = it->next;
+	}
+	return it;
+}
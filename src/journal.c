@@ -0,0 +1,511 @@
+/*
+ * This module keeps the swap journal of a buffer: a file next to the one
+ * the buffer was opened from, .NAME.vsw, that every edit made since the
+ * buffer was last saved is appended to, so that the edits are not lost if
+ * the editor dies. The journal starts with a header telling which version
+ * of the file it applies to, followed by one record per edit: where it
+ * happened, whether it inserted or deleted, and the characters, the same
+ * as undo.c logs.
+ *
+ * Edits only go into a ring in memory; a writer thread takes them out and
+ * writes them to the journal in the background, so an edit costs a copy.
+ * Nothing is synced to the disk: the journal is there for when the editor
+ * dies, not the system. A journal is only created at the first edit and
+ * is removed once the edits are either saved or thrown away.
+ */
+
+#include "proto.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/* Number of bytes of edits that may wait to be written */
+#define JOURNAL_RING 	(64 * 1024)
+#define JOURNAL_MAGIC 	"veerjnl1"
+
+enum { JOURNAL_INSERT, JOURNAL_DELETE };
+
+/* What version of the file the edits apply to */
+typedef struct Header {
+	char magic[8];
+	off_t size;
+	time_t mtime;
+} Header;
+
+typedef struct Record {
+	size_t line;
+	size_t x;
+	size_t len;
+	unsigned char op;
+} Record;
+
+/* Set while a journal is replayed, whose edits are journaled already */
+static bool replaying = FALSE;
+
+struct Journal {
+	/* -1 if the journal could not be created */
+	int fd;
+	char *path;
+	char ring[JOURNAL_RING];
+	/* Bytes ever put into the ring, and ever written out of it */
+	size_t head;
+	size_t tail;
+#ifdef HAVE_PTHREAD_H
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/* Signaled when the ring gets more to write, or less */
+	pthread_cond_t more;
+	pthread_cond_t room;
+	bool stop;
+#endif
+};
+
+static char *journal_path(const char *path);
+static void read_header(const char *path, Header *header);
+static int write_all(int fd, const char *data, size_t len);
+static Journal *start(Buffer *buf, bool keep, off_t valid);
+static void drain(Journal *j);
+static void append(Journal *j, const void *data, size_t len);
+static void record(Buffer *buf, int op, size_t n, size_t x,
+		const char *text, size_t len);
+static bool apply(Buffer *buf, const Record *rec, const char *text);
+#ifdef HAVE_PTHREAD_H
+static void *writer(void *arg);
+#endif
+
+/*
+ * Return the path of the journal of the file at path, which the caller
+ * should free().
+ */
+static char *journal_path(const char *path)
+{
+	const char *name = file_name(path);
+	size_t dirlen = name - path;
+	char *jpath;
+
+	jpath = charalloc(dirlen + strlen(name) + sizeof("..vsw"));
+	memcpy(jpath, path, dirlen);
+	sprintf(jpath + dirlen, ".%s.vsw", name);
+	return jpath;
+}
+
+/*
+ * Fill in the header that tells the version of the file at path as it is
+ * on the disk now, if it is there at all.
+ */
+static void read_header(const char *path, Header *header)
+{
+	struct stat filestat;
+
+	memset(header, 0, sizeof(Header));
+	memcpy(header->magic, JOURNAL_MAGIC, sizeof(header->magic));
+	if (stat(path, &filestat) == 0) {
+		header->size = filestat.st_size;
+		header->mtime = filestat.st_mtime;
+	}
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, data, len)) < 0)
+			return -1;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Open the journal of buf, which must have a path, and start its writer.
+ * If keep is TRUE, the first valid bytes of the journal that is there
+ * already are kept, otherwise a new one is started for the file as it is
+ * on the disk now.
+ */
+static Journal *start(Buffer *buf, bool keep, off_t valid)
+{
+	Journal *j;
+	Header header;
+
+	j = malloc(sizeof(Journal));
+	if (j == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	j->path = journal_path(buf->path);
+	j->head = 0;
+	j->tail = 0;
+
+	j->fd = open(j->path, O_WRONLY | O_CREAT | O_APPEND |
+			(keep ? 0 : O_TRUNC), S_IRUSR | S_IWUSR);
+	if (j->fd >= 0 && keep && ftruncate(j->fd, valid) != 0) {
+		close(j->fd);
+		j->fd = -1;
+	}
+	if (j->fd >= 0 && !keep) {
+		read_header(buf->path, &header);
+		if (write_all(j->fd, (const char *)&header, sizeof(Header)) != 0) {
+			close(j->fd);
+			j->fd = -1;
+		}
+	}
+	if (j->fd < 0) {
+		render_msg("Could not write the journal `%s'", j->path);
+		buf->journal = j;
+		return j;
+	}
+
+#ifdef HAVE_PTHREAD_H
+	j->stop = FALSE;
+	pthread_mutex_init(&j->lock, NULL);
+	pthread_cond_init(&j->more, NULL);
+	pthread_cond_init(&j->room, NULL);
+	if (pthread_create(&j->thread, NULL, writer, j) != 0) {
+		fprintf(stderr, "%s: pthread_create failed\n", __func__);
+		finish();
+	}
+#endif
+	buf->journal = j;
+	return j;
+}
+
+/*
+ * Wait until everything in the ring of j has been written.
+ */
+static void drain(Journal *j)
+{
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&j->lock);
+	while (j->tail != j->head)
+		pthread_cond_wait(&j->room, &j->lock);
+	pthread_mutex_unlock(&j->lock);
+#endif
+}
+
+/*
+ * Put len bytes of data into the ring of j, waiting for the writer to
+ * make room if it is full.
+ */
+static void append(Journal *j, const void *data, size_t len)
+{
+#ifdef HAVE_PTHREAD_H
+	const char *p = data;
+	size_t off;
+	size_t n;
+
+	pthread_mutex_lock(&j->lock);
+	while (len > 0) {
+		while (j->head - j->tail == JOURNAL_RING)
+			pthread_cond_wait(&j->room, &j->lock);
+		off = j->head % JOURNAL_RING;
+		n = JOURNAL_RING - (j->head - j->tail);
+		if (n > JOURNAL_RING - off)
+			n = JOURNAL_RING - off;
+		if (n > len)
+			n = len;
+		memcpy(j->ring + off, p, n);
+		j->head += n;
+		p += n;
+		len -= n;
+		pthread_cond_signal(&j->more);
+	}
+	pthread_mutex_unlock(&j->lock);
+#else
+	write_all(j->fd, data, len);
+#endif
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * The writer: write out whatever is in the ring, a contiguous piece at a
+ * time, until told to stop and there is nothing left.
+ */
+static void *writer(void *arg)
+{
+	Journal *j = arg;
+	size_t off;
+	size_t n;
+
+	pthread_mutex_lock(&j->lock);
+	while (TRUE) {
+		while (j->tail == j->head && !j->stop)
+			pthread_cond_wait(&j->more, &j->lock);
+		if (j->tail == j->head)
+			break;
+		off = j->tail % JOURNAL_RING;
+		n = j->head - j->tail;
+		if (n > JOURNAL_RING - off)
+			n = JOURNAL_RING - off;
+		pthread_mutex_unlock(&j->lock);
+		/* There is no one to tell if it fails; the edits are still there */
+		write_all(j->fd, j->ring + off, n);
+		pthread_mutex_lock(&j->lock);
+		j->tail += n;
+		pthread_cond_broadcast(&j->room);
+	}
+	pthread_mutex_unlock(&j->lock);
+	return NULL;
+}
+#endif
+
+/*
+ * Journal an edit of buf, starting the journal if it is the first.
+ */
+static void record(Buffer *buf, int op, size_t n, size_t x,
+		const char *text, size_t len)
+{
+	Record rec;
+
+	if (buf->path == NULL || replaying)
+		return;
+	if (buf->journal == NULL)
+		start(buf, FALSE, 0);
+	if (buf->journal->fd < 0)
+		return;
+
+	/* The padding goes into the journal too */
+	memset(&rec, 0, sizeof(Record));
+	rec.line = n;
+	rec.x = x;
+	rec.len = len;
+	rec.op = op;
+	append(buf->journal, &rec, sizeof(Record));
+	append(buf->journal, text, len);
+}
+
+/*
+ * Journal that len characters of text were inserted into buf at line n,
+ * index x.
+ */
+void journal_insert(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len)
+{
+	record(buf, JOURNAL_INSERT, n, x, text, len);
+}
+
+/*
+ * Journal that the len characters of text at line n, index x of buf were
+ * deleted.
+ */
+void journal_delete(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len)
+{
+	record(buf, JOURNAL_DELETE, n, x, text, len);
+}
+
+/*
+ * Return TRUE if buf has a journal of edits left behind that applies to
+ * its file as it is on the disk now.
+ */
+bool journal_found(const Buffer *buf)
+{
+	Header header;
+	Header found;
+	char *jpath;
+	ssize_t n = 0;
+	int fd;
+
+	if (buf->path == NULL || buf->journal != NULL)
+		return FALSE;
+	jpath = journal_path(buf->path);
+	if ((fd = open(jpath, O_RDONLY)) >= 0) {
+		n = read(fd, &found, sizeof(Header));
+		/* Only a journal that has edits is worth telling about */
+		if (n == sizeof(Header) && lseek(fd, 0, SEEK_END) <= n)
+			n = 0;
+		close(fd);
+	}
+	free(jpath);
+
+	read_header(buf->path, &header);
+	return n == sizeof(Header) && memcmp(&header, &found, sizeof(Header)) == 0;
+}
+
+/*
+ * Apply the edit rec of the journal, whose characters are at text, to
+ * buf. Return FALSE if the edit does not fit the text of buf.
+ */
+static bool apply(Buffer *buf, const Record *rec, const char *text)
+{
+	const char *nl;
+	Line *line;
+	size_t first;
+
+	if (rec->line < 1)
+		return FALSE;
+	if (buf->lazy != NULL)
+		lazy_reach(buf, rec->line);
+	if (rec->line > buf->index.base + buf->index.nlines)
+		return FALSE;
+	line = line_at(buf, rec->line);
+
+	if (rec->op == JOURNAL_INSERT) {
+		if (rec->x > line->len || (rec->x == line->len && line->len > 0 &&
+					line->text[line->len - 1] == '\n'))
+			return FALSE;
+		undo_insert(buf, rec->line, rec->x, text, rec->len);
+		insert_text(buf, rec->line, rec->x, text, rec->len);
+		return TRUE;
+	}
+	/* What is deleted has to be there, as far as this line goes */
+	nl = memchr(text, '\n', rec->len);
+	first = (nl != NULL) ? (size_t)(nl - text) + 1 : rec->len;
+	if (rec->x + first > line->len ||
+			memcmp(line->text + rec->x, text, first) != 0)
+		return FALSE;
+	undo_delete(buf, rec->line, rec->x, text, rec->len);
+	delete_text(buf, rec->line, rec->x, text, rec->len);
+	return TRUE;
+}
+
+/*
+ * Replay the journal of buf, which journal_found() found, on it and go
+ * on journaling after the edits that fit. The buffer is loaded in full
+ * first; if it cannot be, the journal is kept for another time. The edits
+ * replayed are undone as one. Return their number.
+ */
+size_t journal_replay(Buffer *buf)
+{
+	struct stat filestat;
+	const char *p;
+	const char *end;
+	char *jpath;
+	char *data;
+	Record rec;
+	size_t count = 0;
+	size_t last = 1;
+	ssize_t n;
+	int fd;
+
+	loader_finish(buf);
+	if (buf->loader != NULL) {
+		journal_keep(buf);
+		return 0;
+	}
+
+	jpath = journal_path(buf->path);
+	fd = open(jpath, O_RDONLY);
+	free(jpath);
+	if (fd < 0 || fstat(fd, &filestat) != 0) {
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+	data = charalloc(filestat.st_size + 1);
+	n = read(fd, data, filestat.st_size);
+	close(fd);
+	if (n < (ssize_t)sizeof(Header)) {
+		free(data);
+		return 0;
+	}
+
+	collapse_gap(buf);
+	p = data + sizeof(Header);
+	end = data + n;
+	replaying = TRUE;
+	undo_begin(buf);
+	while ((size_t)(end - p) >= sizeof(Record)) {
+		memcpy(&rec, p, sizeof(Record));
+		/* The editor may have died in the middle of a record */
+		if (rec.len > (size_t)(end - p) - sizeof(Record) ||
+				!apply(buf, &rec, p + sizeof(Record)))
+			break;
+		p += sizeof(Record) + rec.len;
+		last = rec.line;
+		count++;
+	}
+	undo_end(buf);
+	replaying = FALSE;
+
+	/* What is after the last edit that fit is dropped */
+	start(buf, TRUE, p - data);
+	free(data);
+
+	if (count > 0) {
+		go_to(buf, last, 0);
+		buffer_modified(buf, TRUE);
+	}
+	return count;
+}
+
+/*
+ * Start a new journal for buf, which has just been saved, once it is
+ * edited again.
+ */
+void journal_saved(Buffer *buf)
+{
+	journal_close(buf, TRUE);
+}
+
+/*
+ * Remove the journal left behind for the file of buf, whose edits the
+ * user did not want back.
+ */
+void journal_discard(Buffer *buf)
+{
+	char *jpath;
+
+	jpath = journal_path(buf->path);
+	unlink(jpath);
+	free(jpath);
+}
+
+/*
+ * Leave the journal left behind for the file of buf alone, so that its
+ * edits can still be recovered later: the edits of buf are not journaled.
+ */
+void journal_keep(Buffer *buf)
+{
+	Journal *j;
+
+	j = malloc(sizeof(Journal));
+	if (j == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	j->path = journal_path(buf->path);
+	j->fd = -1;
+	j->head = 0;
+	j->tail = 0;
+	buf->journal = j;
+}
+
+/*
+ * Write out what is left in the ring of the journal of buf and close the
+ * journal. If discard is TRUE, the edits have been saved or thrown away
+ * and the journal is removed. Only a journal buf wrote itself is ever
+ * removed here, not one some other session left behind or is writing.
+ */
+void journal_close(Buffer *buf, bool discard)
+{
+	Journal *j = buf->journal;
+
+	if (j == NULL)
+		return;
+
+	if (j->fd >= 0) {
+		drain(j);
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_lock(&j->lock);
+		j->stop = TRUE;
+		pthread_cond_signal(&j->more);
+		pthread_mutex_unlock(&j->lock);
+		pthread_join(j->thread, NULL);
+		pthread_cond_destroy(&j->more);
+		pthread_cond_destroy(&j->room);
+		pthread_mutex_destroy(&j->lock);
+#endif
+		close(j->fd);
+		if (discard)
+			unlink(j->path);
+	}
+	free(j->path);
+	free(j);
+	buf->journal = NULL;
+}
@@ -0,0 +1,60 @@
+/*
+ * This module maps the keys that edit a buffer or move its cursor to the
+ * core. do_input() hands them over here, and so does anything else that
+ * drives the core with keys, e.g. the benchmarks that replay scripts of
+ * keys, so that both go through the very same code.
+ */
+
+#include "proto.h"
+#include <ctype.h>
+
+/*
+ * Do what key does to buf. Return FALSE if key is not one of the keys
+ * handled here.
+ */
+bool do_key(Buffer *buf, int key)
+{
+	/* The keys past 255 are not for the ctype functions */
+	if (key == '\t' || (key >= 0 && key < 256 && isprint(key))) {
+		insert_char(buf, (char)key);
+		return TRUE;
+	}
+
+	switch (key) {
+	case KEY_DOWN:
+		go_down(buf);
+		break;
+	case KEY_RIGHT:
+		go_right(buf);
+		break;
+	case KEY_UP:
+		go_up(buf);
+		break;
+	case KEY_LEFT:
+		go_left(buf);
+		break;
+	case KEY_HOME:
+		go_beg(buf);
+		break;
+	case KEY_END:
+		go_end(buf);
+		break;
+	case CARRIAGE_RET:
+		do_enter(buf);
+		break;
+	case KEY_BACKSPACE:
+		do_backspace(buf);
+		break;
+	case DO_UNDO:
+		if (!read_only(buf) && !undo(buf))
+			render_msg("Nothing to undo");
+		break;
+	case DO_REDO:
+		if (!read_only(buf) && !redo(buf))
+			render_msg("Nothing to redo");
+		break;
+	default:
+		return FALSE;
+	}
+	return TRUE;
+}
@@ -0,0 +1,349 @@
+/*
+ * This module contains lazy buffers, used for files too large to be split
+ * into lines up front. A lazy buffer only holds the lines of a window
+ * [head, tail) of its original text: lines are made as the cursor gets
+ * close to either end of the window and dropped again from the end that
+ * is farther away once the window grows past lazy_cap bytes. Meanwhile a
+ * sparse index of line offsets is built while the editor is idle, so that
+ * the window can be moved anywhere in the file.
+ */
+
+#include "proto.h"
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+/* Every LAZY_STRIDE-th line of the original text is marked */
+#define LAZY_STRIDE 	1024
+/* Number of lines made at a time */
+#define LAZY_BATCH 		1024
+/* Lines kept around the screen no matter what */
+#define LAZY_MARGIN 	256
+/* Number of bytes scanned for marks per idle step */
+#define LAZY_SCAN_STEP 	(4 * 1024 * 1024)
+
+static Line *make_line(Buffer *buf, size_t off, size_t len);
+static void drop_line(Buffer *buf, Line *line);
+static void drop_pages(Buffer *buf, size_t beg, size_t end);
+static void add_mark(Lazy *lazy, size_t off);
+static bool scan_marks(Buffer *buf, size_t size);
+
+/*
+ * Make buf, whose original text has just been mapped, a lazy buffer and
+ * make its first lines.
+ */
+void lazy_open(Buffer *buf)
+{
+	Lazy *lazy;
+
+	lazy = malloc(sizeof(Lazy));
+	if (lazy == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	lazy->head = 0;
+	lazy->tail = 0;
+	lazy->marks = NULL;
+	lazy->nmarks = 0;
+	lazy->markcap = 0;
+	lazy->scanned = 0;
+	lazy->scanned_lines = 0;
+	buf->lazy = lazy;
+
+	add_mark(lazy, 0);
+	lazy_more(buf, DOWN);
+}
+
+void lazy_close(Buffer *buf)
+{
+	free(buf->lazy->marks);
+	free(buf->lazy);
+	buf->lazy = NULL;
+}
+
+static Line *make_line(Buffer *buf, size_t off, size_t len)
+{
+	Line *line;
+
+	line = pool_line(&buf->pool);
+	line->text = buf->orig + off;
+	line->len = len;
+	line->memsize = 0;
+	line->block = NULL;
+	line->prev = NULL;
+	line->next = NULL;
+
+	return line;
+}
+
+/*
+ * Make up to LAZY_BATCH more lines of the original text in dir-ward of
+ * the window. Return FALSE if the window already reaches that end of
+ * the file.
+ */
+bool lazy_more(Buffer *buf, Direction dir)
+{
+	Lazy *lazy = buf->lazy;
+	Line *line;
+	Scan scan;
+	size_t nl[LAZY_BATCH];
+	size_t n;
+	size_t off;
+	size_t i;
+
+	if (dir == DOWN) {
+		if (lazy->tail == buf->origsize)
+			return FALSE;
+		scan_init(&scan);
+		n = scan_lines(&scan, buf->orig + lazy->tail, 
+				buf->origsize - lazy->tail, nl, LAZY_BATCH);
+		/* The last line of the file does not end with '\n' */
+		if (n < LAZY_BATCH && (n == 0 || 
+					lazy->tail + nl[n - 1] < buf->origsize)) {
+			nl[n++] = buf->origsize - lazy->tail;
+		}
+		for (i = 0, off = lazy->tail; i < n; i++) {
+			line = make_line(buf, lazy->tail, off + nl[i] - lazy->tail);
+			lazy->tail = off + nl[i];
+
+			line->prev = buf->lastln;
+			if (buf->lastln != NULL)
+				buf->lastln->next = line;
+			else
+				buf->firstln = buf->curln = buf->topln = line;
+			buf->lastln = line;
+			index_append(buf, line);
+		}
+	}
+	else {
+		if (lazy->head == 0)
+			return FALSE;
+		for (i = 0; i < LAZY_BATCH && lazy->head > 0; i++) {
+			/* The line before head ends with the '\n' at head - 1 */
+			for (off = lazy->head - 1; off > 0 && buf->orig[off - 1] != '\n'; off--)
+				;
+			line = make_line(buf, off, lazy->head - off);
+			lazy->head = off;
+
+			line->next = buf->firstln;
+			buf->firstln->prev = line;
+			buf->firstln = line;
+			index_insert(buf, line);
+			buf->index.base--;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Unlink line, which is the first or the last line of buf, and free it.
+ */
+static void drop_line(Buffer *buf, Line *line)
+{
+	index_remove(buf, line);
+	if (line == buf->firstln) {
+		buf->firstln = line->next;
+		buf->firstln->prev = NULL;
+		buf->index.base++;
+	}
+	else {
+		buf->lastln = line->prev;
+		buf->lastln->next = NULL;
+	}
+	column_forget(buf, line);
+	pool_free_line(&buf->pool, line);
+}
+
+/*
+ * Let the kernel reclaim the pages that lie entirely within [beg, end) of
+ * the original text.
+ */
+static void drop_pages(Buffer *buf, size_t beg, size_t end)
+{
+#if defined(HAVE_MADVISE) && defined(MADV_DONTNEED)
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	beg = (beg + page - 1) / page * page;
+	end = end / page * page;
+	if (beg < end)
+		madvise(buf->orig + beg, end - beg, MADV_DONTNEED);
+#endif
+}
+
+/*
+ * Make sure the window of buf covers the screen and LAZY_MARGIN lines on
+ * either side of it, then shrink the window back to lazy_cap bytes if
+ * it has grown past that. Only lines that are still exactly the original
+ * text at the ends of the window are dropped; edited lines stay.
+ */
+void lazy_fill(Buffer *buf)
+{
+	Lazy *lazy = buf->lazy;
+	size_t rows = render->rows();
+	size_t above;
+	size_t below;
+	size_t old;
+
+	above = line_number(buf, buf->topln) - buf->index.base - 1;
+	while (above < LAZY_MARGIN && lazy_more(buf, UP)) {
+		above = line_number(buf, buf->topln) - buf->index.base - 1;
+	}
+	below = buf->index.nlines - above;
+	while (below < rows + LAZY_MARGIN && lazy_more(buf, DOWN)) {
+		below = buf->index.nlines - above;
+	}
+
+	/* Drop lines from the top */
+	old = lazy->head;
+	while (lazy->tail - lazy->head + buf->index.nlines * sizeof(Line) > lazy_cap &&
+			above > LAZY_MARGIN && buf->firstln->memsize == 0 && 
+			buf->firstln->text == buf->orig + lazy->head) {
+		lazy->head += buf->firstln->len;
+		drop_line(buf, buf->firstln);
+		above--;
+	}
+	drop_pages(buf, old, lazy->head);
+
+	/* Drop lines from the bottom */
+	old = lazy->tail;
+	while (lazy->tail - lazy->head + buf->index.nlines * sizeof(Line) > lazy_cap &&
+			below > rows + LAZY_MARGIN && buf->lastln->memsize == 0 && 
+			buf->lastln->text + buf->lastln->len == buf->orig + lazy->tail) {
+		lazy->tail -= buf->lastln->len;
+		drop_line(buf, buf->lastln);
+		below--;
+	}
+	drop_pages(buf, lazy->tail, old);
+}
+
+/*
+ * Make sure line number n of buf is in its window. If n is far away and
+ * nothing in the window has been edited, the window is moved there using
+ * the marks; otherwise it is grown until it reaches line n.
+ */
+void lazy_reach(Buffer *buf, size_t n)
+{
+	Lazy *lazy = buf->lazy;
+	Line *it;
+	Line *next;
+	size_t rows = render->rows();
+	size_t first;
+	size_t mark;
+	size_t off;
+
+	if (n > buf->index.base && n <= buf->index.base + buf->index.nlines)
+		return;
+
+	off = lazy->head;
+	for (it = buf->firstln; it != NULL; it = it->next) {
+		if (it->memsize != 0 || it->text != buf->orig + off)
+			break;
+		off += it->len;
+	}
+	/* Something was edited, grow the window */
+	if (it != NULL) {
+		while (n > buf->index.base + buf->index.nlines && lazy_more(buf, DOWN))
+			;
+		while (n <= buf->index.base && lazy_more(buf, UP))
+			;
+		return;
+	}
+
+	/* Find the mark before the first line to show */
+	first = (n > rows / 2 + LAZY_MARGIN) ? n - rows / 2 - LAZY_MARGIN : 1;
+	while ((first - 1) / LAZY_STRIDE >= lazy->nmarks && scan_marks(buf, LAZY_SCAN_STEP))
+		;
+	mark = (first - 1) / LAZY_STRIDE;
+	if (mark >= lazy->nmarks)
+		mark = lazy->nmarks - 1;
+
+	/* Start over at the mark */
+	column_forget(buf, buf->curln);
+	for (it = buf->firstln; it != NULL; it = next) {
+		next = it->next;
+		pool_free_line(&buf->pool, it);
+	}
+	index_destroy(buf);
+	drop_pages(buf, lazy->head, lazy->tail);
+	buf->firstln = buf->lastln = buf->curln = buf->topln = NULL;
+	buf->index.base = mark * LAZY_STRIDE;
+	lazy->head = lazy->tail = lazy->marks[mark];
+
+	while (n > buf->index.base + buf->index.nlines && lazy_more(buf, DOWN))
+		;
+}
+
+static void add_mark(Lazy *lazy, size_t off)
+{
+	if (lazy->nmarks == lazy->markcap) {
+		lazy->markcap = (lazy->markcap == 0) ? 1024 : 2 * lazy->markcap;
+		lazy->marks = realloc(lazy->marks, lazy->markcap * sizeof(size_t));
+		if (lazy->marks == NULL) {
+			fprintf(stderr, "%s: realloc failed\n", __func__);
+			finish();
+		}
+	}
+	lazy->marks[lazy->nmarks++] = off;
+}
+
+/*
+ * Scan about size more bytes of the original text of buf for marks.
+ * Return TRUE if there is more to scan.
+ */
+static bool scan_marks(Buffer *buf, size_t size)
+{
+	Lazy *lazy = buf->lazy;
+	Scan scan;
+	size_t nl[LAZY_STRIDE];
+	size_t start = lazy->scanned;
+	size_t want;
+	size_t end;
+	size_t n;
+
+	end = (buf->origsize - lazy->scanned > size) ? 
+		lazy->scanned + size : buf->origsize;
+	scan_init(&scan);
+	while (lazy->scanned < end) {
+		/* Up to the next line to be marked */
+		want = LAZY_STRIDE - lazy->scanned_lines % LAZY_STRIDE;
+		n = scan_lines(&scan, buf->orig + lazy->scanned, 
+				end - lazy->scanned, nl, want);
+		lazy->scanned_lines += n;
+		if (n < want) {
+			lazy->scanned = end;
+			break;
+		}
+		lazy->scanned += nl[n - 1];
+		if (lazy->scanned < buf->origsize)
+			add_mark(lazy, lazy->scanned);
+	}
+
+	/* Pages that were only scanned need not stay resident */
+	if (start < lazy->head)
+		drop_pages(buf, start, (lazy->scanned < lazy->head) ?
+				lazy->scanned : lazy->head);
+	if (lazy->scanned > lazy->tail)
+		drop_pages(buf, (start > lazy->tail) ? start : lazy->tail,
+				lazy->scanned);
+
+	return lazy->scanned < buf->origsize;
+}
+
+/*
+ * Scan a part of the lazy buffers that are not fully scanned yet.
+ * Return TRUE if any of them needs more scanning.
+ */
+bool lazy_idle()
+{
+	Buffer *buf;
+
+	for (buf = firstbuf; buf != NULL; buf = buf->next) {
+		if (buf->lazy != NULL && buf->lazy->scanned < buf->origsize) {
+			scan_marks(buf, LAZY_SCAN_STEP);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
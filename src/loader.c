@@ -0,0 +1,540 @@
+/*
+ * This module contains the background loader. Opening a file only maps
+ * its original text; a worker thread then faults the pages of the mapping
+ * in from the disk and publishes how far it got. The main thread splits
+ * whatever is ready into lines while the editor is idle, so the first
+ * screenful shows up as soon as it is read and the main loop never waits
+ * for the disk. A buffer cannot be modified until it is fully loaded.
+ *
+ * A compressed file is decoded by the worker instead. Lines point into
+ * the original text, which therefore must not move as it grows: address
+ * space is set aside for it up front and made usable as the text reaches
+ * it, and what is left over is given back once the file is decoded.
+ */
+
+#include "proto.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/* Number of bytes the worker faults in before publishing them */
+#define LOADER_CHUNK 	(1024 * 1024)
+/* Number of bytes split into lines per idle step */
+#define LOADER_STEP 	(1024 * 1024)
+/* Address space set aside for the text of a compressed file */
+#define DECODE_RESERVE 	((size_t)1 << (sizeof(size_t) > 4 ? 40 : 30))
+/* Number of bytes of it made usable at a time */
+#define DECODE_COMMIT 	(64 * 1024 * 1024)
+
+#ifdef HAVE_PTHREAD_H
+struct Loader {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	Buffer *buf;
+	/* The worker has brought in [0, ready) of the original text */
+	size_t ready;
+	/* The main thread has split [0, done) of it into lines */
+	size_t done;
+	bool stop;
+	bool finished;
+	/* Last line made by the loader, NULL while only the blank line exists */
+	Line *tail;
+	/* When loading started, see stats_clock() */
+	long started;
+	/* What decodes a compressed file, NULL if the file is mapped */
+	Decoder *decoder;
+	int fd;
+	/* Size of the compressed file and how much of it has been decoded */
+	size_t insize;
+	size_t consumed;
+	/* The file could not be decoded to its end */
+	bool failed;
+};
+
+static int start(Buffer *buf, Decoder *decoder, int fd, size_t insize);
+static void *load(void *arg);
+static void *decode(void *arg);
+static void trim(Buffer *buf, size_t size);
+static void publish(Loader *loader, size_t ready, bool finished);
+static bool step(Buffer *buf);
+static void push_line(Buffer *buf, const char *text, size_t len);
+static void split(Buffer *buf, const char *beg, size_t len);
+#endif
+
+/*
+ * Start loading the original text of buf, which has just been mapped, in
+ * the background. Return 0 on success or -1 if the text has to be split
+ * in the foreground.
+ */
+int loader_open(Buffer *buf)
+{
+#ifdef HAVE_PTHREAD_H
+	return start(buf, NULL, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Start decoding the file associated with fd, which is compressed as the
+ * codec of buf says, into the original text of buf in the background.
+ * Return 0 on success or -1 if it has to be decoded in the foreground.
+ */
+int loader_decode(Buffer *buf, int fd)
+{
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+	struct stat filestat;
+	Decoder *decoder;
+	char *reserve;
+
+	if (fstat(fd, &filestat) != 0)
+		return -1;
+	reserve = mmap(NULL, DECODE_RESERVE, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (reserve == MAP_FAILED)
+		return -1;
+	/* The caller closes fd once this returns */
+	if ((fd = dup(fd)) < 0) {
+		munmap(reserve, DECODE_RESERVE);
+		return -1;
+	}
+	if ((decoder = decoder_open(buf->codec, fd)) == NULL) {
+		close(fd);
+		munmap(reserve, DECODE_RESERVE);
+		return -1;
+	}
+
+	buf->orig = reserve;
+	buf->origsize = 0;
+	if (start(buf, decoder, fd, (size_t)filestat.st_size) != 0) {
+		decoder_close(decoder);
+		close(fd);
+		munmap(reserve, DECODE_RESERVE);
+		buf->orig = NULL;
+		return -1;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Start the worker of buf, which faults in its mapped original text or,
+ * given a decoder, decodes the compressed file of insize bytes open as fd.
+ * Return 0 on success or -1 if no thread could be started.
+ */
+static int start(Buffer *buf, Decoder *decoder, int fd, size_t insize)
+{
+	Loader *loader;
+
+	loader = malloc(sizeof(Loader));
+	if (loader == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	loader->buf = buf;
+	loader->ready = 0;
+	loader->done = 0;
+	loader->stop = FALSE;
+	loader->finished = FALSE;
+	loader->tail = NULL;
+	loader->started = stats_clock();
+	loader->decoder = decoder;
+	loader->fd = fd;
+	loader->insize = insize;
+	loader->consumed = 0;
+	loader->failed = FALSE;
+
+	pthread_mutex_init(&loader->lock, NULL);
+	if (pthread_create(&loader->thread, NULL,
+				(decoder != NULL) ? decode : load, loader) != 0) {
+		pthread_mutex_destroy(&loader->lock);
+		free(loader);
+		return -1;
+	}
+	buf->loader = loader;
+
+	/* The buffer shows a blank line until the first one is ready */
+	link_line(buf, new_line(buf));
+	buf->curln->text = buf->orig;
+
+	return 0;
+}
+#endif
+
+/*
+ * Stop the worker of buf, if it is still running, and forget about it.
+ * Lines made so far are left in place.
+ */
+void loader_close(Buffer *buf)
+{
+#ifdef HAVE_PTHREAD_H
+	Loader *loader = buf->loader;
+
+	pthread_mutex_lock(&loader->lock);
+	loader->stop = TRUE;
+	pthread_mutex_unlock(&loader->lock);
+	pthread_join(loader->thread, NULL);
+
+	/* The text is what was decoded so far */
+	if (loader->decoder != NULL) {
+		decoder_close(loader->decoder);
+		close(loader->fd);
+		trim(buf, loader->ready);
+	}
+	pthread_mutex_destroy(&loader->lock);
+	free(loader);
+	buf->loader = NULL;
+#endif
+}
+
+/*
+ * Return how much of the original text of buf has been loaded, in percent.
+ */
+int loader_progress(const Buffer *buf)
+{
+#ifdef HAVE_PTHREAD_H
+	Loader *loader = buf->loader;
+	size_t consumed;
+
+	/* How much of the compressed file is decoded is all there is to go by */
+	if (loader->decoder != NULL) {
+		pthread_mutex_lock(&loader->lock);
+		consumed = loader->consumed;
+		pthread_mutex_unlock(&loader->lock);
+		return (loader->insize == 0) ? 100 :
+			(int)((double)consumed * 100 / loader->insize);
+	}
+	return (int)((double)loader->done * 100 / buf->origsize);
+#else
+	return 100;
+#endif
+}
+
+/*
+ * Return TRUE if the compressed file of buf, which is being loaded, is
+ * still being decoded, so that its original text is not all there yet.
+ */
+bool loader_decoding(const Buffer *buf)
+{
+#ifdef HAVE_PTHREAD_H
+	return buf->loader->decoder != NULL;
+#else
+	return FALSE;
+#endif
+}
+
+/*
+ * Return TRUE if buf is still being loaded, in which case the user is
+ * told so; used by the commands that modify a buffer.
+ */
+bool still_loading(const Buffer *buf)
+{
+	if (buf->loader == NULL)
+		return FALSE;
+	render_msg("`%s' is still loading (%d%%)",
+			file_name(buf->path), loader_progress(buf));
+	return TRUE;
+}
+
+/*
+ * Return TRUE if any buffer is being loaded.
+ */
+bool loader_busy()
+{
+	Buffer *buf;
+
+	for (buf = firstbuf; buf != NULL; buf = buf->next) {
+		if (buf->loader != NULL)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * Split up to LOADER_STEP more bytes of what the workers have loaded into
+ * lines and have the buffer that got them shown again. Return FALSE if
+ * there was nothing to do.
+ */
+bool loader_idle()
+{
+#ifdef HAVE_PTHREAD_H
+	Buffer *buf;
+
+	for (buf = firstbuf; buf != NULL; buf = buf->next) {
+		if (buf->loader != NULL && step(buf))
+			return TRUE;
+	}
+#endif
+	return FALSE;
+}
+
+/*
+ * Split the rest of buf into lines, waiting for its worker while there is
+ * nothing new. Give up if the worker is finished yet nothing gets split.
+ */
+void loader_finish(Buffer *buf)
+{
+#ifdef HAVE_PTHREAD_H
+	Loader *loader;
+	size_t done;
+	bool finished;
+
+	while ((loader = buf->loader) != NULL) {
+		pthread_mutex_lock(&loader->lock);
+		finished = loader->finished;
+		pthread_mutex_unlock(&loader->lock);
+
+		done = loader->done;
+		step(buf);
+		if (buf->loader != loader || loader->done != done)
+			continue;
+		if (finished)
+			break;
+		usleep(LOADER_POLL * 1000);
+	}
+#endif
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Split up to LOADER_STEP more bytes of what the worker of buf has loaded
+ * into lines and have buf shown again. Return FALSE if there was nothing
+ * to do.
+ */
+static bool step(Buffer *buf)
+{
+	Loader *loader = buf->loader;
+	size_t ready;
+	size_t end;
+	const char *nl;
+	bool finished;
+
+	pthread_mutex_lock(&loader->lock);
+	ready = loader->ready;
+	finished = loader->finished;
+	pthread_mutex_unlock(&loader->lock);
+
+	/* Only split complete lines, unless the end of the text is reached */
+	end = ready;
+	if (end - loader->done > LOADER_STEP)
+		end = loader->done + LOADER_STEP;
+	if (end < ready || !finished) {
+		while (end > loader->done && buf->orig[end - 1] != '\n')
+			end--;
+		/* A line longer than a step */
+		if (end == loader->done) {
+			if ((nl = memchr(buf->orig + end, '\n', ready - end)) != NULL)
+				end = (size_t)(nl - buf->orig) + 1;
+			/* The last line, with no '\n' to end it */
+			else if (finished)
+				end = ready;
+		}
+	}
+
+	if (end > loader->done) {
+		split(buf, buf->orig + loader->done, end - loader->done);
+		loader->done = end;
+	}
+	else if (!finished) {
+		return FALSE;
+	}
+	if (finished && loader->done == ready) {
+		stats_add(STAT_LOAD, loader->started);
+		scan_finish(&buf->scan);
+		if (loader->failed) {
+			render_msg("Could not decompress all of `%s'",
+					file_name(buf->path));
+		}
+		loader_close(buf);
+	}
+	render->all(buf);
+	return TRUE;
+}
+
+/*
+ * Make a line out of len characters of the original text of buf at text
+ * and push it at the back of buf. The first line replaces the blank line
+ * set up by loader_open().
+ */
+static void push_line(Buffer *buf, const char *text, size_t len)
+{
+	Loader *loader = buf->loader;
+	Line *line;
+
+	if (loader->tail == NULL) {
+		line = buf->firstln;
+		column_forget(buf, line);
+	}
+	else {
+		line = pool_line(&buf->pool);
+		line->memsize = 0;
+		line->block = NULL;
+		line->next = NULL;
+		line->prev = buf->lastln;
+		buf->lastln->next = line;
+		buf->lastln = line;
+		index_append(buf, line);
+	}
+	/* Suppress compiler warning, the original text is never written to */
+	line->text = (char *)text;
+	line->len = len;
+	loader->tail = line;
+}
+
+/*
+ * Make lines out of len characters of the original text of buf starting
+ * at beg, which follow the lines made so far.
+ */
+static void split(Buffer *buf, const char *beg, size_t len)
+{
+	size_t nl[SCAN_BATCH];
+	size_t off = 0;
+	size_t prev;
+	size_t n;
+	size_t i;
+
+	do {
+		n = scan_lines(&buf->scan, beg + off, len - off, nl, SCAN_BATCH);
+		for (i = 0, prev = 0; i < n; prev = nl[i++]) {
+			push_line(buf, beg + off + prev, nl[i] - prev);
+		}
+		off += prev;
+	} while (n == SCAN_BATCH);
+	/* The last line of the file does not end with '\n' */
+	if (off < len) {
+		push_line(buf, beg + off, len - off);
+	}
+}
+
+/*
+ * Record that [0, ready) of the original text is in memory, and all of it
+ * if finished is TRUE.
+ */
+static void publish(Loader *loader, size_t ready, bool finished)
+{
+	pthread_mutex_lock(&loader->lock);
+	loader->ready = ready;
+	loader->finished = finished;
+	if (loader->decoder != NULL)
+		loader->consumed = decoder_consumed(loader->decoder);
+	pthread_mutex_unlock(&loader->lock);
+}
+
+/*
+ * The worker: touch every page of the original text, chunk by chunk, so
+ * that the main thread does not fault on them.
+ */
+static void *load(void *arg)
+{
+	Loader *loader = arg;
+	Buffer *buf = loader->buf;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t off = 0;
+	size_t end;
+	size_t p;
+	volatile char touch;
+	bool stop;
+
+	while (off < buf->origsize) {
+		pthread_mutex_lock(&loader->lock);
+		stop = loader->stop;
+		pthread_mutex_unlock(&loader->lock);
+		if (stop)
+			return NULL;
+
+		end = off + LOADER_CHUNK;
+		if (end > buf->origsize)
+			end = buf->origsize;
+
+#if defined(HAVE_MADVISE) && defined(MADV_WILLNEED)
+		madvise(buf->orig + off, end - off, MADV_WILLNEED);
+#endif
+		for (p = off; p < end; p += page)
+			touch = buf->orig[p];
+		touch = buf->orig[end - 1];
+		(void)touch;
+
+		off = end;
+		publish(loader, off, off == buf->origsize);
+	}
+
+	return NULL;
+}
+
+/*
+ * The worker for a compressed file: decode it chunk by chunk into the
+ * address space set aside for the original text, making more of that
+ * usable as it fills up.
+ */
+static void *decode(void *arg)
+{
+	Loader *loader = arg;
+	Buffer *buf = loader->buf;
+	size_t usable = 0;
+	size_t off = 0;
+	size_t want;
+	ssize_t n;
+	bool stop;
+
+	while (TRUE) {
+		pthread_mutex_lock(&loader->lock);
+		stop = loader->stop;
+		pthread_mutex_unlock(&loader->lock);
+		if (stop)
+			return NULL;
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+		if (off == usable) {
+			if (usable + DECODE_COMMIT > DECODE_RESERVE ||
+					mprotect(buf->orig + usable, DECODE_COMMIT,
+						PROT_READ | PROT_WRITE) != 0) {
+				loader->failed = TRUE;
+				break;
+			}
+			usable += DECODE_COMMIT;
+		}
+#endif
+		want = usable - off;
+		if (want > LOADER_CHUNK)
+			want = LOADER_CHUNK;
+		if ((n = decoder_read(loader->decoder, buf->orig + off, want)) <= 0) {
+			loader->failed = (n < 0);
+			break;
+		}
+		off += n;
+		publish(loader, off, FALSE);
+	}
+	publish(loader, off, TRUE);
+
+	return NULL;
+}
+
+/*
+ * Give back the address space set aside for the original text of buf but
+ * its first size bytes, which are all there is, and keep those read-only.
+ */
+static void trim(Buffer *buf, size_t size)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t used = (size + page - 1) / page * page;
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+	munmap(buf->orig + used, DECODE_RESERVE - used);
+	if (size > 0)
+		mprotect(buf->orig, used, PROT_READ);
+#endif
+	if (size == 0)
+		buf->orig = NULL;
+	buf->orig_mapped = (size > 0);
+	buf->origsize = size;
+}
+#endif
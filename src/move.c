@@ -4,82 +4,117 @@
 
 #include "proto.h"
 
-void go_down()
+void go_down(Buffer *buf)
 {
-	int tmp = curbuf->visual_x;
+	int tmp = buf->visual_x;
 
-	if (curbuf->curln != curbuf->lastln) {
-		curbuf->curln = curbuf->curln->next;
-		curbuf->x_pos = visual2real(curbuf->visual_x);
-		curbuf->visual_x = real2visual(curbuf->x_pos);
-		curbuf->y_pos++;
-		if (curbuf->y_pos == (LINES - MAINWIN_OFFSET)) {
-			scrol(DOWN);
-			curbuf->y_pos--;
-			curbuf->topln = curbuf->topln->next;
-			print_line(curbuf->curln);
+	if (buf->lazy != NULL)
+		lazy_fill(buf);
+	if (buf->curln != buf->lastln) {
+		collapse_gap(buf);
+		buf->curln = buf->curln->next;
+		buf->x_pos = visual2real(buf, buf->visual_x);
+		buf->visual_x = real2visual(buf, buf->x_pos);
+		buf->y_pos++;
+		if (buf->y_pos == render->rows()) {
+			render->scrol(buf, DOWN);
+			buf->y_pos--;
+			buf->topln = buf->topln->next;
+			render->line(buf, buf->curln);
 		}
-		position_cursor(mainwin, curbuf->y_pos, curbuf->visual_x);
-		curbuf->visual_x = tmp;
+		render->cursor(buf);
+		buf->visual_x = tmp;
 	}
 }
 
-void go_up()
+void go_up(Buffer *buf)
 {
-	int tmp = curbuf->visual_x;
+	int tmp = buf->visual_x;
 
-	if (curbuf->curln != curbuf->firstln) {
-		curbuf->curln = curbuf->curln->prev;
-		curbuf->x_pos = visual2real(curbuf->visual_x);
-		curbuf->visual_x = real2visual(curbuf->x_pos);
-		curbuf->y_pos--;
-		if (curbuf->y_pos == -1) {
-			scrol(UP);
-			curbuf->y_pos++;
-			curbuf->topln = curbuf->topln->prev;
-			print_line(curbuf->curln);
+	if (buf->lazy != NULL)
+		lazy_fill(buf);
+	if (buf->curln != buf->firstln) {
+		collapse_gap(buf);
+		buf->curln = buf->curln->prev;
+		buf->x_pos = visual2real(buf, buf->visual_x);
+		buf->visual_x = real2visual(buf, buf->x_pos);
+		buf->y_pos--;
+		if (buf->y_pos == -1) {
+			render->scrol(buf, UP);
+			buf->y_pos++;
+			buf->topln = buf->topln->prev;
+			render->line(buf, buf->curln);
 		}
-		position_cursor(mainwin, curbuf->y_pos, curbuf->visual_x);
-		curbuf->visual_x = tmp;
+		render->cursor(buf);
+		buf->visual_x = tmp;
 	}
 }
 
-void go_right()
+void go_right(Buffer *buf)
 {
-	char curln_ch = curbuf->curln->text[curbuf->x_pos];
-
-	if (curln_ch != '\n' && curln_ch != '\0') {
-		curbuf->x_pos++;
-		curbuf->visual_x = real2visual(curbuf->x_pos);
-		position_cursor(mainwin, curbuf->y_pos, curbuf->visual_x);
+	if ((size_t)buf->x_pos < buf->curln->len && 
+			CURLN_CHAR(buf, buf->x_pos) != '\n') {
+		buf->x_pos++;
+		buf->visual_x = real2visual(buf, buf->x_pos);
+		render->cursor(buf);
 	}
 }
 
-void go_left()
+void go_left(Buffer *buf)
 {
-	if (curbuf->x_pos > 0) {
-		curbuf->x_pos--;
-		curbuf->visual_x = real2visual(curbuf->x_pos);
-		position_cursor(mainwin, curbuf->y_pos, curbuf->visual_x);
+	if (buf->x_pos > 0) {
+		buf->x_pos--;
+		buf->visual_x = real2visual(buf, buf->x_pos);
+		render->cursor(buf);
 	}
 }
 
-void go_end()
+void go_end(Buffer *buf)
 {
-	if (curbuf->curln->text[curbuf->curln->len - 1] == '\n') {
-		curbuf->x_pos = curbuf->curln->len - 1;
+	if (buf->curln->len > 0 && 
+			CURLN_CHAR(buf, buf->curln->len - 1) == '\n') {
+		buf->x_pos = buf->curln->len - 1;
 	}
 	else {
-		curbuf->x_pos = curbuf->curln->len;
+		buf->x_pos = buf->curln->len;
 	}
-	curbuf->visual_x = real2visual(curbuf->x_pos);
-	position_cursor(mainwin, curbuf->y_pos, curbuf->visual_x);
+	buf->visual_x = real2visual(buf, buf->x_pos);
+	render->cursor(buf);
 }
 
-void go_beg()
+void go_beg(Buffer *buf)
 {
-	curbuf->x_pos = 0;
-	curbuf->visual_x = real2visual(curbuf->x_pos);
-	position_cursor(mainwin, curbuf->y_pos, curbuf->visual_x);
+	buf->x_pos = 0;
+	buf->visual_x = real2visual(buf, buf->x_pos);
+	render->cursor(buf);
 }
 
+
+/*
+ * Place the cursor on line number n, at character x. If line n is not on
+ * the screen already, it is brought to the middle of the screen.
+ */
+void go_to(Buffer *buf, size_t n, int x)
+{
+	size_t top;
+	size_t rows = render->rows();
+
+	collapse_gap(buf);
+	if (buf->lazy != NULL)
+		lazy_reach(buf, n);
+	buf->curln = line_at(buf, n);
+	n = line_number(buf, buf->curln);
+
+	top = line_number(buf, buf->topln);
+	if (n < top || n >= top + rows) {
+		top = (n > rows / 2) ? n - rows / 2 : 1;
+		buf->topln = line_at(buf, top);
+		top = line_number(buf, buf->topln);
+	}
+	buf->y_pos = n - top;
+	if (buf->lazy != NULL)
+		lazy_fill(buf);
+	buf->x_pos = x;
+	buf->visual_x = real2visual(buf, buf->x_pos);
+	render->all(buf);
+}
@@ -0,0 +1,167 @@
+/*
+ * This module contains the allocator for Line nodes and short line text.
+ * Every buffer has its own pool: small objects are carved out of large
+ * slabs, recycled through free lists and released all at once when the
+ * buffer is closed.
+ */
+
+#include "proto.h"
+#include <string.h>
+
+#define SLAB_SIZE 	(64 * 1024)
+#define POOL_ALIGN 	16
+
+/* Slabs are chained through their first bytes */
+typedef struct Slab {
+	struct Slab *next;
+} Slab;
+
+/* A free chunk of text is chained through its first bytes */
+typedef struct Chunk {
+	struct Chunk *next;
+} Chunk;
+
+static void *pool_carve(Pool *pool, size_t size);
+
+void pool_init(Pool *pool)
+{
+	memset(pool, 0, sizeof(Pool));
+}
+
+/*
+ * Cut size bytes off the current slab, starting a new one if needed.
+ */
+static void *pool_carve(Pool *pool, size_t size)
+{
+	Slab *slab;
+	char *ptr;
+
+	size = (size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+	if (pool->left < size) {
+		slab = malloc(SLAB_SIZE);
+		if (slab == NULL) {
+			fprintf(stderr, "%s: malloc failed\n", __func__);
+			finish();
+		}
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+		pool->nslabs++;
+		pool->next = (char *)slab + POOL_ALIGN;
+		pool->left = SLAB_SIZE - POOL_ALIGN;
+	}
+	ptr = pool->next;
+	pool->next += size;
+	pool->left -= size;
+
+	return ptr;
+}
+
+Line *pool_line(Pool *pool)
+{
+	Line *line;
+
+	if (pool->free_lines != NULL) {
+		line = pool->free_lines;
+		pool->free_lines = line->next;
+	}
+	else {
+		line = pool_carve(pool, sizeof(Line));
+	}
+	pool->served++;
+
+	return line;
+}
+
+void pool_free_line(Pool *pool, Line *line)
+{
+	line->next = pool->free_lines;
+	pool->free_lines = line;
+}
+
+/*
+ * Allocate room for at least *size characters of line text and store the
+ * actual size in *size. Text of up to POOL_TEXT_MAX characters comes from
+ * the pool, anything longer from the heap.
+ */
+char *text_alloc(Pool *pool, size_t *size)
+{
+	size_t class;
+	Chunk *chunk;
+
+	if (*size > POOL_TEXT_MAX) {
+		return charalloc(*size);
+	}
+
+	class = (*size == 0) ? 0 : (*size - 1) / POOL_ALIGN;
+	*size = (class + 1) * POOL_ALIGN;
+	if (pool->free_text[class] != NULL) {
+		chunk = pool->free_text[class];
+		pool->free_text[class] = chunk->next;
+	}
+	else {
+		chunk = pool_carve(pool, *size);
+	}
+	pool->served++;
+
+	return (char *)chunk;
+}
+
+/*
+ * Give back text of size characters. The size tells where it came from;
+ * a size of zero means that text is not owned at all.
+ */
+void text_free(Pool *pool, char *text, size_t size)
+{
+	Chunk *chunk;
+
+	if (size > POOL_TEXT_MAX) {
+		free(text);
+	}
+	else if (size > 0) {
+		chunk = (Chunk *)text;
+		chunk->next = pool->free_text[size / POOL_ALIGN - 1];
+		pool->free_text[size / POOL_ALIGN - 1] = chunk;
+	}
+}
+
+/*
+ * Resize text of oldsize characters to hold at least *size characters,
+ * keeping its contents. The new size is stored in *size.
+ */
+char *text_realloc(Pool *pool, char *text, size_t oldsize, size_t *size)
+{
+	char *ntext;
+
+	if (oldsize > POOL_TEXT_MAX && *size > POOL_TEXT_MAX) {
+		return charrealloc(text, *size);
+	}
+	ntext = text_alloc(pool, size);
+	memcpy(ntext, text, oldsize < *size ? oldsize : *size);
+	text_free(pool, text, oldsize);
+
+	return ntext;
+}
+
+/*
+ * Number of malloc() calls the pool has saved so far.
+ */
+size_t pool_avoided(const Pool *pool)
+{
+	return pool->served - pool->nslabs;
+}
+
+/*
+ * Release every slab of the pool at once. Anything that was handed out
+ * by the pool is gone afterwards.
+ */
+void pool_destroy(Pool *pool)
+{
+	Slab *slab;
+
+	while (pool->slabs != NULL) {
+		slab = pool->slabs;
+		pool->slabs = slab->next;
+		free(slab);
+	}
+	pool_init(pool);
+}
@@ -13,16 +13,21 @@ typedef struct Answer {
 	int x_pos;
 	int y_pos;
 	int x_margin;
+	/* Called with the text whenever it changes, if not NULL */
+	void (*changed)(const char *text);
 } Answer;
 static Answer answer;
 
 static void answer_init();
+static char *vprompt_str(void (*changed)(const char *), const char *msg,
+		va_list ap);
 static void mvprint_msg_prompt(const char *msg, int y);
 static void print_answer_prompt(const char *ans);
 static void insert_char_prompt(const char c);
 static void go_right_prompt();
 static void go_left_prompt();
 static void do_backspace_prompt();
+static void answer_changed();
 static void do_escape();
 static int do_input_prompt();
 
@@ -84,17 +89,44 @@ Response prompt_ync(const char *question, ...)
 char *prompt_str(const char *msg, ...)
 {
 	va_list ap;
+	char *text;
+
+	va_start (ap, msg);
+	text = vprompt_str(NULL, msg, ap);
+	va_end (ap);
+
+	return text;
+}
+
+/*
+ * Like prompt_str(), but call changed with the text typed so far every
+ * time it changes, e.g. to search as the user types.
+ */
+char *prompt_str_live(void (*changed)(const char *), const char *msg, ...)
+{
+	va_list ap;
+	char *text;
+
+	va_start (ap, msg);
+	text = vprompt_str(changed, msg, ap);
+	va_end (ap);
+
+	return text;
+}
+
+static char *vprompt_str(void (*changed)(const char *), const char *msg,
+		va_list ap)
+{
 	char buffer[256];
 	int retval;
 
-	va_start (ap, msg);
 	vsnprintf (buffer, 256, msg, ap);
-	va_end (ap);
 
 	answer_init();
+	answer.changed = changed;
 	
 	clear_win(bottwin);
-	answer.x_margin = strlen(msg);
+	answer.x_margin = strlen(buffer);
 	mvprint_msg_prompt(buffer, 0);
 	mvprint_msg_prompt("(Press ESCAPE to cancel)", 1);
 	position_cursor(bottwin, 0, answer.x_margin);
@@ -201,6 +233,18 @@ static void do_backspace_prompt()
 	}
 }
 
+/*
+ * Tell whoever asked for it that the text has changed. The cursor is put
+ * back on the prompt afterwards, wherever the callback left it.
+ */
+static void answer_changed()
+{
+	if (answer.changed != NULL) {
+		answer.changed(answer.text);
+		print_answer_prompt(answer.text);
+	}
+}
+
 static void do_escape()
 {
 	clear_win(bottwin);
@@ -219,6 +263,7 @@ static int do_input_prompt()
 
 	if (short_cut == FALSE && action_key == FALSE) {
 		insert_char_prompt(input);
+		answer_changed();
 	}
 	else if (action_key == TRUE) {
 		switch (input) {
@@ -229,10 +274,10 @@ static int do_input_prompt()
 			go_left_prompt();
 			break;
 		case KEY_HOME:
-			go_beg();
+			go_beg(curbuf);
 			break;
 		case KEY_END:
-			go_end();
+			go_end(curbuf);
 			break;
 		case CARRIAGE_RET:
 			retval = FALSE;
@@ -243,6 +288,7 @@ static int do_input_prompt()
 			break;
 		case KEY_BACKSPACE:
 			do_backspace_prompt();
+			answer_changed();
 			break;
 		case ERR:
 			retval = ERR;
@@ -265,5 +311,6 @@ static void answer_init()
 	answer.x_pos = 0;
 	answer.y_pos = 0;
 	answer.x_margin = 0;
+	answer.changed = NULL;
 }
 
@@ -12,13 +12,20 @@ extern WINDOW *mainwin;
 extern WINDOW *statbar;
 extern WINDOW *bottwin;
 extern Curwin curwin;
+extern Buffer *curbuf;
 
 extern Buffer *firstbuf;
 extern Buffer *lastbuf;
-extern Buffer *curbuf;
+extern const Render *render;
+extern const Render curses_render;
 
 extern int error;
 
+extern bool lazy_all;
+extern bool view_only;
+extern size_t lazy_cap;
+extern Sync sync_policy;
+
 /* Functions prototypes */
 
 /* veer.c */
@@ -28,41 +35,162 @@ void init_terminal();
 void init_window();
 void help();
 
-/* file.c */
-Buffer *new_buffer();
-void push_back_buffer(const char *path);
+/* command.c */
+void save_as(Buffer *buf);
+void do_save();
+void close_buffer();
 void do_prev_buf();
 void do_next_buf();
-Line *new_line();
-void delete_line(Line *line);
+void do_goto_line();
+void do_search(Direction dir);
+void do_regex_search();
+void do_regex_replace();
+
+/* column.c */
+size_t column_of(Buffer *buf, size_t i);
+size_t index_at(Buffer *buf, size_t x);
+void column_insert(Buffer *buf, size_t i, char c);
+void column_delete(Buffer *buf, size_t i, char c);
+void column_forget(Buffer *buf, const Line *line);
+void column_destroy(Buffer *buf);
+
+/* findall.c */
+void do_search_all();
+bool findall_idle();
+bool findall_busy();
+int findall_progress(const Buffer *buf);
+void findall_forget(Buffer *buf);
+void findall_goto();
+
+/* follow.c */
+void do_follow();
+void follow_stop(Buffer *buf);
+bool follow_busy();
+bool follow_idle();
+
+/* codec.c */
+Codec codec_of(int fd);
+const char *codec_name(Codec codec);
+Decoder *decoder_open(Codec codec, int fd);
+void decoder_close(Decoder *dec);
+ssize_t decoder_read(Decoder *dec, char *out, size_t size);
+size_t decoder_consumed(const Decoder *dec);
+Encoder *encoder_open(Codec codec);
+void encoder_close(Encoder *enc);
+int encoder_write(Encoder *enc, int fd, const char *text, size_t len);
+int encoder_finish(Encoder *enc, int fd);
+
+/* file.c */
+Buffer *new_buffer();
+Buffer *push_back_buffer(const char *path);
+void delete_buffer(Buffer *buf);
+int reload_buffer(Buffer *buf);
+void copy_original(Buffer *buf);
+Line *new_line(Buffer *buf);
+void delete_line(Buffer *buf, Line *line);
 FILE *open_file(const char *path, const char *mode);
-void open_buffer(const char* path);
-void push_back_line(const Line *line);
-void insert_line(Line *ptr, const Line *line);
-void read_into_buffer(FILE* fs);
-void save_buffer();
-void erase_line();
-void buffer_modified(bool modified);
+Buffer *open_buffer(const char* path);
+void push_back_line(Buffer *buf, const Line *line);
+void link_line(Buffer *buf, Line *nline);
+void insert_line(Buffer *buf, Line *ptr, Line *nline);
+void read_into_buffer(Buffer *buf, FILE* fs);
+void own_line(Buffer *buf, Line *line, size_t size);
+int write_buffer(Buffer *buf, FILE *fs);
+int commit_temp(FILE *fs, bool failed);
+int save_buffer(Buffer *buf);
+void erase_line(Buffer *buf, Line *ptr);
+void buffer_modified(Buffer *buf, bool modified);
+bool read_only(const Buffer *buf);
+
+/* index.c */
+void index_append(Buffer *buf, Line *line);
+void index_insert(Buffer *buf, Line *line);
+void index_remove(Buffer *buf, Line *line);
+void index_destroy(Buffer *buf);
+size_t line_number(Buffer *buf, const Line *line);
+Line *line_at(Buffer *buf, size_t n);
+
+/* keys.c */
+bool do_key(Buffer *buf, int key);
+
+/* lazy.c */
+void lazy_open(Buffer *buf);
+void lazy_close(Buffer *buf);
+bool lazy_more(Buffer *buf, Direction dir);
+void lazy_fill(Buffer *buf);
+void lazy_reach(Buffer *buf, size_t n);
+bool lazy_idle();
+
+/* loader.c */
+int loader_open(Buffer *buf);
+int loader_decode(Buffer *buf, int fd);
+void loader_close(Buffer *buf);
+int loader_progress(const Buffer *buf);
+bool loader_decoding(const Buffer *buf);
+bool still_loading(const Buffer *buf);
+bool loader_busy();
+bool loader_idle();
+void loader_finish(Buffer *buf);
+
+/* pool.c */
+void pool_init(Pool *pool);
+Line *pool_line(Pool *pool);
+void pool_free_line(Pool *pool, Line *line);
+char *text_alloc(Pool *pool, size_t *size);
+void text_free(Pool *pool, char *text, size_t size);
+char *text_realloc(Pool *pool, char *text, size_t oldsize, size_t *size);
+size_t pool_avoided(const Pool *pool);
+void pool_destroy(Pool *pool);
 
 /* move.c */
-void go_up();
-void go_down();
-void go_left();
-void go_right();
-void go_beg();
-void go_end();
+void go_up(Buffer *buf);
+void go_down(Buffer *buf);
+void go_left(Buffer *buf);
+void go_right(Buffer *buf);
+void go_beg(Buffer *buf);
+void go_end(Buffer *buf);
+void go_to(Buffer *buf, size_t n, int x);
+
+/* render.c */
+void render_msg(const char *msg, ...);
+
+/* undo.c */
+void undo_insert(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len);
+void undo_delete(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len);
+void undo_begin(Buffer *buf);
+void undo_end(Buffer *buf);
+void undo_saved(Buffer *buf);
+void undo_destroy(Buffer *buf);
+bool undo(Buffer *buf);
+bool redo(Buffer *buf);
+
+/* journal.c */
+void journal_insert(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len);
+void journal_delete(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len);
+bool journal_found(const Buffer *buf);
+size_t journal_replay(Buffer *buf);
+void journal_saved(Buffer *buf);
+void journal_discard(Buffer *buf);
+void journal_keep(Buffer *buf);
+void journal_close(Buffer *buf, bool discard);
 
 /* utils.c */
-int visual2real(const int visualx);
-int real2visual(const int realx);
+int visual2real(Buffer *buf, const int visualx);
+int real2visual(Buffer *buf, const int realx);
 char *charalloc(size_t size);
 char *charrealloc(char *ptr, size_t size);
 char *file_name(const char *path);
 
 /* winio.c */
 int get_input(WINDOW *win, bool *short_cut, bool *action_key);
+char *get_text(WINDOW *win, int first, bool paste, size_t *len);
 void clear_line(WINDOW *win, int y);
 void print_buffer(Line *beg);
+void shift_rows(int y, Direction dir);
 void scrol(Direction dir);
 void print_line(Line *line);
 void update_statbar();
@@ -72,15 +200,60 @@ void display_buffer();
 void clear_win(WINDOW *win);
 void clear_allwin();
 void switch_win(Curwin cur);
+void update_screen();
+void do_stats();
+
+/* regex.c */
+Regex *regex_compile(const char *pattern, const char **error);
+void regex_free(Regex *re);
+bool regex_exec(Regex *re, const char *text, size_t len, size_t from,
+		size_t *beg, size_t *end);
+bool regex_search(Buffer *buf, Regex *re, size_t *n, size_t *x);
+size_t regex_replace(Buffer *buf, Regex *re, const char *with);
+
+/* scan.c */
+void scan_init(Scan *scan);
+int scan_select(const char *name);
+const char *scan_name();
+size_t scan_lines(Scan *scan, const char *text, size_t len, size_t *nl,
+		size_t max);
+void scan_finish(Scan *scan);
+
+/* search.c */
+int search_select(const char *name);
+const char *search_name();
+void pattern_init(Pattern *pat, const char *text);
+void pattern_free(Pattern *pat);
+const char *pattern_find(const Pattern *pat, const char *text, size_t len);
+void search_set(const char *text);
+const char *search_text();
+bool search_buffer(Buffer *buf, Direction dir, bool at, size_t *n, size_t *x);
+
+/* stats.c */
+long stats_clock();
+void stats_add(Stat stat, long start);
+void stats_alloc(size_t size);
+const char *stats_name(Stat stat);
+const Histogram *stats_histogram(Stat stat);
+size_t stats_allocs(size_t *bytes);
+unsigned long stats_percentile(const Histogram *h, int p);
+void stats_dump(FILE *fs);
 
 /* text.c */
-void do_enter();
-void do_backspace();
-void insert_char(const char c);
+void collapse_gap(Buffer *buf);
+void do_enter(Buffer *buf);
+void do_backspace(Buffer *buf);
+void insert_char(Buffer *buf, const char c);
+void insert_str(Buffer *buf, const char *text, size_t len);
+void insert_text(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len);
+void delete_text(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len);
 
 /* prompt.c */
 Response prompt_ync(const char *question, ...);
 char *prompt_str(const char *msg, ...);
+char *prompt_str_live(void (*changed)(const char *), const char *msg, ...);
 void print_msg_prompt(const char *msg, ...);
 
 #endif
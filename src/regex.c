@@ -0,0 +1,1067 @@
+/*
+ * This module contains the regular expressions and the searching and
+ * replacing of buffers with them. The syntax is that of POSIX extended
+ * regular expressions without back references and bounds: . [] [^] *
+ * + ? | () ^ $, the classes [:alpha:] and the like inside brackets, and
+ * \d \w \s \D \W \S \t \n outside of them. Like regexec(), a match is the
+ * leftmost and then the longest one.
+ *
+ * A pattern is parsed into a tree, which is compiled into two Thompson
+ * NFAs: one for the pattern and one for it reversed. Neither is run as
+ * such; their states are grouped into DFA states as they are reached,
+ * and every transition between DFA states is computed once and then
+ * looked up, so matching costs a table lookup per character whatever
+ * the pattern. Characters that no part of the pattern tells apart share
+ * a column of the tables. If the states grow past REGEX_STATES, the
+ * tables are thrown away and built again.
+ *
+ * The reversed NFA runs from the end of a line back to where the search
+ * starts, with its start state added at every character, which finds the
+ * leftmost position a match starts at. The other one then runs from
+ * there for as long as it can, which finds where the longest match ends.
+ * Both only read every character once.
+ */
+
+#include "proto.h"
+#include <string.h>
+#include <ctype.h>
+
+/* Upper bound on the number of DFA states of a pattern */
+#define REGEX_STATES 	4096
+
+/* Node types of the tree */
+enum { N_EMPTY, N_SET, N_CAT, N_ALT, N_STAR, N_PLUS, N_QUEST, N_BOL, N_EOL };
+
+/* Instructions of the NFAs */
+enum { I_SET, I_SPLIT, I_JMP, I_BOL, I_EOL, I_MATCH };
+
+/* Flags of the DFA states */
+#define S_MATCH 	1
+#define S_MATCH_END 	2
+#define S_DEAD 		4
+
+typedef struct Node {
+	int type;
+	int a;
+	int b;
+} Node;
+
+typedef struct Inst {
+	int op;
+	int x;
+	int y;
+} Inst;
+
+/*
+ * A DFA built from an NFA as it runs. The kernel of a state lists the
+ * NFA instructions it is made of: I_SET, I_EOL and I_MATCH ones, all the
+ * others being followed right away. Kernels are stored back to back in
+ * kernels, state s at off[s]. Every state has a row of nclasses + 1
+ * ints in trans, and is known by where its row starts: the first int of
+ * the row holds its flags and the one at 1 + c the row of the state after
+ * it on class c, or -1 if not computed yet.
+ */
+typedef struct Dfa {
+	Inst *inst;
+	int ninst;
+	int instcap;
+	/* Whether the start state is added back at every character */
+	bool unanchored;
+	int nstates;
+	int *trans;
+	int *kernels;
+	size_t *off;
+	int *len;
+	size_t kernlen;
+	size_t kerncap;
+	int statecap;
+	int *hash;
+	int hashcap;
+	/* Start states at a boundary of the line or not, -1 if not built */
+	int start[2];
+	/* Scratch space: the kernel being built, a stack and visited marks */
+	int *kernel;
+	int nkernel;
+	int *stack;
+	unsigned int *mark;
+	unsigned int gen;
+	/* Bumped every time the tables are thrown away */
+	unsigned int flushes;
+} Dfa;
+
+struct Regex {
+	Node *nodes;
+	int nnodes;
+	int nodecap;
+	unsigned char (*sets)[32];
+	int nsets;
+	int setcap;
+	unsigned char classes[256];
+	/* A character of every class */
+	unsigned char rep[256];
+	int nclasses;
+	/* Whether an empty line matches, -1 if not known yet */
+	int empty;
+	Dfa fwd;
+	Dfa rev;
+	/* Where the parser is */
+	const char *p;
+	const char *error;
+};
+
+static int new_node(Regex *re, int type, int a, int b);
+static int new_set(Regex *re);
+static void set_add(unsigned char *set, int c);
+static void set_class(unsigned char *set, int (*is)(int), bool neg);
+static int parse_alt(Regex *re);
+static int parse_cat(Regex *re);
+static int parse_repeat(Regex *re);
+static int parse_atom(Regex *re);
+static int parse_bracket(Regex *re);
+static int parse_escape(Regex *re);
+static int emit(Dfa *dfa, int op, int x, int y);
+static void compile(Regex *re, Dfa *dfa, int node, bool reverse);
+static void make_classes(Regex *re);
+static void dfa_init(Dfa *dfa, bool unanchored);
+static void dfa_free(Dfa *dfa);
+static void dfa_flush(Dfa *dfa);
+static void add_closure(Dfa *dfa, int pc, bool bol, bool eol);
+static int add_state(Regex *re, Dfa *dfa);
+static int start_state(Regex *re, Dfa *dfa, bool bol);
+static int step(Regex *re, Dfa *dfa, int s, int c);
+static bool match_empty(Regex *re);
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (ptr == NULL) {
+		fprintf(stderr, "%s: realloc failed\n", __func__);
+		finish();
+	}
+	return ptr;
+}
+
+static int new_node(Regex *re, int type, int a, int b)
+{
+	if (re->nnodes == re->nodecap) {
+		re->nodecap = (re->nodecap == 0) ? 32 : 2 * re->nodecap;
+		re->nodes = xrealloc(re->nodes, re->nodecap * sizeof(Node));
+	}
+	re->nodes[re->nnodes].type = type;
+	re->nodes[re->nnodes].a = a;
+	re->nodes[re->nnodes].b = b;
+	return re->nnodes++;
+}
+
+/*
+ * Return the index of a new, empty character set.
+ */
+static int new_set(Regex *re)
+{
+	if (re->nsets == re->setcap) {
+		re->setcap = (re->setcap == 0) ? 16 : 2 * re->setcap;
+		re->sets = xrealloc(re->sets, re->setcap * sizeof(re->sets[0]));
+	}
+	memset(re->sets[re->nsets], 0, 32);
+	return re->nsets++;
+}
+
+static void set_add(unsigned char *set, int c)
+{
+	set[(unsigned char)c / 8] |= 1 << ((unsigned char)c % 8);
+}
+
+#define SET_HAS(set, c) 	((set)[(c) / 8] & (1 << ((c) % 8)))
+
+/*
+ * Add the characters for which is() holds, or does not if neg, to set.
+ */
+static void set_class(unsigned char *set, int (*is)(int), bool neg)
+{
+	int c;
+
+	for (c = 0; c < 256; c++) {
+		if ((is(c) != 0) != neg)
+			set_add(set, c);
+	}
+}
+
+static int is_word(int c)
+{
+	return isalnum(c) || c == '_';
+}
+
+/*
+ * Parse alternatives, which run up to the end of the pattern or a ')'.
+ */
+static int parse_alt(Regex *re)
+{
+	int left;
+
+	left = parse_cat(re);
+	while (re->error == NULL && *re->p == '|') {
+		re->p++;
+		left = new_node(re, N_ALT, left, parse_cat(re));
+	}
+	return left;
+}
+
+static int parse_cat(Regex *re)
+{
+	int left = -1;
+	int right;
+
+	while (re->error == NULL && *re->p != '\0' && *re->p != '|' &&
+			*re->p != ')') {
+		right = parse_repeat(re);
+		left = (left < 0) ? right : new_node(re, N_CAT, left, right);
+	}
+	return (left < 0) ? new_node(re, N_EMPTY, 0, 0) : left;
+}
+
+static int parse_repeat(Regex *re)
+{
+	int atom;
+
+	if (*re->p == '*' || *re->p == '+' || *re->p == '?') {
+		re->error = "nothing to repeat";
+		return -1;
+	}
+	atom = parse_atom(re);
+	while (re->error == NULL) {
+		if (*re->p == '*')
+			atom = new_node(re, N_STAR, atom, 0);
+		else if (*re->p == '+')
+			atom = new_node(re, N_PLUS, atom, 0);
+		else if (*re->p == '?')
+			atom = new_node(re, N_QUEST, atom, 0);
+		else
+			break;
+		re->p++;
+	}
+	return atom;
+}
+
+static int parse_atom(Regex *re)
+{
+	int set;
+	int node;
+
+	switch (*re->p) {
+	case '(':
+		re->p++;
+		node = parse_alt(re);
+		if (re->error != NULL)
+			return node;
+		if (*re->p != ')')
+			re->error = "unmatched (";
+		else
+			re->p++;
+		return node;
+	case '[':
+		re->p++;
+		return parse_bracket(re);
+	case '.':
+		re->p++;
+		set = new_set(re);
+		memset(re->sets[set], 0xff, 32);
+		re->sets[set]['\n' / 8] &= ~(1 << ('\n' % 8));
+		return new_node(re, N_SET, set, 0);
+	case '^':
+		re->p++;
+		return new_node(re, N_BOL, 0, 0);
+	case '$':
+		re->p++;
+		return new_node(re, N_EOL, 0, 0);
+	case '\\':
+		re->p++;
+		return parse_escape(re);
+	default:
+		set = new_set(re);
+		set_add(re->sets[set], *re->p++);
+		return new_node(re, N_SET, set, 0);
+	}
+}
+
+/*
+ * Parse what follows a '\' outside of brackets.
+ */
+static int parse_escape(Regex *re)
+{
+	unsigned char *set;
+	int s;
+	char c = *re->p;
+
+	if (c == '\0') {
+		re->error = "trailing backslash";
+		return -1;
+	}
+	re->p++;
+	s = new_set(re);
+	set = re->sets[s];
+	switch (c) {
+	case 'd': case 'D':
+		set_class(set, isdigit, c == 'D');
+		break;
+	case 'w': case 'W':
+		set_class(set, is_word, c == 'W');
+		break;
+	case 's': case 'S':
+		set_class(set, isspace, c == 'S');
+		break;
+	case 't':
+		set_add(set, '\t');
+		break;
+	case 'n':
+		set_add(set, '\n');
+		break;
+	default:
+		set_add(set, c);
+		break;
+	}
+	return new_node(re, N_SET, s, 0);
+}
+
+static const struct {
+	const char *name;
+	int (*is)(int);
+} char_classes[] = {
+	{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+	{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+	{ "lower", islower }, { "print", isprint }, { "punct", ispunct },
+	{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+/*
+ * Parse a bracket expression, after its '['.
+ */
+static int parse_bracket(Regex *re)
+{
+	int s = new_set(re);
+	unsigned char *set = re->sets[s];
+	bool neg = FALSE;
+	bool first = TRUE;
+	const char *end;
+	size_t i;
+	int lo;
+	int hi;
+	int c;
+
+	if (*re->p == '^') {
+		neg = TRUE;
+		re->p++;
+	}
+	while (*re->p != ']' || first) {
+		first = FALSE;
+		if (*re->p == '\0') {
+			re->error = "unmatched [";
+			return -1;
+		}
+		/* A class such as [:alpha:] */
+		if (re->p[0] == '[' && re->p[1] == ':' &&
+				(end = strstr(re->p + 2, ":]")) != NULL) {
+			for (i = 0; i < sizeof(char_classes) / sizeof(char_classes[0]);
+					i++) {
+				if (strlen(char_classes[i].name) == (size_t)(end - re->p - 2)
+						&& strncmp(char_classes[i].name, re->p + 2,
+							end - re->p - 2) == 0)
+					break;
+			}
+			if (i == sizeof(char_classes) / sizeof(char_classes[0])) {
+				re->error = "unknown character class";
+				return -1;
+			}
+			set_class(set, char_classes[i].is, FALSE);
+			re->p = end + 2;
+			continue;
+		}
+		lo = (unsigned char)*re->p++;
+		if (lo == '\\' && *re->p != '\0') {
+			lo = (unsigned char)*re->p++;
+			if (lo == 't')
+				lo = '\t';
+			else if (lo == 'n')
+				lo = '\n';
+		}
+		hi = lo;
+		if (re->p[0] == '-' && re->p[1] != ']' && re->p[1] != '\0') {
+			hi = (unsigned char)re->p[1];
+			re->p += 2;
+			if (hi < lo) {
+				re->error = "invalid range";
+				return -1;
+			}
+		}
+		for (c = lo; c <= hi; c++)
+			set_add(set, c);
+	}
+	re->p++;
+	if (neg) {
+		for (i = 0; i < 32; i++)
+			set[i] = ~set[i];
+		set[(unsigned char)'\n' / 8] &= ~(1 << ('\n' % 8));
+	}
+	return new_node(re, N_SET, s, 0);
+}
+
+static int emit(Dfa *dfa, int op, int x, int y)
+{
+	if (dfa->ninst == dfa->instcap) {
+		dfa->instcap = (dfa->instcap == 0) ? 32 : 2 * dfa->instcap;
+		dfa->inst = xrealloc(dfa->inst, dfa->instcap * sizeof(Inst));
+	}
+	dfa->inst[dfa->ninst].op = op;
+	dfa->inst[dfa->ninst].x = x;
+	dfa->inst[dfa->ninst].y = y;
+	return dfa->ninst++;
+}
+
+/*
+ * Compile node into dfa, backwards if reverse: concatenations are turned
+ * around and so are the meanings of ^ and $.
+ */
+static void compile(Regex *re, Dfa *dfa, int node, bool reverse)
+{
+	const Node *n = &re->nodes[node];
+	int a = n->a;
+	int b = n->b;
+	int split;
+	int jmp;
+
+	switch (n->type) {
+	case N_EMPTY:
+		break;
+	case N_SET:
+		emit(dfa, I_SET, n->a, 0);
+		break;
+	case N_BOL:
+		emit(dfa, reverse ? I_EOL : I_BOL, 0, 0);
+		break;
+	case N_EOL:
+		emit(dfa, reverse ? I_BOL : I_EOL, 0, 0);
+		break;
+	case N_CAT:
+		compile(re, dfa, reverse ? b : a, reverse);
+		compile(re, dfa, reverse ? a : b, reverse);
+		break;
+	case N_ALT:
+		split = emit(dfa, I_SPLIT, 0, 0);
+		dfa->inst[split].x = dfa->ninst;
+		compile(re, dfa, a, reverse);
+		jmp = emit(dfa, I_JMP, 0, 0);
+		dfa->inst[split].y = dfa->ninst;
+		compile(re, dfa, b, reverse);
+		dfa->inst[jmp].x = dfa->ninst;
+		break;
+	case N_STAR:
+		split = emit(dfa, I_SPLIT, 0, 0);
+		dfa->inst[split].x = dfa->ninst;
+		compile(re, dfa, a, reverse);
+		emit(dfa, I_JMP, split, 0);
+		dfa->inst[split].y = dfa->ninst;
+		break;
+	case N_PLUS:
+		jmp = dfa->ninst;
+		compile(re, dfa, a, reverse);
+		split = emit(dfa, I_SPLIT, jmp, 0);
+		dfa->inst[split].y = dfa->ninst;
+		break;
+	case N_QUEST:
+		split = emit(dfa, I_SPLIT, 0, 0);
+		dfa->inst[split].x = dfa->ninst;
+		compile(re, dfa, a, reverse);
+		dfa->inst[split].y = dfa->ninst;
+		break;
+	}
+}
+
+/*
+ * Group the characters into classes that every set of the pattern either
+ * has all or none of.
+ */
+static void make_classes(Regex *re)
+{
+	int map[256][2];
+	unsigned char old[256];
+	int s;
+	int c;
+	int in;
+
+	memset(re->classes, 0, sizeof(re->classes));
+	re->nclasses = 1;
+	for (s = 0; s < re->nsets; s++) {
+		memcpy(old, re->classes, sizeof(old));
+		memset(map, 0xff, sizeof(map));
+		re->nclasses = 0;
+		for (c = 0; c < 256; c++) {
+			in = SET_HAS(re->sets[s], c) ? 1 : 0;
+			if (map[old[c]][in] < 0)
+				map[old[c]][in] = re->nclasses++;
+			re->classes[c] = map[old[c]][in];
+		}
+	}
+	for (c = 255; c >= 0; c--)
+		re->rep[re->classes[c]] = c;
+}
+
+static void dfa_init(Dfa *dfa, bool unanchored)
+{
+	memset(dfa, 0, sizeof(Dfa));
+	dfa->unanchored = unanchored;
+	dfa->start[0] = dfa->start[1] = -1;
+}
+
+static void dfa_free(Dfa *dfa)
+{
+	free(dfa->inst);
+	free(dfa->trans);
+	free(dfa->kernels);
+	free(dfa->off);
+	free(dfa->len);
+	free(dfa->hash);
+	free(dfa->kernel);
+	free(dfa->stack);
+	free(dfa->mark);
+}
+
+/*
+ * Throw every state away.
+ */
+static void dfa_flush(Dfa *dfa)
+{
+	dfa->nstates = 0;
+	dfa->kernlen = 0;
+	dfa->start[0] = dfa->start[1] = -1;
+	memset(dfa->hash, 0xff, dfa->hashcap * sizeof(int));
+	dfa->flushes++;
+}
+
+/*
+ * Add the instructions reached from pc that make up a kernel to the
+ * kernel being built. ^ is only passed if bol and $ only if eol.
+ */
+static void add_closure(Dfa *dfa, int pc, bool bol, bool eol)
+{
+	const Inst *inst;
+	int sp = 0;
+
+	dfa->stack[sp++] = pc;
+	while (sp > 0) {
+		pc = dfa->stack[--sp];
+		if (dfa->mark[pc] == dfa->gen)
+			continue;
+		dfa->mark[pc] = dfa->gen;
+		inst = &dfa->inst[pc];
+		switch (inst->op) {
+		case I_SPLIT:
+			dfa->stack[sp++] = inst->y;
+			dfa->stack[sp++] = inst->x;
+			break;
+		case I_JMP:
+			dfa->stack[sp++] = inst->x;
+			break;
+		case I_BOL:
+			if (bol)
+				dfa->stack[sp++] = pc + 1;
+			break;
+		case I_EOL:
+			if (eol)
+				dfa->stack[sp++] = pc + 1;
+			else
+				dfa->kernel[dfa->nkernel++] = pc;
+			break;
+		default:
+			dfa->kernel[dfa->nkernel++] = pc;
+			break;
+		}
+	}
+}
+
+static int compare_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Return the row of the state whose kernel is the one that has been
+ * built, making it if need be.
+ */
+static int add_state(Regex *re, Dfa *dfa)
+{
+	const int stride = re->nclasses + 1;
+	unsigned int h = 2166136261u;
+	int *kernel = dfa->kernel;
+	int n = dfa->nkernel;
+	int flags = 0;
+	int s;
+	int i;
+
+	qsort(kernel, n, sizeof(int), compare_int);
+	for (i = 0; i < n; i++)
+		h = (h ^ (unsigned int)kernel[i]) * 16777619u;
+
+	for (i = h & (dfa->hashcap - 1); (s = dfa->hash[i]) >= 0;
+			i = (i + 1) & (dfa->hashcap - 1)) {
+		if (dfa->len[s] == n && memcmp(dfa->kernels + dfa->off[s],
+					kernel, n * sizeof(int)) == 0)
+			return s * stride;
+	}
+
+	if (dfa->nstates == REGEX_STATES) {
+		dfa_flush(dfa);
+		for (i = h & (dfa->hashcap - 1); dfa->hash[i] >= 0;
+				i = (i + 1) & (dfa->hashcap - 1))
+			;
+	}
+	if (dfa->nstates == dfa->statecap) {
+		dfa->statecap = (dfa->statecap == 0) ? 16 : 2 * dfa->statecap;
+		dfa->trans = xrealloc(dfa->trans,
+				(size_t)dfa->statecap * stride * sizeof(int));
+		dfa->off = xrealloc(dfa->off, dfa->statecap * sizeof(size_t));
+		dfa->len = xrealloc(dfa->len, dfa->statecap * sizeof(int));
+	}
+	if (dfa->kernlen + n > dfa->kerncap) {
+		dfa->kerncap = 2 * (dfa->kernlen + n);
+		dfa->kernels = xrealloc(dfa->kernels, dfa->kerncap * sizeof(int));
+	}
+	s = dfa->nstates++;
+	dfa->hash[i] = s;
+	memcpy(dfa->kernels + dfa->kernlen, kernel, n * sizeof(int));
+	dfa->off[s] = dfa->kernlen;
+	dfa->len[s] = n;
+	dfa->kernlen += n;
+	memset(dfa->trans + (size_t)s * stride, 0xff, stride * sizeof(int));
+
+	/* Whether a match ends here, or would at the end of the line */
+	if (n == 0)
+		flags |= S_DEAD;
+	kernel = dfa->kernels + dfa->off[s];
+	dfa->gen++;
+	dfa->nkernel = 0;
+	for (i = 0; i < n; i++) {
+		if (dfa->inst[kernel[i]].op == I_MATCH)
+			flags |= S_MATCH | S_MATCH_END;
+		else if (dfa->inst[kernel[i]].op == I_EOL)
+			add_closure(dfa, kernel[i], FALSE, TRUE);
+	}
+	for (i = 0; i < dfa->nkernel; i++) {
+		if (dfa->inst[dfa->kernel[i]].op == I_MATCH)
+			flags |= S_MATCH_END;
+	}
+	dfa->trans[s * stride] = flags;
+	return s * stride;
+}
+
+static int start_state(Regex *re, Dfa *dfa, bool bol)
+{
+	if (dfa->start[bol] < 0) {
+		dfa->gen++;
+		dfa->nkernel = 0;
+		add_closure(dfa, 0, bol, FALSE);
+		dfa->start[bol] = add_state(re, dfa);
+	}
+	return dfa->start[bol];
+}
+
+/*
+ * Compute the state after the one whose row is at s on a character of
+ * class c.
+ */
+static int step(Regex *re, Dfa *dfa, int s, int c)
+{
+	const int row = s;
+	unsigned int flushes = dfa->flushes;
+	const Inst *inst;
+	int *kernel;
+	int n;
+	int next;
+	int i;
+
+	/* The kernel may move while the new one is built */
+	s /= re->nclasses + 1;
+	n = dfa->len[s];
+	kernel = malloc(n * sizeof(int) + 1);
+	if (kernel == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", __func__);
+		finish();
+	}
+	memcpy(kernel, dfa->kernels + dfa->off[s], n * sizeof(int));
+
+	dfa->gen++;
+	dfa->nkernel = 0;
+	for (i = 0; i < n; i++) {
+		inst = &dfa->inst[kernel[i]];
+		if (inst->op == I_SET && SET_HAS(re->sets[inst->x], re->rep[c]))
+			add_closure(dfa, kernel[i] + 1, FALSE, FALSE);
+	}
+	if (dfa->unanchored)
+		add_closure(dfa, 0, FALSE, FALSE);
+	free(kernel);
+
+	next = add_state(re, dfa);
+	if (dfa->flushes == flushes)
+		dfa->trans[row + 1 + c] = next;
+	return next;
+}
+
+/*
+ * Return whether re matches an empty line, where ^ and $ both hold at
+ * once, which no state of the DFAs stands for.
+ */
+static bool match_empty(Regex *re)
+{
+	Dfa *dfa = &re->fwd;
+	int i;
+
+	if (re->empty < 0) {
+		dfa->gen++;
+		dfa->nkernel = 0;
+		add_closure(dfa, 0, TRUE, TRUE);
+		re->empty = FALSE;
+		for (i = 0; i < dfa->nkernel; i++) {
+			if (dfa->inst[dfa->kernel[i]].op == I_MATCH)
+				re->empty = TRUE;
+		}
+	}
+	return re->empty;
+}
+
+/*
+ * Compile pattern. Return NULL and store what is wrong with it in *error
+ * if it is not a valid pattern.
+ */
+Regex *regex_compile(const char *pattern, const char **error)
+{
+	Regex *re;
+	int root;
+	Dfa *dfa;
+	int i;
+
+	re = calloc(1, sizeof(Regex));
+	if (re == NULL) {
+		fprintf(stderr, "%s: calloc failed\n", __func__);
+		finish();
+	}
+	re->p = pattern;
+	root = parse_alt(re);
+	if (re->error == NULL && *re->p == ')')
+		re->error = "unmatched )";
+	if (re->error != NULL) {
+		*error = re->error;
+		regex_free(re);
+		return NULL;
+	}
+	make_classes(re);
+	re->empty = -1;
+
+	dfa_init(&re->fwd, FALSE);
+	dfa_init(&re->rev, TRUE);
+	for (i = 0; i < 2; i++) {
+		dfa = (i == 0) ? &re->fwd : &re->rev;
+		compile(re, dfa, root, i == 1);
+		emit(dfa, I_MATCH, 0, 0);
+		/* Every instruction is pushed once per jump to it at most */
+		dfa->kernel = xrealloc(NULL, dfa->ninst * sizeof(int));
+		dfa->stack = xrealloc(NULL, (2 * dfa->ninst + 1) * sizeof(int));
+		dfa->mark = calloc(dfa->ninst, sizeof(unsigned int));
+		if (dfa->mark == NULL) {
+			fprintf(stderr, "%s: calloc failed\n", __func__);
+			finish();
+		}
+		dfa->hashcap = 2 * REGEX_STATES;
+		dfa->hash = xrealloc(NULL, dfa->hashcap * sizeof(int));
+		memset(dfa->hash, 0xff, dfa->hashcap * sizeof(int));
+	}
+	free(re->nodes);
+	re->nodes = NULL;
+	return re;
+}
+
+void regex_free(Regex *re)
+{
+	if (re == NULL)
+		return;
+	free(re->nodes);
+	free(re->sets);
+	dfa_free(&re->fwd);
+	dfa_free(&re->rev);
+	free(re);
+}
+
+/*
+ * Find the leftmost-longest match of re in the line of len characters at
+ * text, without its '\n', that starts at or after from. Return TRUE if
+ * there is one and store where it starts and ends in *beg and *end.
+ */
+bool regex_exec(Regex *re, const char *text, size_t len, size_t from,
+		size_t *beg, size_t *end)
+{
+	const unsigned char *classes = re->classes;
+	const int *trans;
+	Dfa *dfa;
+	size_t start = len + 1;
+	size_t p;
+	int s;
+	int next;
+	int c;
+
+	if (from > len)
+		return FALSE;
+	if (len == 0) {
+		*beg = *end = 0;
+		return match_empty(re);
+	}
+
+	/* Backward for the leftmost start */
+	dfa = &re->rev;
+	s = start_state(re, dfa, TRUE);
+	trans = dfa->trans;
+	for (p = len; ; p--) {
+		if (trans[s] & ((p == 0) ? S_MATCH_END : S_MATCH))
+			start = p;
+		if (p == from)
+			break;
+		c = classes[(unsigned char)text[p - 1]];
+		if ((next = trans[s + 1 + c]) < 0) {
+			next = step(re, dfa, s, c);
+			trans = dfa->trans;
+		}
+		s = next;
+	}
+	if (start > len)
+		return FALSE;
+
+	/* Then forward for the longest match from there */
+	dfa = &re->fwd;
+	s = start_state(re, dfa, start == 0);
+	trans = dfa->trans;
+	for (p = start; ; p++) {
+		if (trans[s] & ((p == len) ? S_MATCH_END : S_MATCH))
+			*end = p;
+		if (p == len || (trans[s] & S_DEAD))
+			break;
+		c = classes[(unsigned char)text[p]];
+		if ((next = trans[s + 1 + c]) < 0) {
+			next = step(re, dfa, s, c);
+			trans = dfa->trans;
+		}
+		s = next;
+	}
+	*beg = start;
+	return TRUE;
+}
+
+/*
+ * Return the length of line without its '\n'.
+ */
+static size_t text_len(const char *text, size_t len)
+{
+	return (len > 0 && text[len - 1] == '\n') ? len - 1 : len;
+}
+
+/*
+ * Search the lines of [beg, end) of the original text of buf, the first
+ * of which is line number n. Store the number of the line of the first
+ * match in *n and where in it it is in *x.
+ */
+static bool find_orig(Regex *re, Buffer *buf, size_t beg, size_t end,
+		size_t *n, size_t *x)
+{
+	const char *p = buf->orig + beg;
+	const char *stop = buf->orig + end;
+	const char *eol;
+	size_t mend;
+
+	for (; p < stop; p = eol + 1, (*n)++) {
+		if ((eol = memchr(p, '\n', stop - p)) == NULL)
+			eol = stop;
+		if (regex_exec(re, p, eol - p, 0, x, &mend))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * Search the lines from line on, up to but not including stop, the first
+ * of which is line number *n.
+ */
+static Line *find_lines(Regex *re, Line *line, const Line *stop, size_t *n,
+		size_t *x)
+{
+	size_t mend;
+
+	for (; line != stop; line = line->next, (*n)++) {
+		if (regex_exec(re, line->text, text_len(line->text, line->len), 0,
+					x, &mend))
+			return line;
+	}
+	return NULL;
+}
+
+/*
+ * Find the next match of re after the cursor of buf, wrapping around the
+ * end of the buffer. Store the number of its line in *n and where in it
+ * it is in *x.
+ */
+bool regex_search(Buffer *buf, Regex *re, size_t *n, size_t *x)
+{
+	Lazy *lazy = buf->lazy;
+	Line *cur = buf->curln;
+	size_t mend;
+	bool found;
+
+	collapse_gap(buf);
+	*n = line_number(buf, cur);
+	found = regex_exec(re, cur->text, text_len(cur->text, cur->len),
+			buf->x_pos + 1, x, &mend);
+	if (!found) {
+		(*n)++;
+		found = find_lines(re, cur->next, NULL, n, x) != NULL;
+	}
+	if (!found && lazy != NULL) {
+		found = find_orig(re, buf, lazy->tail, buf->origsize, n, x);
+		if (!found) {
+			*n = 1;
+			found = find_orig(re, buf, 0, lazy->head, n, x);
+		}
+	}
+	if (!found) {
+		*n = line_number(buf, buf->firstln);
+		found = find_lines(re, buf->firstln, cur->next, n, x) != NULL;
+	}
+	return found;
+}
+
+/*
+ * Append len characters of text to the text being built at *out.
+ */
+static void append(char **out, size_t *outlen, size_t *outcap,
+		const char *text, size_t len)
+{
+	if (*outlen + len > *outcap) {
+		*outcap = 2 * (*outlen + len);
+		*out = charrealloc(*out, *outcap);
+	}
+	memcpy(*out + *outlen, text, len);
+	*outlen += len;
+}
+
+/*
+ * Replace every match of re in line with with, in which & stands for what
+ * matched and \ takes the meaning away from the next character. The text
+ * of the line, which is line number n, is only replaced if something
+ * matched, and only what changed is logged for undo. Return the number
+ * of matches.
+ */
+static size_t replace_line(Buffer *buf, Regex *re, Line *line, size_t n,
+		const char *with, char **out, size_t *outcap)
+{
+	const char *text = line->text;
+	size_t len = text_len(text, line->len);
+	size_t outlen = 0;
+	size_t count = 0;
+	size_t from = 0;
+	size_t prev = (size_t)-1;
+	size_t beg;
+	size_t end;
+	size_t size;
+	size_t head;
+	size_t tail;
+	const char *w;
+
+	while (regex_exec(re, text, len, from, &beg, &end)) {
+		/* No empty match right after the previous match */
+		if (beg == end && beg == prev) {
+			if (beg == len)
+				break;
+			append(out, &outlen, outcap, text + from, beg + 1 - from);
+			from = beg + 1;
+			continue;
+		}
+		append(out, &outlen, outcap, text + from, beg - from);
+		for (w = with; *w != '\0'; w++) {
+			if (*w == '&')
+				append(out, &outlen, outcap, text + beg, end - beg);
+			else if (*w == '\\' && w[1] != '\0')
+				append(out, &outlen, outcap, ++w, 1);
+			else
+				append(out, &outlen, outcap, w, 1);
+		}
+		count++;
+		prev = end;
+		if (end == beg) {
+			if (beg == len)
+				break;
+			append(out, &outlen, outcap, text + beg, 1);
+			from = beg + 1;
+		}
+		else {
+			from = end;
+		}
+	}
+	if (count == 0)
+		return 0;
+	if (from < line->len)
+		append(out, &outlen, outcap, text + from, line->len - from);
+
+	for (head = 0; head < line->len && head < outlen &&
+			text[head] == (*out)[head]; head++)
+		;
+	for (tail = 0; tail < line->len - head && tail < outlen - head &&
+			text[line->len - 1 - tail] == (*out)[outlen - 1 - tail]; tail++)
+		;
+	if (line->len - head - tail > 0)
+		undo_delete(buf, n, head, text + head, line->len - head - tail);
+	if (outlen - head - tail > 0)
+		undo_insert(buf, n, head, *out + head, outlen - head - tail);
+
+	size = outlen;
+	line->text = text_alloc(&buf->pool, &size);
+	memcpy(line->text, *out, outlen);
+	if (line->memsize != 0)
+		text_free(&buf->pool, (char *)text, line->memsize);
+	line->len = outlen;
+	line->memsize = size;
+	column_forget(buf, line);
+	return count;
+}
+
+/*
+ * Replace every match of re in buf with with in one go, which is undone
+ * as one step. Return the number of matches.
+ */
+size_t regex_replace(Buffer *buf, Regex *re, const char *with)
+{
+	char *out = NULL;
+	size_t outcap = 0;
+	size_t count = 0;
+	size_t len;
+	Line *it;
+	size_t n;
+
+	/* Every line of a lazy buffer has to be made first */
+	if (buf->lazy != NULL) {
+		while (lazy_more(buf, UP))
+			;
+		while (lazy_more(buf, DOWN))
+			;
+	}
+	collapse_gap(buf);
+	n = line_number(buf, buf->firstln);
+	undo_begin(buf);
+	for (it = buf->firstln; it != NULL; it = it->next, n++)
+		count += replace_line(buf, re, it, n, with, &out, &outcap);
+	undo_end(buf);
+	free(out);
+
+	if (count > 0) {
+		/* The cursor may be past the end of its line now */
+		len = text_len(buf->curln->text, buf->curln->len);
+		if ((size_t)buf->x_pos > len)
+			buf->x_pos = len;
+		buf->visual_x = real2visual(buf, buf->x_pos);
+		buffer_modified(buf, TRUE);
+		render->all(buf);
+	}
+	return count;
+}
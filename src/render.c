@@ -0,0 +1,83 @@
+/*
+ * This module connects the editing core to whatever shows it. The core
+ * never draws anything itself: the functions that change a buffer tell
+ * render what changed, and render decides what to do about it. The editor
+ * points render at the curses screen, see winio.c; until then, and in
+ * programs that drive the core without a screen, nothing is shown at all.
+ */
+
+#include "proto.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+/* Number of rows the screen of the null renderer is taken to have */
+#define NULL_ROWS 	24
+
+static int null_rows();
+static void null_line(Buffer *buf, Line *line);
+static void null_shift(Buffer *buf, int y, Direction dir);
+static void null_scroll(Buffer *buf, Direction dir);
+static void null_buffer(Buffer *buf);
+static void null_message(const char *msg);
+
+static const Render null_render = {
+	null_rows,
+	null_line,
+	null_line,
+	null_shift,
+	null_scroll,
+	null_buffer,
+	null_buffer,
+	null_buffer,
+	null_message
+};
+
+const Render *render = &null_render;
+
+static int null_rows()
+{
+	return NULL_ROWS;
+}
+
+static void null_line(Buffer *buf, Line *line)
+{
+	(void)buf;
+	(void)line;
+}
+
+static void null_shift(Buffer *buf, int y, Direction dir)
+{
+	(void)buf;
+	(void)y;
+	(void)dir;
+}
+
+static void null_scroll(Buffer *buf, Direction dir)
+{
+	(void)buf;
+	(void)dir;
+}
+
+static void null_buffer(Buffer *buf)
+{
+	(void)buf;
+}
+
+static void null_message(const char *msg)
+{
+	(void)msg;
+}
+
+/*
+ * Tell the user about something, printf() style.
+ */
+void render_msg(const char *msg, ...)
+{
+	char buffer[256];
+	va_list ap;
+
+	va_start(ap, msg);
+	vsnprintf(buffer, sizeof(buffer), msg, ap);
+	va_end(ap);
+	render->message(buffer);
+}
@@ -0,0 +1,222 @@
+/*
+ * This module finds the line breaks of a text, which is what every file
+ * that is opened spends most of its time on. Besides where the lines end,
+ * a scan counts the lines, the lines ending with "\r\n" and the NUL bytes
+ * and finds the longest line, all in the same pass.
+ *
+ * Blocks of 16 (SSE2) or 32 (AVX2) bytes are compared at once where the
+ * CPU supports it, which is found out on the first call; anything else
+ * goes through a plain loop.
+ */
+
+#include "proto.h"
+#include <string.h>
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*Scanner)(Scan *scan, const char *text, size_t len,
+		size_t *nl, size_t max);
+
+static size_t scan_from(Scan *scan, const char *text, size_t i, size_t len,
+		size_t *nl, size_t n, size_t max);
+static size_t scan_scalar(Scan *scan, const char *text, size_t len,
+		size_t *nl, size_t max);
+#ifdef SCAN_X86
+static size_t scan_sse2(Scan *scan, const char *text, size_t len,
+		size_t *nl, size_t max);
+static size_t scan_avx2(Scan *scan, const char *text, size_t len,
+		size_t *nl, size_t max);
+#endif
+
+static const struct {
+	const char *name;
+	Scanner scanner;
+} scanners[] = {
+	{ "scalar", scan_scalar },
+#ifdef SCAN_X86
+	{ "sse2", scan_sse2 },
+	{ "avx2", scan_avx2 },
+#endif
+};
+
+/* Index into scanners of the one in use, -1 until the first scan */
+static int scanner = -1;
+
+void scan_init(Scan *scan)
+{
+	memset(scan, 0, sizeof(Scan));
+	scan->last = '\n';
+}
+
+/*
+ * Use the scanner called name from now on. Return 0 on success or -1 if
+ * there is no such scanner or the CPU does not support it.
+ */
+int scan_select(const char *name)
+{
+	int i;
+
+	for (i = 0; i < (int)(sizeof(scanners) / sizeof(scanners[0])); i++) {
+		if (strcmp(scanners[i].name, name) != 0)
+			continue;
+#ifdef SCAN_X86
+		__builtin_cpu_init();
+		if ((scanners[i].scanner == scan_sse2 &&
+					!__builtin_cpu_supports("sse2")) ||
+				(scanners[i].scanner == scan_avx2 &&
+				 !__builtin_cpu_supports("avx2"))) {
+			return -1;
+		}
+#endif
+		scanner = i;
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Return the name of the scanner in use.
+ */
+const char *scan_name()
+{
+	if (scanner < 0 && scan_select("avx2") != 0 && scan_select("sse2") != 0)
+		scan_select("scalar");
+	return scanners[scanner].name;
+}
+
+/*
+ * Scan len more characters of a text, which continue where the previous
+ * call left off. The end of every line found, i.e. the index right after
+ * its '\n', is stored in nl, relative to text. The scan stops after max
+ * lines; return the number of them found. Unless that is max, all of text
+ * has been scanned.
+ */
+size_t scan_lines(Scan *scan, const char *text, size_t len, size_t *nl,
+		size_t max)
+{
+	size_t n;
+
+	if (max == 0)
+		return 0;
+	if (scanner < 0)
+		scan_name();
+	n = scanners[scanner].scanner(scan, text, len, nl, max);
+	/* The last line is only counted once its '\n' is found */
+	len = (n == max && n > 0) ? nl[n - 1] : len;
+	if (len > 0) {
+		scan->pos += len;
+		scan->last = text[len - 1];
+	}
+	return n;
+}
+
+/*
+ * Account for the last line of the text, if it does not end with '\n'.
+ */
+void scan_finish(Scan *scan)
+{
+	if (scan->pos - scan->start > scan->longest)
+		scan->longest = scan->pos - scan->start;
+}
+
+/*
+ * Record the '\n' at text[i] as the n-th line break found by this call.
+ */
+static inline void found(Scan *scan, const char *text, size_t i, size_t *nl,
+		size_t n)
+{
+	size_t end = scan->pos + i;
+
+	if (end - scan->start > scan->longest)
+		scan->longest = end - scan->start;
+	if ((i > 0) ? text[i - 1] == '\r' : scan->last == '\r')
+		scan->crlf++;
+	scan->lines++;
+	scan->start = end + 1;
+	nl[n] = i + 1;
+}
+
+/*
+ * Scan text from i on, having found n lines so far.
+ */
+static size_t scan_from(Scan *scan, const char *text, size_t i, size_t len,
+		size_t *nl, size_t n, size_t max)
+{
+	for (; i < len && n < max; i++) {
+		if (text[i] == '\n')
+			found(scan, text, i, nl, n++);
+		else if (text[i] == '\0')
+			scan->nuls++;
+	}
+	return n;
+}
+
+static size_t scan_scalar(Scan *scan, const char *text, size_t len,
+		size_t *nl, size_t max)
+{
+	return scan_from(scan, text, 0, len, nl, 0, max);
+}
+
+#ifdef SCAN_X86
+/*
+ * The SIMD scanners find the '\n' and NUL bytes of a block as bit masks.
+ * Only the NUL bytes up to bit b are counted if the scan stops at the
+ * '\n' at bit b.
+ */
+#define SCAN_BLOCK(nlmask, nulmask) \
+	do { \
+		unsigned int m = (nlmask); \
+		unsigned int z = (nulmask); \
+		unsigned int b; \
+		while (m != 0) { \
+			b = __builtin_ctz(m); \
+			m &= m - 1; \
+			found(scan, text, i + b, nl, n++); \
+			if (n == max) { \
+				z &= (unsigned int)(((unsigned long long)2 << b) - 1); \
+				scan->nuls += __builtin_popcount(z); \
+				return n; \
+			} \
+		} \
+		scan->nuls += __builtin_popcount(z); \
+	} while (0)
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(Scan *scan, const char *text, size_t len,
+		size_t *nl, size_t max)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v;
+	size_t n = 0;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(text + i));
+		SCAN_BLOCK(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)),
+				_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+	}
+	return scan_from(scan, text, i, len, nl, n, max);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(Scan *scan, const char *text, size_t len,
+		size_t *nl, size_t max)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i v;
+	size_t n = 0;
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(text + i));
+		SCAN_BLOCK(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)),
+				_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)));
+	}
+	return scan_from(scan, text, i, len, nl, n, max);
+}
+#endif
@@ -0,0 +1,440 @@
+/*
+ * This module contains the search of a buffer for a pattern. A search
+ * looks for the pattern from the cursor on, forward or backward, wrapping
+ * around the end of the buffer, and finds the first match.
+ *
+ * Lines whose text follows each other in memory, which is what the lines
+ * of a file that have not been edited are, are searched as one run. A
+ * pattern never contains '\n', so no match can span two lines of a run.
+ * The parts of the original text of a lazy buffer outside its window are
+ * searched in place, without making lines out of them.
+ *
+ * Blocks of 16 (SSE2) or 32 (AVX2) positions are tested at once for the
+ * first and the last character of the pattern where the CPU supports it,
+ * and only the positions where both are found are compared in full;
+ * anything else goes through Boyer-Moore-Horspool.
+ */
+
+#include "proto.h"
+#include <string.h>
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define SEARCH_X86
+#include <immintrin.h>
+#endif
+
+/* Upper bound on the length of a run of lines searched at once */
+#define SEARCH_RUN 	(1024 * 1024)
+
+typedef const char *(*Matcher)(const Pattern *pat, const char *text,
+		size_t len);
+
+static const char *find_bmh(const Pattern *pat, const char *text,
+		size_t len);
+#ifdef SEARCH_X86
+static const char *find_sse2(const Pattern *pat, const char *text,
+		size_t len);
+static const char *find_avx2(const Pattern *pat, const char *text,
+		size_t len);
+#endif
+static const char *find(const char *text, size_t len);
+static const char *find_last(const char *text, size_t len);
+static Line *find_forward(Line *line, const Line *stop, size_t *x);
+static Line *find_backward(Line *line, const Line *stop, size_t *x);
+static bool find_orig(Buffer *buf, size_t beg, size_t end, Direction dir,
+		size_t *n, size_t *x);
+static size_t count_lines(const char *text, size_t len);
+
+static const struct {
+	const char *name;
+	Matcher matcher;
+} matchers[] = {
+	{ "bmh", find_bmh },
+#ifdef SEARCH_X86
+	{ "sse2", find_sse2 },
+	{ "avx2", find_avx2 },
+#endif
+};
+
+/* Index into matchers of the one in use, -1 until the first search */
+static int matcher = -1;
+
+/* The pattern of the search commands */
+static Pattern pat;
+
+/*
+ * Use the matcher called name from now on. Return 0 on success or -1 if
+ * there is no such matcher or the CPU does not support it.
+ */
+int search_select(const char *name)
+{
+	int i;
+
+	for (i = 0; i < (int)(sizeof(matchers) / sizeof(matchers[0])); i++) {
+		if (strcmp(matchers[i].name, name) != 0)
+			continue;
+#ifdef SEARCH_X86
+		__builtin_cpu_init();
+		if ((matchers[i].matcher == find_sse2 &&
+					!__builtin_cpu_supports("sse2")) ||
+				(matchers[i].matcher == find_avx2 &&
+				 !__builtin_cpu_supports("avx2"))) {
+			return -1;
+		}
+#endif
+		matcher = i;
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Return the name of the matcher in use.
+ */
+const char *search_name()
+{
+	if (matcher < 0 && search_select("avx2") != 0 &&
+			search_select("sse2") != 0) {
+		search_select("bmh");
+	}
+	return matchers[matcher].name;
+}
+
+/*
+ * Make text a pattern to be searched for with pattern_find().
+ */
+void pattern_init(Pattern *pat, const char *text)
+{
+	size_t i;
+
+	pat->len = strlen(text);
+	pat->text = charalloc(pat->len + 1);
+	strcpy(pat->text, text);
+
+	for (i = 0; i < 256; i++)
+		pat->skip[i] = pat->len;
+	for (i = 0; i + 1 < pat->len; i++)
+		pat->skip[(unsigned char)pat->text[i]] = pat->len - 1 - i;
+}
+
+void pattern_free(Pattern *pat)
+{
+	free(pat->text);
+	memset(pat, 0, sizeof(Pattern));
+}
+
+/*
+ * Return the first match of pat in len characters of text, or NULL. Once
+ * a matcher is chosen, this may be called from any thread.
+ */
+const char *pattern_find(const Pattern *pat, const char *text, size_t len)
+{
+	if (len < pat->len)
+		return NULL;
+	if (pat->len == 1)
+		return memchr(text, pat->text[0], len);
+	if (matcher < 0)
+		search_name();
+	return matchers[matcher].matcher(pat, text, len);
+}
+
+/*
+ * Search for text from now on.
+ */
+void search_set(const char *text)
+{
+	pattern_free(&pat);
+	pattern_init(&pat, text);
+}
+
+/*
+ * Return what is searched for, or NULL if nothing has been yet.
+ */
+const char *search_text()
+{
+	return (pat.len > 0) ? pat.text : NULL;
+}
+
+static const char *find(const char *text, size_t len)
+{
+	return pattern_find(&pat, text, len);
+}
+
+/*
+ * Return the last match in len characters of text, or NULL.
+ */
+static const char *find_last(const char *text, size_t len)
+{
+	const char *end = text + len;
+	const char *last = NULL;
+	const char *hit;
+
+	while ((hit = find(text, end - text)) != NULL) {
+		last = hit;
+		text = hit + 1;
+	}
+	return last;
+}
+
+static const char *find_bmh(const Pattern *pat, const char *text,
+		size_t len)
+{
+	const size_t m = pat->len;
+	const char tail = pat->text[m - 1];
+	size_t i = 0;
+	char c;
+
+	while (i + m <= len) {
+		c = text[i + m - 1];
+		if (c == tail && memcmp(text + i, pat->text, m - 1) == 0)
+			return text + i;
+		i += pat->skip[(unsigned char)c];
+	}
+	return NULL;
+}
+
+#ifdef SEARCH_X86
+/*
+ * The SIMD matchers compare the blocks at i and at i + m - 1 with the
+ * first and the last character of the pattern; every bit set in mask is
+ * a position where both match. What is left after the last block goes
+ * through find_bmh().
+ */
+#define SEARCH_BLOCK(mask) \
+	do { \
+		unsigned int m_ = (mask); \
+		unsigned int b; \
+		while (m_ != 0) { \
+			b = __builtin_ctz(m_); \
+			m_ &= m_ - 1; \
+			if (memcmp(text + i + b + 1, pat->text + 1, m - 2) == 0) \
+				return text + i + b; \
+		} \
+	} while (0)
+
+__attribute__((target("sse2")))
+static const char *find_sse2(const Pattern *pat, const char *text,
+		size_t len)
+{
+	const size_t m = pat->len;
+	const __m128i first = _mm_set1_epi8(pat->text[0]);
+	const __m128i last = _mm_set1_epi8(pat->text[m - 1]);
+	__m128i a;
+	__m128i b;
+	size_t i;
+
+	for (i = 0; i + m - 1 + 16 <= len; i += 16) {
+		a = _mm_loadu_si128((const __m128i *)(text + i));
+		b = _mm_loadu_si128((const __m128i *)(text + i + m - 1));
+		SEARCH_BLOCK(_mm_movemask_epi8(_mm_and_si128(
+					_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+	}
+	return find_bmh(pat, text + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const Pattern *pat, const char *text,
+		size_t len)
+{
+	const size_t m = pat->len;
+	const __m256i first = _mm256_set1_epi8(pat->text[0]);
+	const __m256i last = _mm256_set1_epi8(pat->text[m - 1]);
+	__m256i a;
+	__m256i b;
+	size_t i;
+
+	for (i = 0; i + m - 1 + 32 <= len; i += 32) {
+		a = _mm256_loadu_si256((const __m256i *)(text + i));
+		b = _mm256_loadu_si256((const __m256i *)(text + i + m - 1));
+		SEARCH_BLOCK(_mm256_movemask_epi8(_mm256_and_si256(
+					_mm256_cmpeq_epi8(a, first),
+					_mm256_cmpeq_epi8(b, last))));
+	}
+	return find_bmh(pat, text + i, len - i);
+}
+#endif
+
+/*
+ * Find the first match in the lines from line on, up to but not including
+ * stop. Return the line of the match and store where in it the match is
+ * in *x, or return NULL.
+ */
+static Line *find_forward(Line *line, const Line *stop, size_t *x)
+{
+	Line *first;
+	const char *beg;
+	const char *hit;
+	size_t len;
+
+	while (line != stop) {
+		first = line;
+		beg = line->text;
+		len = line->len;
+		for (line = line->next; line != stop && len < SEARCH_RUN &&
+				line->text == beg + len; line = line->next) {
+			len += line->len;
+		}
+		if ((hit = find(beg, len)) != NULL) {
+			for (line = first; hit >= line->text + line->len; line = line->next)
+				;
+			*x = hit - line->text;
+			return line;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find the last match in the lines from line back, down to but not
+ * including stop. Return the line of the match and store where in it the
+ * match is in *x, or return NULL.
+ */
+static Line *find_backward(Line *line, const Line *stop, size_t *x)
+{
+	Line *last;
+	const char *beg;
+	const char *hit;
+	size_t len;
+
+	while (line != stop) {
+		last = line;
+		beg = line->text;
+		len = line->len;
+		for (line = line->prev; line != stop && len < SEARCH_RUN &&
+				line->text + line->len == beg; line = line->prev) {
+			beg = line->text;
+			len += line->len;
+		}
+		if ((hit = find_last(beg, len)) != NULL) {
+			for (line = last; hit < line->text; line = line->prev)
+				;
+			*x = hit - line->text;
+			return line;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Return the number of '\n' in len characters of text.
+ */
+static size_t count_lines(const char *text, size_t len)
+{
+	size_t nl[SCAN_BATCH];
+	size_t off = 0;
+	size_t n;
+	Scan scan;
+
+	scan_init(&scan);
+	do {
+		n = scan_lines(&scan, text + off, len - off, nl, SCAN_BATCH);
+		if (n > 0)
+			off += nl[n - 1];
+	} while (n == SCAN_BATCH);
+	return scan.lines;
+}
+
+/*
+ * Find the first (DOWN) or the last (UP) match in [beg, end) of the
+ * original text of the lazy buffer buf, which is either before or after
+ * its window. Store the number of the line of the match in *n and where
+ * in it the match is in *x.
+ */
+static bool find_orig(Buffer *buf, size_t beg, size_t end, Direction dir,
+		size_t *n, size_t *x)
+{
+	const char *text = buf->orig;
+	const char *hit;
+	size_t start;
+
+	if (end <= beg)
+		return FALSE;
+	if (dir == DOWN)
+		hit = find(text + beg, end - beg);
+	else
+		hit = find_last(text + beg, end - beg);
+	if (hit == NULL)
+		return FALSE;
+
+	for (start = hit - text; start > 0 && text[start - 1] != '\n'; start--)
+		;
+	*x = (size_t)(hit - text) - start;
+	/* The first line of the window is line base + 1 */
+	if (beg >= buf->lazy->tail) {
+		*n = buf->index.base + buf->index.nlines + 1 +
+			count_lines(text + buf->lazy->tail, start - buf->lazy->tail);
+	}
+	else {
+		*n = buf->index.base + 1 -
+			count_lines(text + start, buf->lazy->head - start);
+	}
+	return TRUE;
+}
+
+/*
+ * Search buf for the pattern from the x-th character of its current line
+ * on in the direction dir, wrapping around. Matches at x itself are found
+ * only if at is TRUE. Return TRUE if there is a match and store the number
+ * of its line in *n and where in it the match is in *x.
+ */
+bool search_buffer(Buffer *buf, Direction dir, bool at, size_t *n, size_t *x)
+{
+	Line *cur = buf->curln;
+	Lazy *lazy = buf->lazy;
+	Line *line = NULL;
+	const char *hit;
+	size_t from = *x;
+
+	if (pat.len == 0)
+		return FALSE;
+	collapse_gap(buf);
+
+	/* The rest of the current line first */
+	if (dir == DOWN) {
+		from += at ? 0 : 1;
+		if (from < cur->len && (hit = find(cur->text + from,
+						cur->len - from)) != NULL) {
+			line = cur;
+			*x = hit - cur->text;
+		}
+	}
+	else {
+		from += at ? pat.len : pat.len - 1;
+		if (from > cur->len)
+			from = cur->len;
+		if ((hit = find_last(cur->text, from)) != NULL) {
+			line = cur;
+			*x = hit - cur->text;
+		}
+	}
+	if (line != NULL) {
+		*n = line_number(buf, line);
+		return TRUE;
+	}
+
+	/* Then the other lines, and what is outside the window of a lazy buffer */
+	if (dir == DOWN) {
+		line = find_forward(cur->next, NULL, x);
+		if (line == NULL && lazy != NULL &&
+				(find_orig(buf, lazy->tail, buf->origsize, DOWN, n, x) ||
+				 find_orig(buf, 0, lazy->head, DOWN, n, x))) {
+			return TRUE;
+		}
+		if (line == NULL)
+			line = find_forward(buf->firstln, cur->next, x);
+	}
+	else {
+		line = find_backward(cur->prev, NULL, x);
+		if (line == NULL && lazy != NULL &&
+				(find_orig(buf, 0, lazy->head, UP, n, x) ||
+				 find_orig(buf, lazy->tail, buf->origsize, UP, n, x))) {
+			return TRUE;
+		}
+		if (line == NULL)
+			line = find_backward(buf->lastln, cur->prev, x);
+	}
+	if (line == NULL)
+		return FALSE;
+	*n = line_number(buf, line);
+	return TRUE;
+}
@@ -0,0 +1,129 @@
+/*
+ * This module keeps count of how long the editor takes to do things and
+ * of what it allocates, cheaply enough to be always on. Every kind of
+ * thing timed has a histogram of its times: bucket k > 0 counts the times
+ * of at least 2^(k-1) and less than 2^k microseconds, the last bucket
+ * also the longer ones. Worker threads allocate too, so the counts of
+ * allocations are added to atomically.
+ */
+
+#include "proto.h"
+#include <time.h>
+
+#ifdef __GNUC__
+#define COUNT(var, n) 	__atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED)
+#define READ(var) 		__atomic_load_n(&(var), __ATOMIC_RELAXED)
+#else
+#define COUNT(var, n) 	((var) += (n))
+#define READ(var) 		(var)
+#endif
+
+static const char *names[STAT_KINDS] = { "input", "update", "load", "save" };
+
+static Histogram histograms[STAT_KINDS];
+static size_t allocs = 0;
+static size_t alloc_bytes = 0;
+
+/*
+ * Return a monotonic timestamp in microseconds.
+ */
+long stats_clock()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Count what has been timed since start, which stats_clock() returned.
+ */
+void stats_add(Stat stat, long start)
+{
+	Histogram *h = &histograms[stat];
+	unsigned long t = stats_clock() - start;
+	int k = 0;
+
+	while (k < STATS_BUCKETS - 1 && t >= 1UL << k)
+		k++;
+	h->buckets[k]++;
+	h->count++;
+	h->total += t;
+	if (t > h->max)
+		h->max = t;
+}
+
+/*
+ * Count an allocation of size bytes.
+ */
+void stats_alloc(size_t size)
+{
+	COUNT(allocs, 1);
+	COUNT(alloc_bytes, size);
+}
+
+const char *stats_name(Stat stat)
+{
+	return names[stat];
+}
+
+const Histogram *stats_histogram(Stat stat)
+{
+	return &histograms[stat];
+}
+
+/*
+ * Return the number of allocations so far and store how many bytes they
+ * asked for in *bytes.
+ */
+size_t stats_allocs(size_t *bytes)
+{
+	*bytes = READ(alloc_bytes);
+	return READ(allocs);
+}
+
+/*
+ * Return how long the p-th percentile of the times counted by h took at
+ * most, in microseconds, which is as close as the buckets tell.
+ */
+unsigned long stats_percentile(const Histogram *h, int p)
+{
+	size_t rank = (h->count * p + 99) / 100;
+	size_t seen = 0;
+	int k;
+
+	if (h->count == 0)
+		return 0;
+	for (k = 0; k < STATS_BUCKETS - 1; k++) {
+		seen += h->buckets[k];
+		if (seen >= rank)
+			break;
+	}
+	return (k < STATS_BUCKETS - 1 && (1UL << k) < h->max) ? 1UL << k : h->max;
+}
+
+/*
+ * Write everything counted so far to fs as a JSON object.
+ */
+void stats_dump(FILE *fs)
+{
+	const Histogram *h;
+	size_t bytes;
+	size_t n;
+	int s;
+	int k;
+
+	n = stats_allocs(&bytes);
+	fprintf(fs, "{\n  \"allocs\": %zu,\n  \"alloc_bytes\": %zu", n, bytes);
+	for (s = 0; s < STAT_KINDS; s++) {
+		h = &histograms[s];
+		fprintf(fs, ",\n  \"%s\": {\"count\": %zu, \"total_us\": %lu, "
+				"\"max_us\": %lu, \"p50_us\": %lu, \"p99_us\": %lu, "
+				"\"buckets\": [", names[s], h->count, h->total, h->max,
+				stats_percentile(h, 50), stats_percentile(h, 99));
+		for (k = 0; k < STATS_BUCKETS; k++)
+			fprintf(fs, "%s%zu", (k > 0) ? ", " : "", h->buckets[k]);
+		fprintf(fs, "]}");
+	}
+	fprintf(fs, "\n}\n");
+}
@@ -3,40 +3,119 @@
 #include <string.h>
 
 
+static void move_gap(Buffer *buf, size_t x, size_t size);
+static void reach(Buffer *buf, size_t n, size_t m);
+static Line *make_line(Buffer *buf, const char *a, size_t alen,
+		const char *b, size_t blen);
+
+/*
+ * Move the gap of the current line to x, making sure it is at least size
+ * bytes long. A line without a gap gets one spanning all of its spare
+ * memory; the gap doubles the line when it runs out of room, so typing at
+ * the cursor only moves the characters between the old and the new
+ * position of the gap.
+ */
+static void move_gap(Buffer *buf, size_t x, size_t size)
+{
+	Line *line = buf->curln;
+	size_t tail;
+
+	if (buf->gaplen == 0) {
+		own_line(buf, line, line->len + GAP_SIZE);
+		buf->gap = line->len;
+		buf->gaplen = line->memsize - line->len;
+	}
+	if (buf->gaplen < size) {
+		tail = line->len - buf->gap;
+		size = line->memsize + (size > line->memsize ? size : line->memsize);
+		line->text = text_realloc(&buf->pool, line->text, line->memsize, &size);
+		memmove(line->text + size - tail, 
+				line->text + buf->gap + buf->gaplen, tail);
+		buf->gaplen = size - line->len;
+		line->memsize = size;
+	}
+
+	if (x < buf->gap) {
+		memmove(line->text + x + buf->gaplen, line->text + x, 
+				buf->gap - x);
+	}
+	else if (x > buf->gap) {
+		memmove(line->text + buf->gap, 
+				line->text + buf->gap + buf->gaplen, x - buf->gap);
+	}
+	buf->gap = x;
+}
+
+/*
+ * Close the gap in the current line of buf, if any, so that its text is
+ * contiguous again. This is done whenever the cursor leaves the line.
+ */
+void collapse_gap(Buffer *buf)
+{
+	if (buf->gaplen > 0) {
+		memmove(buf->curln->text + buf->gap, 
+				buf->curln->text + buf->gap + buf->gaplen, 
+				buf->curln->len - buf->gap);
+		buf->gaplen = 0;
+	}
+}
+
 /*
  * Insert the character c into the curln line where the cursor is located.
  *
  * The new string consists of three parts: xcy
- * strlen(x) == curbuf->x_pos
- * strlen(y) == curbuf->curln->len - curbuf->x_pos
+ * strlen(x) == buf->x_pos
+ * strlen(y) == buf->curln->len - buf->x_pos
+ *
+ * c goes into the gap, which is moved to the cursor first.
  */
-void insert_char(const char c)
+void insert_char(Buffer *buf, const char c)
 {
-	/* +1 for the new character and +1 for '\0' */
-	if (curbuf->curln->len < curbuf->curln->memsize) {
-		memmove(curbuf->curln->text + curbuf->x_pos + 1, 
-				curbuf->curln->text + curbuf->x_pos, 
-				curbuf->curln->len - curbuf->x_pos + 1);
-		curbuf->curln->text[curbuf->x_pos] = c;
-		curbuf->curln->len += 1;
-	}
-	else {
-		char *tmp;
+	if (read_only(buf))
+		return;
+	undo_insert(buf, line_number(buf, buf->curln), buf->x_pos,
+			&c, 1);
+	/* +1 for the new character */
+	move_gap(buf, buf->x_pos, 1);
+	buf->curln->text[buf->gap++] = c;
+	buf->gaplen--;
+	buf->curln->len += 1;
+	column_insert(buf, buf->x_pos, c);
+
+	buf->x_pos++;
+	buf->visual_x = real2visual(buf, buf->x_pos);
+	render->line(buf, buf->curln);
+	buffer_modified(buf, TRUE);
+}
+
+/*
+ * Insert len characters of text at the cursor in one go, as when text is
+ * pasted, and leave the cursor after them. The buffer is drawn once, at
+ * the end.
+ */
+void insert_str(Buffer *buf, const char *text, size_t len)
+{
+	const char *last = text + len;
+	size_t n;
+	size_t x = buf->x_pos;
 
-		tmp = charalloc(curbuf->curln->memsize * 2);
-		strncpy(tmp, curbuf->curln->text, curbuf->x_pos);
-		tmp[curbuf->x_pos] = c;
-		strcpy(tmp + curbuf->x_pos + 1, curbuf->curln->text + curbuf->x_pos);
-		curbuf->curln->len += 1;
-		curbuf->curln->memsize *= 2;
+	if (len == 0 || read_only(buf))
+		return;
+	collapse_gap(buf);
+	n = line_number(buf, buf->curln);
+	undo_insert(buf, n, x, text, len);
+	insert_text(buf, n, x, text, len);
 
-		free(curbuf->curln->text);
-		curbuf->curln->text = tmp;
+	/* Where the text ends */
+	while (last > text && last[-1] != '\n')
+		last--;
+	x = (last == text) ? x + len : (size_t)(text + len - last);
+	while (last > text) {
+		if (*--last == '\n')
+			n++;
 	}
-	curbuf->x_pos++;
-	curbuf->visual_x = real2visual(curbuf->x_pos);
-	print_line(curbuf->curln);
-	buffer_modified(TRUE);
+	go_to(buf, n, (int)x);
+	buffer_modified(buf, TRUE);
 }
 
 /*
@@ -45,42 +124,56 @@ void insert_char(const char c)
  * The curln string looks like this: x|y
  * After this procedure, it looks like: x
  *                                     |y
- * strlen(x) = curbuf->x_pos
- * strlen(y) = curbuf->curln->len - curbuf->x_pos
+ * strlen(x) = buf->x_pos
+ * strlen(y) = buf->curln->len - buf->x_pos
  */
-void do_enter()
+void do_enter(Buffer *buf)
 {
-	/* char *tmp; */
-	/* size_t len; */
 	Line *line;
 
-	line = new_line();
-	/* +1 for '\0' */
-	assert(curbuf->curln->memsize > 0);
-	line->text = charalloc(curbuf->curln->memsize);
-	line->memsize = curbuf->curln->memsize;
-	/* Copy the second half (y) to line->text */
-	strcpy(line->text, curbuf->curln->text + curbuf->x_pos);
-	line->len = curbuf->curln->len - curbuf->x_pos;
-	
-	/* Cut the current line to its new length */
-	/* curbuf->curln->text = charrealloc(curbuf->curln->text, curbuf->x_pos + 2); */
-	curbuf->curln->text[curbuf->x_pos] = '\n';
-	curbuf->curln->text[curbuf->x_pos + 1] = '\0';
-	/* +1 for '\n' */
-	curbuf->curln->len = (size_t)curbuf->x_pos + 1;
-
-	insert_line(curbuf->curln, line);
-
-	print_buffer(curbuf->curln);
-	go_down();
+	if (read_only(buf))
+		return;
+	undo_insert(buf, line_number(buf, buf->curln), buf->x_pos,
+			"\n", 1);
+	collapse_gap(buf);
+	line = new_line(buf);
+	/* The second half (y) */
+	line->len = buf->curln->len - buf->x_pos;
+	if (buf->curln->memsize == 0) {
+		/* It is a part of the original text as well, no need to copy */
+		line->text = buf->curln->text + buf->x_pos;
+	}
+	else {
+		line->memsize = line->len;
+		line->text = text_alloc(&buf->pool, &line->memsize);
+		memcpy(line->text, buf->curln->text + buf->x_pos, line->len);
+	}
+
+	/*
+	 * Cut the current line to its new length. If the cursor is already
+	 * on '\n', the first half (x) is left as it is.
+	 */
+	if ((size_t)buf->x_pos == buf->curln->len || 
+			buf->curln->text[buf->x_pos] != '\n') {
+		/* +1 for '\n' */
+		own_line(buf, buf->curln, buf->x_pos + 1);
+		buf->curln->text[buf->x_pos] = '\n';
+	}
+	buf->curln->len = (size_t)buf->x_pos + 1;
+	column_forget(buf, buf->curln);
+
+	insert_line(buf, buf->curln, line);
+
+	/* The rows below only move down by one */
+	render->shift(buf, buf->y_pos + 1, DOWN);
+	render->from(buf, buf->curln);
+	go_down(buf);
 	/* Place the cursor at the beginnig of the new line */
-	curbuf->x_pos = 0;
-	curbuf->visual_x = real2visual(curbuf->x_pos);
-	position_cursor(mainwin, curbuf->y_pos, curbuf->visual_x);
+	buf->x_pos = 0;
+	buf->visual_x = real2visual(buf, buf->x_pos);
+	render->cursor(buf);
 
-	buffer_modified(TRUE);
-	delete_line(line);
+	buffer_modified(buf, TRUE);
 }
 
 /*
@@ -90,44 +183,171 @@ void do_enter()
  *                                      |y
  *
  * After this procedure, it looks like: x|y
- * strlen(x) == curbuf->x_pos
- * strlen(y) == curbuf->curln->len - curbuf->x_pos
+ * strlen(x) == buf->x_pos
+ * strlen(y) == buf->curln->len - buf->x_pos
  */
-void do_backspace()
+void do_backspace(Buffer *buf)
 {
-	if (curbuf->x_pos != 0) {
-		memmove(curbuf->curln->text + curbuf->x_pos - 1, 
-				curbuf->curln->text + curbuf->x_pos,
-				curbuf->curln->len - curbuf->x_pos + 1);
-		curbuf->x_pos--;
-		curbuf->visual_x = real2visual(curbuf->x_pos);
-		clear_line(mainwin, curbuf->y_pos);
-		print_line(curbuf->curln);
-		buffer_modified(TRUE);
+	if (read_only(buf))
+		return;
+	if (buf->x_pos != 0) {
+		/* Widen the gap by one to the left */
+		move_gap(buf, buf->x_pos, 0);
+		buf->gap--;
+		buf->gaplen++;
+		buf->curln->len -= 1;
+		buf->x_pos--;
+		undo_delete(buf, line_number(buf, buf->curln),
+				buf->x_pos, &buf->curln->text[buf->gap], 1);
+		column_delete(buf, buf->x_pos, buf->curln->text[buf->gap]);
+		buf->visual_x = real2visual(buf, buf->x_pos);
+		render->line(buf, buf->curln);
+		buffer_modified(buf, TRUE);
 	}
-	else if (curbuf->x_pos == 0 && curbuf->curln->prev != NULL) {
-		go_up();
-		curbuf->x_pos = curbuf->curln->len - 1;
-		curbuf->visual_x = real2visual(curbuf->x_pos);
-		position_cursor(mainwin, curbuf->y_pos, curbuf->visual_x);
-
-		if (curbuf->curln->len + curbuf->curln->next->len < curbuf->curln->memsize) {
-			memmove(curbuf->curln->text + curbuf->curln->len - 1,
-					curbuf->curln->next->text, 
-					curbuf->curln->next->len + 1);
-		}
-		else {
-			curbuf->curln->text = charrealloc(curbuf->curln->text, 
-					curbuf->curln->memsize + curbuf->curln->next->memsize);
-			curbuf->curln->memsize = curbuf->curln->memsize + curbuf->curln->next->memsize;
-
-			strcpy(curbuf->curln->text + curbuf->curln->len - 1, 
-					curbuf->curln->next->text);
-		}
-		curbuf->curln->len += curbuf->curln->next->len - 1;
-		erase_line(curbuf->curln->next);
-		print_buffer(curbuf->curln);
-		buffer_modified(TRUE);
+	else if (buf->x_pos == 0 && buf->curln->prev != NULL) {
+		undo_delete(buf, line_number(buf, buf->curln) - 1,
+				buf->curln->prev->len - 1, "\n", 1);
+		go_up(buf);
+		/* -1 for '\n' */
+		buf->x_pos = buf->curln->len - 1;
+		buf->visual_x = real2visual(buf, buf->x_pos);
+		render->cursor(buf);
+
+		/* Overwrite '\n' with the next line */
+		own_line(buf, buf->curln, 
+				buf->curln->len - 1 + buf->curln->next->len);
+		memcpy(buf->curln->text + buf->curln->len - 1,
+				buf->curln->next->text, 
+				buf->curln->next->len);
+		buf->curln->len += buf->curln->next->len - 1;
+		column_forget(buf, buf->curln);
+		erase_line(buf, buf->curln->next);
+		/* The rows below only move up by one */
+		render->shift(buf, buf->y_pos + 1, UP);
+		render->from(buf, buf->curln);
+		buffer_modified(buf, TRUE);
 	}
 }
 
+/*
+ * Make lines n through m of a lazy buffer.
+ */
+static void reach(Buffer *buf, size_t n, size_t m)
+{
+	if (buf->lazy == NULL)
+		return;
+	lazy_reach(buf, n);
+	while (m > buf->index.base + buf->index.nlines && lazy_more(buf, DOWN))
+		;
+}
+
+/*
+ * Make a line of alen characters at a followed by blen characters at b.
+ */
+static Line *make_line(Buffer *buf, const char *a, size_t alen,
+		const char *b, size_t blen)
+{
+	Line *line;
+
+	line = new_line(buf);
+	line->len = alen + blen;
+	line->memsize = (line->len > 0) ? line->len : 1;
+	line->text = text_alloc(&buf->pool, &line->memsize);
+	memcpy(line->text, a, alen);
+	memcpy(line->text + alen, b, blen);
+	return line;
+}
+
+/*
+ * Insert len characters of text into line n of buf at index x.
+ */
+void insert_text(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len)
+{
+	const char *nl = memchr(text, '\n', len);
+	const char *last;
+	const char *p;
+	const char *q;
+	Line *line;
+	Line *prev;
+	Line *end;
+
+	reach(buf, n, n);
+	line = line_at(buf, n);
+	if (nl == NULL) {
+		own_line(buf, line, line->len + len);
+		memmove(line->text + x + len, line->text + x, line->len - x);
+		memcpy(line->text + x, text, len);
+		line->len += len;
+		column_forget(buf, line);
+		return;
+	}
+
+	/* The rest of the line goes after what follows the last '\n' */
+	for (last = text + len; last[-1] != '\n'; last--)
+		;
+	end = make_line(buf, last, text + len - last, line->text + x,
+			line->len - x);
+	own_line(buf, line, x + (nl + 1 - text));
+	memcpy(line->text + x, text, nl + 1 - text);
+	line->len = x + (nl + 1 - text);
+	column_forget(buf, line);
+
+	prev = line;
+	for (p = nl + 1; p < last; p = q + 1) {
+		q = memchr(p, '\n', last - p);
+		insert_line(buf, prev, make_line(buf, p, q + 1 - p, "", 0));
+		prev = prev->next;
+	}
+	insert_line(buf, prev, end);
+}
+
+/*
+ * Delete the len characters of text from line n of buf on, starting at
+ * index x.
+ */
+void delete_text(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len)
+{
+	const char *last = text + len;
+	size_t lines = 0;
+	size_t k;
+	size_t i;
+	Line *line;
+	Line *end;
+	Line *it;
+
+	for (i = 0; i < len; i++) {
+		if (text[i] == '\n')
+			lines++;
+	}
+	reach(buf, n, n + lines);
+	line = line_at(buf, n);
+	if (lines == 0) {
+		own_line(buf, line, line->len);
+		memmove(line->text + x, line->text + x + len, line->len - x - len);
+		line->len -= len;
+		column_forget(buf, line);
+		return;
+	}
+
+	/* The line the text ends in, which is joined to line at k */
+	for (end = line, i = 0; i < lines; i++)
+		end = end->next;
+	while (last[-1] != '\n')
+		last--;
+	k = text + len - last;
+
+	own_line(buf, line, x + end->len - k);
+	memcpy(line->text + x, end->text + k, end->len - k);
+	line->len = x + end->len - k;
+	column_forget(buf, line);
+
+	buf->curln = line;
+	do {
+		it = line->next;
+		if (it == buf->topln)
+			buf->topln = line;
+		erase_line(buf, it);
+	} while (it != end);
+}
@@ -0,0 +1,415 @@
+/*
+ * This module keeps the log of the edits of a buffer that undo and redo
+ * walk. An edit is a record of where it happened, as a line number and
+ * an index into the line, and of the characters it inserted or deleted,
+ * '\n' included. Records are appended back to back to an arena: a
+ * header, the characters, and their number again so that the arena can
+ * be walked backward as well. The records before cur are done, the ones
+ * from cur on have been undone and may be redone until the next edit.
+ *
+ * Characters typed one after another go into the record of the first of
+ * them as long as no more than UNDO_PAUSE milliseconds pass in between,
+ * and so do backspaces; a paste thus takes one record whatever its size.
+ * Edits made by one command, like a replace, are undone together. Once
+ * the arena grows past UNDO_BUDGET bytes, the oldest edits are dropped.
+ * Every edit logged, undone or redone also goes into the journal, see
+ * journal.c.
+ */
+
+#include "proto.h"
+#include <string.h>
+#include <time.h>
+
+/* Number of bytes the log of a buffer may take */
+#define UNDO_BUDGET 	(4 * 1024 * 1024)
+/* Milliseconds between keys that start a new record */
+#define UNDO_PAUSE 	1000
+
+enum { UNDO_INSERT, UNDO_DELETE };
+
+typedef struct Record {
+	size_t line;
+	size_t x;
+	size_t len;
+	unsigned char op;
+	/* Undone and redone along with the record before it */
+	unsigned char join;
+} Record;
+
+/* Bytes a record of len characters takes in the arena */
+#define RECORD_SIZE(len) 	(sizeof(Record) + (len) + sizeof(size_t))
+
+struct Undo {
+	char *arena;
+	size_t size;
+	size_t cap;
+	size_t cur;
+	/* Where cur was when the buffer was saved, (size_t)-1 if dropped */
+	size_t saved;
+	/* The last record, if it may still be added to */
+	size_t last;
+	bool open;
+	/* Where the next insert goes on with the last record */
+	size_t next_line;
+	size_t next_x;
+	long when;
+	/* Between undo_begin() and undo_end() */
+	bool grouping;
+	bool first;
+};
+
+static long now_ms();
+static Undo *get_undo(Buffer *buf);
+static void advance(size_t *n, size_t *x, const char *text, size_t len);
+static void reserve(Undo *u, size_t size);
+static void read_record(const Undo *u, size_t off, Record *rec);
+static size_t prev_record(const Undo *u, size_t end, Record *rec);
+static void append_record(Undo *u, int op, size_t n, size_t x,
+		const char *text, size_t len);
+static void add_to_last(Undo *u, int op, size_t n, size_t x,
+		const char *text, size_t len);
+static void trim(Undo *u);
+static void record(Buffer *buf, int op, size_t n, size_t x,
+		const char *text, size_t len);
+
+static long now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static Undo *get_undo(Buffer *buf)
+{
+	if (buf->undo == NULL) {
+		buf->undo = calloc(1, sizeof(Undo));
+		if (buf->undo == NULL) {
+			fprintf(stderr, "%s: calloc failed\n", __func__);
+			finish();
+		}
+	}
+	return buf->undo;
+}
+
+/*
+ * Move line n, index x on over len characters of text.
+ */
+static void advance(size_t *n, size_t *x, const char *text, size_t len)
+{
+	const char *end = text + len;
+	const char *nl;
+
+	while ((nl = memchr(text, '\n', end - text)) != NULL) {
+		(*n)++;
+		*x = 0;
+		text = nl + 1;
+	}
+	*x += end - text;
+}
+
+/*
+ * Make room for size more bytes in the arena, which is not let grow much
+ * past the budget.
+ */
+static void reserve(Undo *u, size_t size)
+{
+	size_t most = UNDO_BUDGET + UNDO_BUDGET / 4;
+
+	if (u->size + size > u->cap) {
+		u->cap = 2 * (u->size + size);
+		if (u->cap > most)
+			u->cap = (u->size + size > most) ? u->size + size : most;
+		u->arena = charrealloc(u->arena, u->cap);
+	}
+}
+
+static void read_record(const Undo *u, size_t off, Record *rec)
+{
+	memcpy(rec, u->arena + off, sizeof(Record));
+}
+
+/*
+ * Read the record that ends at end and return where it starts.
+ */
+static size_t prev_record(const Undo *u, size_t end, Record *rec)
+{
+	size_t len;
+
+	memcpy(&len, u->arena + end - sizeof(size_t), sizeof(size_t));
+	end -= RECORD_SIZE(len);
+	read_record(u, end, rec);
+	return end;
+}
+
+static void append_record(Undo *u, int op, size_t n, size_t x,
+		const char *text, size_t len)
+{
+	Record rec;
+
+	rec.line = n;
+	rec.x = x;
+	rec.len = len;
+	rec.op = op;
+	rec.join = u->grouping && !u->first;
+	u->first = FALSE;
+
+	reserve(u, RECORD_SIZE(len));
+	u->last = u->size;
+	memcpy(u->arena + u->size, &rec, sizeof(Record));
+	memcpy(u->arena + u->size + sizeof(Record), text, len);
+	memcpy(u->arena + u->size + sizeof(Record) + len, &len, sizeof(size_t));
+	u->size += RECORD_SIZE(len);
+	u->cur = u->size;
+}
+
+/*
+ * Add text to the last record: after its characters if it inserted them,
+ * before them if it deleted them, since backspace goes backward.
+ */
+static void add_to_last(Undo *u, int op, size_t n, size_t x,
+		const char *text, size_t len)
+{
+	Record rec;
+	char *chars;
+
+	read_record(u, u->last, &rec);
+	reserve(u, len);
+	chars = u->arena + u->last + sizeof(Record);
+	if (op == UNDO_INSERT) {
+		memcpy(chars + rec.len, text, len);
+	}
+	else {
+		memmove(chars + len, chars, rec.len);
+		memcpy(chars, text, len);
+		rec.line = n;
+		rec.x = x;
+	}
+	rec.len += len;
+	memcpy(u->arena + u->last, &rec, sizeof(Record));
+	memcpy(chars + rec.len, &rec.len, sizeof(size_t));
+	u->size += len;
+	u->cur = u->size;
+}
+
+/*
+ * Drop the oldest edits until the log is well within its budget. What
+ * is done together is dropped together.
+ */
+static void trim(Undo *u)
+{
+	Record rec;
+	size_t off = 0;
+
+	if (u->size <= UNDO_BUDGET)
+		return;
+	while (off < u->size && u->size - off > UNDO_BUDGET / 4 * 3) {
+		do {
+			read_record(u, off, &rec);
+			off += RECORD_SIZE(rec.len);
+			if (off < u->size)
+				read_record(u, off, &rec);
+		} while (off < u->size && rec.join);
+	}
+
+	memmove(u->arena, u->arena + off, u->size - off);
+	u->size -= off;
+	u->cur -= off;
+	if (u->saved != (size_t)-1)
+		u->saved = (u->saved < off) ? (size_t)-1 : u->saved - off;
+	if (u->last < off)
+		u->open = FALSE;
+	else
+		u->last -= off;
+	/* A large edit that has been dropped leaves a large arena behind */
+	if (u->cap > UNDO_BUDGET && u->size < u->cap / 4) {
+		u->cap = u->size + RECORD_SIZE(0);
+		u->arena = charrealloc(u->arena, u->cap);
+	}
+}
+
+/*
+ * Log the edit of buf at line n, index x, adding it to the last record
+ * if it goes on with it.
+ */
+static void record(Buffer *buf, int op, size_t n, size_t x,
+		const char *text, size_t len)
+{
+	Undo *u = get_undo(buf);
+	long when = now_ms();
+	Record rec;
+	size_t endn = n;
+	size_t endx = x;
+
+	/* What has been undone cannot be redone any more */
+	if (u->cur < u->size) {
+		if (u->saved != (size_t)-1 && u->saved > u->cur)
+			u->saved = (size_t)-1;
+		u->size = u->cur;
+		u->open = FALSE;
+	}
+
+	if (u->open && !u->grouping && when - u->when <= UNDO_PAUSE) {
+		read_record(u, u->last, &rec);
+		advance(&endn, &endx, text, len);
+		if (op == rec.op && ((op == UNDO_INSERT && n == u->next_line &&
+						x == u->next_x) ||
+					(op == UNDO_DELETE && endn == rec.line &&
+					 endx == rec.x))) {
+			add_to_last(u, op, n, x, text, len);
+			advance(&u->next_line, &u->next_x, text, len);
+			u->when = when;
+			trim(u);
+			return;
+		}
+	}
+
+	append_record(u, op, n, x, text, len);
+	u->open = !u->grouping;
+	u->next_line = n;
+	u->next_x = x;
+	advance(&u->next_line, &u->next_x, text, len);
+	u->when = when;
+	if (!u->grouping)
+		trim(u);
+}
+
+/*
+ * Log that len characters of text were inserted into buf at line n,
+ * index x.
+ */
+void undo_insert(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len)
+{
+	journal_insert(buf, n, x, text, len);
+	record(buf, UNDO_INSERT, n, x, text, len);
+}
+
+/*
+ * Log that the len characters of text at line n, index x of buf were
+ * deleted.
+ */
+void undo_delete(Buffer *buf, size_t n, size_t x, const char *text,
+		size_t len)
+{
+	journal_delete(buf, n, x, text, len);
+	record(buf, UNDO_DELETE, n, x, text, len);
+}
+
+/*
+ * Make the edits logged until undo_end() one step of undo.
+ */
+void undo_begin(Buffer *buf)
+{
+	Undo *u = get_undo(buf);
+
+	u->grouping = TRUE;
+	u->first = TRUE;
+	u->open = FALSE;
+}
+
+void undo_end(Buffer *buf)
+{
+	Undo *u = get_undo(buf);
+
+	u->grouping = FALSE;
+	trim(u);
+}
+
+/*
+ * Remember that buf is saved as it is now.
+ */
+void undo_saved(Buffer *buf)
+{
+	Undo *u = get_undo(buf);
+
+	u->saved = u->cur;
+	u->open = FALSE;
+}
+
+void undo_destroy(Buffer *buf)
+{
+	if (buf->undo != NULL) {
+		free(buf->undo->arena);
+		free(buf->undo);
+		buf->undo = NULL;
+	}
+}
+
+/*
+ * Undo the last step of buf. Return FALSE if there is nothing to undo.
+ */
+bool undo(Buffer *buf)
+{
+	Undo *u = buf->undo;
+	const char *text;
+	Record rec;
+	size_t n = 0;
+	size_t x = 0;
+
+	if (u == NULL || u->cur == 0)
+		return FALSE;
+
+	collapse_gap(buf);
+	u->open = FALSE;
+	do {
+		u->cur = prev_record(u, u->cur, &rec);
+		text = u->arena + u->cur + sizeof(Record);
+		n = rec.line;
+		x = rec.x;
+		if (rec.op == UNDO_INSERT) {
+			journal_delete(buf, n, x, text, rec.len);
+			delete_text(buf, n, x, text, rec.len);
+		}
+		else {
+			journal_insert(buf, n, x, text, rec.len);
+			insert_text(buf, n, x, text, rec.len);
+			advance(&n, &x, text, rec.len);
+		}
+	} while (rec.join && u->cur > 0);
+
+	go_to(buf, n, (int)x);
+	buffer_modified(buf, u->cur != u->saved);
+	return TRUE;
+}
+
+/*
+ * Redo the last step of buf that was undone. Return FALSE if there is
+ * nothing to redo.
+ */
+bool redo(Buffer *buf)
+{
+	Undo *u = buf->undo;
+	const char *text;
+	Record rec;
+	size_t n = 0;
+	size_t x = 0;
+
+	if (u == NULL || u->cur == u->size)
+		return FALSE;
+
+	collapse_gap(buf);
+	u->open = FALSE;
+	do {
+		read_record(u, u->cur, &rec);
+		text = u->arena + u->cur + sizeof(Record);
+		n = rec.line;
+		x = rec.x;
+		if (rec.op == UNDO_INSERT) {
+			journal_insert(buf, n, x, text, rec.len);
+			insert_text(buf, n, x, text, rec.len);
+			advance(&n, &x, text, rec.len);
+		}
+		else {
+			journal_delete(buf, n, x, text, rec.len);
+			delete_text(buf, n, x, text, rec.len);
+		}
+		u->cur += RECORD_SIZE(rec.len);
+		if (u->cur < u->size)
+			read_record(u, u->cur, &rec);
+	} while (u->cur < u->size && rec.join);
+
+	go_to(buf, n, (int)x);
+	buffer_modified(buf, u->cur != u->saved);
+	return TRUE;
+}
@@ -8,47 +8,24 @@
 
 /*
  * Convert visual x-coordinate to the index of its correspondent
- * character and return the index.
+ * character on the current line of buf and return the index.
  */
-int visual2real(const int visualx)
+int visual2real(Buffer *buf, const int visualx)
 {
-	int i = 0;
-	int pos = 0;
-
-	while (curbuf->curln->text[i] != '\0' && 
-			curbuf->curln->text[i] != '\n') {
-		if (curbuf->curln->text[i] == '\t')
-			pos += 8 - pos % 8;
-		else
-			pos++;
-		if (pos > visualx)
-			break;
-		i++;
-	}
-	return i;
+	return (int)index_at(buf, visualx);
 }
 
 /* Opposite of visual2real() */
-int real2visual(const int realx)
+int real2visual(Buffer *buf, const int realx)
 {
-	int i = 0;
-	int pos = 0;
-
-	while (i < realx && curbuf->curln->text[i] != '\0' && 
-			curbuf->curln->text[i] != '\n') {
-		if (curbuf->curln->text[i] == '\t')
-			pos += 8 - pos % 8;
-		else
-			pos++;
-		i++;
-	}
-	return pos;
+	return (int)column_of(buf, realx);
 }
 
 char *charalloc(size_t size)
 {
 	char *ptr = NULL;
 
+	stats_alloc(size);
 	ptr = malloc(sizeof(char) * size);
 	if (ptr == NULL) {
 		error = errno;
@@ -60,6 +37,7 @@ char *charalloc(size_t size)
 
 char *charrealloc(char *ptr, size_t size)
 {
+	stats_alloc(size);
 	ptr = realloc(ptr, sizeof(char) * size);
 	if (ptr == NULL) {
 		error =errno;
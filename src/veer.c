@@ -24,6 +24,14 @@
 #include <termios.h>
 #include <string.h>
 #include <signal.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+
+/* Where finish() writes the stats of stats.c, if anywhere */
+static const char *stats_file = NULL;
+
+static size_t megabytes(const char *arg);
 
 /*
  * Print the usage of the program and exit.
@@ -33,7 +41,13 @@ void usage()
 	#define HELP "Usage: veer [OPTIONS] [FILES]\n\n\
 Option		Meaning\n\
 -h		Show this msg\n\
--v		Print version\n"
+-v		Print version\n\
+-L		Open every file lazily, not only the large ones\n\
+-m MB		Memory a lazily opened file may use (default 64)\n\
+-R		View the files only, straight from the disk (default -m 1)\n\
+-y WHAT		Sync none, the file or all (also its directory) on save\n\
+		(default file)\n\
+-j FILE		Write latency and allocation stats to FILE on exit\n"
 
 	printf(HELP);
 	exit(EXIT_SUCCESS);
@@ -77,21 +91,33 @@ void init_terminal()
 	noecho();
 	curs_set(1);
 	set_escdelay(250);
+#ifdef HAVE_DEFINE_KEY
+	/* Have the terminal tell pastes from typing */
+	define_key("\033[200~", PASTE_BEGIN);
+	define_key("\033[201~", PASTE_END);
+	printf("\033[?2004h");
+	fflush(stdout);
+#endif
 	/* enable_signal(); */
 }
 
 /*
  * Initialize the three windows of the program i.e. mainwin, statbar and bottwin.
  * Also enable the keypad for mainwin and bottwin.
+ *
+ * Once they exist, the windows are only resized and moved: get_input() may
+ * be in the middle of reading from one of them when the terminal is resized.
  */
 void init_window()
 {
-	if (mainwin != NULL)
-		delwin(mainwin);
-	if (statbar != NULL)
-		delwin(statbar);
-	if (bottwin != NULL)
-		delwin(bottwin);
+	if (mainwin != NULL) {
+		wresize(mainwin, LINES - BOTTWIN_HEIGHT - STATBAR_HEIGHT, COLS);
+		wresize(statbar, STATBAR_HEIGHT, COLS);
+		mvwin(statbar, LINES - BOTTWIN_HEIGHT - STATBAR_HEIGHT, 0);
+		wresize(bottwin, BOTTWIN_HEIGHT, COLS);
+		mvwin(bottwin, LINES - BOTTWIN_HEIGHT, 0);
+		return;
+	}
 
 	/* newwin(int nlines, int ncols, int begin_y, int begin_x); */
 	mainwin = newwin(LINES - BOTTWIN_HEIGHT - STATBAR_HEIGHT, COLS, 0, 0);
@@ -100,6 +126,8 @@ void init_window()
 	
 	keypad(mainwin, TRUE);
 	keypad(bottwin, TRUE);
+	/* Let curses shift rows with the insert/delete line capabilities */
+	idlok(mainwin, TRUE);
 }
 
 void handle_sigstp(int signal)
@@ -161,7 +189,7 @@ void do_exit()
 			switch (prompt_ync("Save modified buffer `%s`?", 
 						it->path != NULL ? it->path : "Untitled")) {
 			case YES:
-				save_buffer();
+				save_as(it);
 				if (it->modified) {
 					return;
 				} else {
@@ -177,21 +205,62 @@ void do_exit()
 			}
 		}
 	}
+	/* What was not saved is thrown away on purpose */
+	for (it = firstbuf; it != NULL; it = it->next)
+		journal_close(it, TRUE);
 	finish();
 }
 
 /*
- * Exit gracefully
+ * Exit gracefully. Unless the user has dealt with them, the edits that
+ * are not saved are left in the journals, since finish() is also where
+ * the program ends up when it runs out of memory.
  */
 void finish()
 {
+	Buffer *it;
+
+	for (it = firstbuf; it != NULL; it = it->next)
+		journal_close(it, FALSE);
 	delwin(bottwin);
 	delwin(statbar);
 	delwin(mainwin);
 	endwin();
+#ifdef HAVE_DEFINE_KEY
+	printf("\033[?2004l");
+	fflush(stdout);
+#endif
+	if (stats_file != NULL) {
+		FILE *fs = fopen(stats_file, "w");
+
+		if (fs != NULL) {
+			stats_dump(fs);
+			fclose(fs);
+		}
+		else {
+			perror(stats_file);
+		}
+	}
 	exit(EXIT_SUCCESS);
 }
 
+/*
+ * Insert the text that comes in a burst starting with first, or that is
+ * pasted, all at once. A single character is inserted as typed.
+ */
+void do_text(int first, bool paste)
+{
+	char *text;
+	size_t len;
+
+	text = get_text(mainwin, first, paste, &len);
+	if (len == 1 && text[0] != '\n')
+		insert_char(curbuf, text[0]);
+	else
+		insert_str(curbuf, text, len);
+	free(text);
+}
+
 /*
  * Handle various inputs. There are 3 different inputs.
  * 1 - Printable ASCII characters
@@ -203,17 +272,43 @@ void do_input()
 	int input;
 	bool short_cut = FALSE;
 	bool action_key = FALSE;
+	long start;
 	
 	input = get_input(mainwin, &short_cut, &action_key);
+	start = stats_clock();
 
-	/* We have a printable character */
+	/* We have a printable character, and maybe more are waiting */
 	if (short_cut == FALSE && action_key == FALSE) {
-		insert_char((char)input);
+		if (curbuf->results != NULL)
+			do_key(curbuf, input);
+		else
+			do_text(input, FALSE);
 	}
 	else if (short_cut == TRUE) {
 		switch (input) {
 		case DO_SAVE:
-			save_buffer();
+			do_save();
+			break;
+		case DO_CLOSE_BUF:
+			close_buffer();
+			break;
+		case DO_GOTO_LINE:
+			do_goto_line();
+			break;
+		case DO_SEARCH:
+			do_search(DOWN);
+			break;
+		case DO_SEARCH_BACK:
+			do_search(UP);
+			break;
+		case DO_SEARCH_ALL:
+			do_search_all();
+			break;
+		case DO_REGEX_SEARCH:
+			do_regex_search();
+			break;
+		case DO_REGEX_REPLACE:
+			do_regex_replace();
 			break;
 		case DO_EXIT:
 			do_exit();
@@ -224,46 +319,63 @@ void do_input()
 		case DO_NEXT_BUF:
 			do_next_buf();
 			break;
+		case DO_STATS:
+			do_stats();
+			break;
+		case DO_FOLLOW:
+			do_follow();
+			break;
+		default:
+			do_key(curbuf, input);
+			break;
 		}
 	}
 	else if (action_key == TRUE) {
 		switch (input) {
-		case KEY_DOWN:
-			go_down();
-			break;
-		case KEY_RIGHT:
-			go_right();
-			break;
-		case KEY_UP:
-			go_up();
-			break;
-		case KEY_LEFT:
-			go_left();
-			break;
-		case KEY_HOME:
-			go_beg();
-			break;
-		case KEY_END:
-			go_end();
-			break;
 		case CARRIAGE_RET:
-			do_enter();
+			if (curbuf->results != NULL)
+				findall_goto();
+			else
+				do_key(curbuf, input);
 			break;
-		case KEY_BACKSPACE:
-			do_backspace();
+		case PASTE_BEGIN:
+			do_text(0, TRUE);
 			break;
 		default:
+			do_key(curbuf, input);
 			break;
 		}
 	}
+	stats_add(STAT_INPUT, start);
+}
+
+/*
+ * Return the number of bytes in arg megabytes, or exit if arg is not a
+ * positive number of them.
+ */
+static size_t megabytes(const char *arg)
+{
+	unsigned long n;
+	char *end;
+
+	errno = 0;
+	n = strtoul(arg, &end, 10);
+	if (!isdigit((unsigned char)arg[0]) || *end != '\0' || errno != 0 ||
+			n == 0 || n > SIZE_MAX / (1024 * 1024)) {
+		fprintf(stderr, "veer: `%s' is not a positive number of megabytes\n",
+				arg);
+		exit(EXIT_FAILURE);
+	}
+	return (size_t)n * 1024 * 1024;
 }
 
 int main(int argc, char *argv[])
 {
+	Buffer *it;
+	bool cap_given = FALSE;
 	char opt;
-	bool opts_processed = FALSE;
 	
-	while ((opt = (char)getopt(argc, argv, "hv")) != -1) {
+	while ((opt = (char)getopt(argc, argv, "hvLRm:y:j:")) != -1) {
 		switch (opt) {
 		case 'h':
 			usage();
@@ -271,14 +383,42 @@ int main(int argc, char *argv[])
 		case 'v':
 			version();
 			break;
+		case 'L':
+			lazy_all = TRUE;
+			break;
+		case 'R':
+			view_only = TRUE;
+			lazy_all = TRUE;
+			break;
+		case 'm':
+			lazy_cap = megabytes(optarg);
+			cap_given = TRUE;
+			break;
+		case 'y':
+			if (strcmp(optarg, "none") == 0)
+				sync_policy = SYNC_NONE;
+			else if (strcmp(optarg, "file") == 0)
+				sync_policy = SYNC_FILE;
+			else if (strcmp(optarg, "all") == 0)
+				sync_policy = SYNC_ALL;
+			else
+				usage();
+			break;
+		case 'j':
+			stats_file = optarg;
+			break;
 		default:
 			usage();
 		}
-		opts_processed = TRUE;
 	}
 
+	/* A file that is only viewed needs no more lines than the screen */
+	if (view_only && !cap_given)
+		lazy_cap = VIEW_CAP;
+
 	/* Initializations */
 	
+	render = &curses_render;
 	init_terminal();
 	init_window();	
 	init_signal();
@@ -286,16 +426,38 @@ int main(int argc, char *argv[])
 	/* End of initializations */
 
 	/* Open buffer */
-	if ((argc > 1) && (opts_processed == FALSE)) {
+	if (optind < argc) {
 		int i;
 
 		for (i = optind; i < argc; i++) {
 			open_buffer(argv[i]);
 		}
 	}
-	else if (argc == 1) {
+	else {
 		open_buffer(NULL);
 	}
+	/* Edits left behind when the program died */
+	for (it = firstbuf; it != NULL; it = it->next) {
+		/* A file that is only viewed is not recovered either */
+		if (view_only || !journal_found(it))
+			continue;
+		curbuf = it;
+		switch (prompt_ync("`%s' has unsaved edits in its journal, "
+					"recover them?", it->path)) {
+		case YES:
+			print_msg_prompt("Recovered %zu edits of `%s'",
+					journal_replay(it), it->path);
+			break;
+		case NO:
+			journal_discard(it);
+			break;
+		/* Left for another time */
+		default:
+			journal_keep(it);
+			break;
+		}
+	}
+	curbuf = firstbuf;
 
 	/* Show buffer if it is not empty */
 	if (curbuf != NULL) {
@@ -8,6 +8,7 @@
 /* header files that are only used throughout the program */
 #include <stdlib.h>
 #include <assert.h>
+#include <sys/types.h>
 #include <curses.h>
 
 /* VEER version */
@@ -23,6 +24,13 @@ typedef enum Direction {
 	DOWN = 1
 } Direction;
 
+/* What is synced to the disk when a file is saved, see commit_temp() */
+typedef enum Sync {
+	SYNC_NONE,
+	SYNC_FILE,
+	SYNC_ALL
+} Sync;
+
 typedef enum Response {
 	YES = 1,
 	NO = 0,
@@ -32,16 +40,163 @@ typedef enum Response {
 
 /* Global structures */
 
-/* typedef struct Line Line; */
+/*
+ * text is not null-terminated; len counts every character including the
+ * trailing '\n', if any. A line whose memsize is zero does not own its
+ * text: it points into the original text of its buffer, which is read-only
+ * and must be copied with own_line() before being modified.
+ */
 typedef struct Line {
 	char *text;
 	size_t len;
 	size_t memsize;
-	size_t line_no;
+	/* The block of the line index the line belongs to */
+	struct Block *block;
 	struct Line *prev;
 	struct Line *next;
 } Line;
 
+/*
+ * The line index groups consecutive lines into blocks, see index.c.
+ * idx is the position of the block in blocks, tree is a Fenwick tree over
+ * the line counts of the blocks.
+ */
+typedef struct Block {
+	Line *first;
+	size_t count;
+	size_t idx;
+} Block;
+
+typedef struct Index {
+	Block **blocks;
+	size_t nblocks;
+	size_t cap;
+	size_t *tree;
+	bool dirty;
+	size_t nlines;
+	/* Number of lines before the first line, see lazy.c */
+	size_t base;
+} Index;
+
+/*
+ * A lazy buffer only holds the lines of [head, tail) of its original
+ * text, see lazy.c. marks[i] is the offset of line i * LAZY_STRIDE of the
+ * original text; the text has been scanned for marks up to scanned.
+ */
+typedef struct Lazy {
+	size_t head;
+	size_t tail;
+	size_t *marks;
+	size_t nmarks;
+	size_t markcap;
+	size_t scanned;
+	size_t scanned_lines;
+} Lazy;
+
+/* What stats.c times */
+typedef enum Stat {
+	STAT_INPUT,
+	STAT_UPDATE,
+	STAT_LOAD,
+	STAT_SAVE,
+	STAT_KINDS
+} Stat;
+
+#define STATS_BUCKETS 	24
+
+/* The times of one kind of thing, in microseconds, see stats.c */
+typedef struct Histogram {
+	size_t count;
+	unsigned long total;
+	unsigned long max;
+	size_t buckets[STATS_BUCKETS];
+} Histogram;
+
+/* The background loader of a buffer, see loader.c */
+typedef struct Loader Loader;
+
+/* What a search results buffer lists, see findall.c */
+typedef struct Results Results;
+
+/* A compiled regular expression, see regex.c */
+typedef struct Regex Regex;
+
+/* The log of the edits of a buffer, see undo.c */
+typedef struct Undo Undo;
+
+/* The swap journal of a buffer, see journal.c */
+typedef struct Journal Journal;
+
+/* How the file of a buffer is followed, see follow.c */
+typedef struct Follow Follow;
+
+/* How a file is compressed, see codec.c */
+typedef enum Codec {
+	CODEC_NONE,
+	CODEC_GZIP,
+	CODEC_XZ,
+	CODEC_ZSTD
+} Codec;
+
+typedef struct Decoder Decoder;
+typedef struct Encoder Encoder;
+
+/*
+ * The tabs of the current line of a buffer, see column.c: the k-th tab is
+ * the pos[k]-th character and the text after it starts at column col[k].
+ * The tabs from split on are stored without dpos and dcol added.
+ */
+typedef struct Columns {
+	const Line *line;
+	size_t *pos;
+	size_t *col;
+	size_t ntabs;
+	size_t cap;
+	size_t split;
+	size_t dpos;
+	size_t dcol;
+	/* Number of characters of the line, without '\n' */
+	size_t end;
+} Columns;
+
+/*
+ * What scanning a text for line breaks found, see scan.c. pos is the
+ * number of characters scanned, start is where the last line starts and
+ * last is the character before pos.
+ */
+typedef struct Scan {
+	size_t lines;
+	size_t longest;
+	size_t crlf;
+	size_t nuls;
+	size_t pos;
+	size_t start;
+	char last;
+} Scan;
+
+/*
+ * A search pattern, see search.c: skip[c] is how far the pattern may be
+ * moved on if c is the character under its last one.
+ */
+typedef struct Pattern {
+	char *text;
+	size_t len;
+	size_t skip[256];
+} Pattern;
+
+/* Line nodes and short line text of a buffer are allocated from its pool */
+#define POOL_TEXT_MAX 	128
+
+typedef struct Pool {
+	struct Slab *slabs;
+	char *next;
+	size_t left;
+	Line *free_lines;
+	struct Chunk *free_text[POOL_TEXT_MAX / 16];
+	size_t served;
+	size_t nslabs;
+} Pool;
+
 typedef struct Buffer {
 	int id;
 	char *path;
@@ -53,26 +208,109 @@ typedef struct Buffer {
 	int x_pos;
 	int y_pos;
 	int visual_x;
+	/* The column shown at the left edge of the window */
+	size_t left_col;
+	/*
+	 * While curln is being edited, its text has a gap of gaplen unused
+	 * bytes at gap, which is where the cursor was last edited at.
+	 */
+	size_t gap;
+	size_t gaplen;
 	bool modified;
+	/* The text of the file as it was read, mapped if possible */
+	char *orig;
+	size_t origsize;
+	bool orig_mapped;
+	dev_t orig_dev;
+	ino_t orig_ino;
+	/* How the file is compressed, it is saved compressed the same way */
+	Codec codec;
+	Pool pool;
+	Index index;
+	Columns columns;
+	/* What the scan of the original text found, if it was scanned */
+	Scan scan;
+	Lazy *lazy;
+	Loader *loader;
+	/* Not NULL if the buffer lists the results of a search */
+	Results *results;
+	/* What undo and redo go through, NULL until the first edit */
+	Undo *undo;
+	/* Where the edits go until they are saved, NULL until the first edit */
+	Journal *journal;
+	/* Not NULL while the file is followed as it grows */
+	Follow *follow;
 	struct Buffer *prev;
 	struct Buffer *next;
 } Buffer; /* Buffer is only an alias not an instance */
 
+/*
+ * What the editing core tells about the changes it makes to a buffer, see
+ * render.c. rows is the number of rows a buffer is shown on; line paints
+ * a line on the row of the cursor, from paints the lines from one on down
+ * from there, shift moves the rows from y on by one row in dir to make
+ * room for a line or close the gap of one, scrol scrolls by one row,
+ * cursor shows where the cursor is, status shows the state of the buffer
+ * and all shows all of it again.
+ */
+typedef struct Render {
+	int (*rows)();
+	void (*line)(Buffer *buf, Line *line);
+	void (*from)(Buffer *buf, Line *line);
+	void (*shift)(Buffer *buf, int y, Direction dir);
+	void (*scrol)(Buffer *buf, Direction dir);
+	void (*cursor)(Buffer *buf);
+	void (*status)(Buffer *buf);
+	void (*all)(Buffer *buf);
+	void (*message)(const char *msg);
+} Render;
+
 /* Macros */
 #define BUFFER_SIZE 	80
+/* Files larger than this are opened as lazy buffers */
+#define LAZY_THRESHOLD	((off_t)1 << 30)
+/* Memory a lazy buffer may spend on its window with -R */
+#define VIEW_CAP 		(1024 * 1024)
+#define GAP_SIZE 		64
+/* Number of line ends asked of scan_lines() at a time */
+#define SCAN_BATCH 		1024
+/* Milliseconds to wait for input while files are loading */
+#define LOADER_POLL 	50
+/* Milliseconds to wait for the rest of a paste before giving up on it */
+#define PASTE_WAIT 	1000
 #define STATBAR_HEIGHT 	1
 #define BOTTWIN_HEIGHT 	2
 #define MAINWIN_OFFSET 	(STATBAR_HEIGHT + BOTTWIN_HEIGHT)
 
+/* The i-th character of the current line of buf, skipping over the gap */
+#define CURLN_CHAR(buf, i) \
+	((buf)->curln->text[(size_t)(i) < (buf)->gap ? (size_t)(i) : \
+	 (size_t)(i) + (buf)->gaplen])
+
 /* Functions with associated keys */
 #define CNTRL(CH) ((CH) - 64)
 
 #define DO_EXIT		CNTRL('X')	
 #define DO_SAVE		CNTRL('S')
+#define DO_CLOSE_BUF	CNTRL('W')
+#define DO_GOTO_LINE	CNTRL('G')
+#define DO_SEARCH	CNTRL('F')
+#define DO_SEARCH_BACK	CNTRL('B')
+#define DO_SEARCH_ALL	CNTRL('A')
+#define DO_REGEX_SEARCH	CNTRL('E')
+#define DO_REGEX_REPLACE	CNTRL('R')
+#define DO_UNDO		CNTRL('Z')
+#define DO_REDO		CNTRL('Y')
+#define DO_STATS	CNTRL('P')
+#define DO_FOLLOW	CNTRL('T')
 
 #define DO_PREV_BUF	544
 #define DO_NEXT_BUF	559
 
+/* Made up keys for where a bracketed paste starts and ends */
+#define PASTE_BEGIN	(KEY_MAX + 1)
+#define PASTE_END	(KEY_MAX + 2)
+
 #define CARRIAGE_RET	13
 #define ESCAPE			27
 
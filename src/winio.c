@@ -3,7 +3,100 @@
  */
 #include "proto.h"
 #include <ctype.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdarg.h>
 
+/* Number of characters a field of the status bar may take */
+#define STATUS_FIELD 	256
+
+/*
+ * The frame is a shadow of what was last painted on each row of mainwin:
+ * the characters of the row from the leftmost column of the buffer on,
+ * clipped to the width of the window, with tabs expanded. Rows are
+ * only painted again if what they should show differs from the frame, and
+ * rows that merely moved are shifted with the insert/delete line
+ * capabilities of the terminal, see shift_rows().
+ */
+typedef struct Row {
+	char *text;
+	int len;
+	int cap;
+} Row;
+
+static Row *frame = NULL;
+static int nrows = 0;
+
+/*
+ * The status bar is kept as the fields it shows, which update_statbar()
+ * only sets. Once a frame, before the screen is updated, paint_statbar()
+ * lays them out and paints the span of columns that differs from what
+ * was painted last, if any.
+ */
+enum {
+	FIELD_PATH,
+	FIELD_STATE,
+	FIELD_POS,
+	FIELD_DOS,
+	FIELD_NUL,
+	FIELD_LOADING,
+	FIELD_SEARCHING,
+	FIELDS
+};
+
+static struct {
+	char field[FIELDS][STATUS_FIELD];
+	/* What is painted, cols characters, 0 if nothing is */
+	char *shown;
+	char *next;
+	int cols;
+	bool dirty;
+} status;
+
+/* Whether the histograms of stats.c are shown, see do_stats() */
+static bool stats_shown = FALSE;
+
+/* What is shown of the current buffer and where the user is typing */
+WINDOW *mainwin = NULL;
+WINDOW *statbar = NULL;
+WINDOW *bottwin = NULL;
+Curwin curwin;
+Buffer *curbuf = NULL;
+
+static void fit_frame();
+static size_t slice_start(const Line *line, size_t left, size_t *col);
+static void paint_row(int y, const Line *line);
+static bool follow_cursor();
+static int cursor_x();
+static void shift_frame(int y, int n);
+static size_t clean_text(char *text, size_t len);
+static char *read_paste(size_t *len);
+static void paint_stats();
+static void set_field(int k, const char *fmt, ...);
+static void paint_statbar(WINDOW *win);
+static int curses_rows();
+static void curses_line(Buffer *buf, Line *line);
+static void curses_from(Buffer *buf, Line *line);
+static void curses_shift(Buffer *buf, int y, Direction dir);
+static void curses_scroll(Buffer *buf, Direction dir);
+static void curses_cursor(Buffer *buf);
+static void curses_status(Buffer *buf);
+static void curses_all(Buffer *buf);
+static void curses_message(const char *msg);
+
+/* Shows what the core does to the current buffer, see render.c */
+const Render curses_render = {
+	curses_rows,
+	curses_line,
+	curses_from,
+	curses_shift,
+	curses_scroll,
+	curses_cursor,
+	curses_status,
+	curses_all,
+	curses_message
+};
 
 /*
  * Get input from user and determine if the input is a short cut (CTRL+char),
@@ -14,18 +107,44 @@ int get_input(WINDOW *win, bool *short_cut, bool *action_key)
 {
 	int input;
 
+	if (stats_shown && win == mainwin)
+		paint_stats();
+	paint_statbar(win);
 	/* A single call for all the screen update */
-	doupdate();
+	update_screen();
 
-	/* Using blocking mode */
-	input = wgetch(win);
+	/*
+	 * Do background work until a key is pressed, then block. While files
+	 * are loading there may be nothing to do yet, so only wait a little.
+	 */
+	while (TRUE) {
+		wtimeout(win, 0);
+		if ((input = wgetch(win)) != ERR)
+			break;
+		if (loader_idle() || lazy_idle() || findall_idle() || follow_idle() ||
+				status.dirty) {
+			paint_statbar(win);
+			update_screen();
+			continue;
+		}
+		wtimeout(win, (loader_busy() || findall_busy() || follow_busy()) ?
+				LOADER_POLL : -1);
+		if ((input = wgetch(win)) != ERR)
+			break;
+	}
+	wtimeout(win, -1);
 
+	/* The made up keys are past what the ctype functions take */
+	if (input == PASTE_BEGIN || input == PASTE_END) {
+		*short_cut = FALSE;
+		*action_key = TRUE;
+	}
 	/* Printable character */
 	/*
 	 * Exception:
 	 * Horizontal tab = 9
 	 */
-	if (isprint(input) || input == 9) {
+	else if (isprint(input) || input == 9) {
 		*short_cut = FALSE;
 		*action_key = FALSE;
 	}
@@ -57,6 +176,314 @@ int get_input(WINDOW *win, bool *short_cut, bool *action_key)
 	return input;
 }
 
+/*
+ * Keep the characters of text that can be inserted, turning carriage
+ * returns into '\n', "\r\n" into one. Return the new length.
+ */
+static size_t clean_text(char *text, size_t len)
+{
+	size_t i;
+	size_t n = 0;
+	char c;
+	char prev = '\0';
+
+	for (i = 0; i < len; i++, prev = c) {
+		c = text[i];
+		if (c == '\r' || (c == '\n' && prev != '\r'))
+			text[n++] = '\n';
+		else if (isprint((unsigned char)c) || c == '\t')
+			text[n++] = c;
+	}
+	return n;
+}
+
+/*
+ * Read what is pasted up to where the paste ends. curses reads a byte per
+ * system call, so the text is read straight from the terminal instead.
+ * What comes after the paste is handed back to curses.
+ */
+static char *read_paste(size_t *len)
+{
+	static const char end[] = "\033[201~";
+	const size_t endlen = sizeof(end) - 1;
+	size_t cap = 64 * 1024;
+	char *text = charalloc(cap);
+	struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+	size_t from;
+	ssize_t n;
+	char *p = NULL;
+
+	*len = 0;
+	while (poll(&pfd, 1, PASTE_WAIT) > 0) {
+		if (cap - *len < cap / 4) {
+			cap *= 2;
+			text = charrealloc(text, cap);
+		}
+		if ((n = read(STDIN_FILENO, text + *len, cap - *len)) <= 0)
+			break;
+		/* The end may have come in two reads */
+		from = (*len > endlen) ? *len - endlen : 0;
+		*len += n;
+		for (p = text + from; (p = memchr(p, '\033', text + *len - p)) != NULL;
+				p++) {
+			if ((size_t)(text + *len - p) >= endlen &&
+					memcmp(p, end, endlen) == 0)
+				break;
+		}
+		if (p != NULL)
+			break;
+	}
+	if (p != NULL) {
+		n = text + *len - (p + endlen);
+		while (n > 0)
+			ungetch((unsigned char)p[endlen + --n]);
+		*len = p - text;
+	}
+	*len = clean_text(text, *len);
+	return text;
+}
+
+/*
+ * Read text that comes in a burst, so that it can be inserted at once.
+ * If paste is TRUE, read what was pasted. Otherwise first is a printable
+ * character that was just read and the text is whatever printable
+ * characters and carriage returns are already waiting after it; the
+ * first other key is left to get_input(). Carriage returns are turned
+ * into '\n'. Return the text, which the caller should free(), and store
+ * its length in *len.
+ */
+char *get_text(WINDOW *win, int first, bool paste, size_t *len)
+{
+	size_t cap = BUFFER_SIZE;
+	char *text;
+	int input = first;
+
+	if (paste)
+		return read_paste(len);
+
+	text = charalloc(cap);
+	*len = 0;
+	wtimeout(win, 0);
+	while (input != ERR) {
+		if (input < 0 || input > 255 ||
+				(!isprint(input) && input != '\t' && input != '\r')) {
+			ungetch(input);
+			break;
+		}
+		if (*len == cap) {
+			cap *= 2;
+			text = charrealloc(text, cap);
+		}
+		text[(*len)++] = (input == '\r') ? '\n' : input;
+		input = wgetch(win);
+	}
+	wtimeout(win, -1);
+	return text;
+}
+
+/*
+ * Make the frame as tall as mainwin. New rows are blank.
+ */
+static void fit_frame()
+{
+	int rows = getmaxy(mainwin);
+	int y;
+
+	if (rows == nrows)
+		return;
+	for (y = rows; y < nrows; y++)
+		free(frame[y].text);
+	frame = realloc(frame, rows * sizeof(Row));
+	if (frame == NULL && rows > 0) {
+		fprintf(stderr, "%s: realloc failed\n", __func__);
+		finish();
+	}
+	for (y = nrows; y < rows; y++) {
+		frame[y].cap = COLS + 1;
+		frame[y].text = charalloc(frame[y].cap);
+		frame[y].len = 0;
+	}
+	nrows = rows;
+}
+
+/*
+ * Return the index of the first character of line, a line of the current
+ * buffer, that starts at column left or after it, and store the column it
+ * starts at in *col; that is past left only if a tab covers left. Like in
+ * column.c, only tabs are wider than one column. Only the characters
+ * before left are looked at, and for the current line only its tabs.
+ */
+static size_t slice_start(const Line *line, size_t left, size_t *col)
+{
+	const char *tab;
+	size_t end = line->len;
+	size_t run;
+	size_t i = 0;
+
+	if (line == curbuf->curln) {
+		i = index_at(curbuf, left);
+		*col = column_of(curbuf, i);
+		if (*col < left && i < line->len && CURLN_CHAR(curbuf, i) == '\t')
+			*col = column_of(curbuf, ++i);
+		return i;
+	}
+
+	if (end > 0 && line->text[end - 1] == '\n')
+		end--;
+	*col = 0;
+	while (i < end && *col < left) {
+		tab = memchr(line->text + i, '\t', end - i);
+		run = ((tab != NULL) ? (size_t)(tab - line->text) : end) - i;
+		if (*col + run >= left) {
+			i += left - *col;
+			*col = left;
+			break;
+		}
+		*col += run;
+		i += run;
+		if (tab != NULL) {
+			*col += 8 - *col % 8;
+			i++;
+		}
+	}
+	return i;
+}
+
+/*
+ * Paint line, or nothing if it is NULL, on row y of mainwin unless the
+ * row already shows it. The current line may have a gap in the middle of
+ * its text. Only the slice of the line from the leftmost column of the
+ * buffer on that fits in the window is looked at.
+ */
+static void paint_row(int y, const Line *line)
+{
+	static Row next = { NULL, 0, 0 };
+	Row *row = &frame[y];
+	Row tmp;
+	int width = getmaxx(mainwin);
+	size_t left = curbuf->left_col;
+	size_t start = left;
+	int col;
+	int w;
+	size_t i = 0;
+	char c;
+
+	if (next.cap < width + 1) {
+		next.cap = width + 1;
+		next.text = charrealloc(next.text, next.cap);
+	}
+	next.len = 0;
+	if (line != NULL)
+		i = slice_start(line, left, &start);
+	/* The rest of a tab that starts before the left edge */
+	for (col = 0; col < (int)(start - left) && col < width; col++)
+		next.text[next.len++] = ' ';
+	for (; line != NULL && i < line->len; i++) {
+		c = (line == curbuf->curln) ? CURLN_CHAR(curbuf, i) : line->text[i];
+		if (c == '\n')
+			break;
+		w = (c == '\t') ? (int)(8 - (left + col) % 8) :
+			(int)strlen(unctrl((unsigned char)c));
+		if (col + w > width)
+			break;
+		if (c == '\t')
+			memset(next.text + next.len, ' ', w);
+		else
+			next.text[next.len] = c;
+		next.len += (c == '\t') ? w : 1;
+		col += w;
+	}
+
+	if (next.len == row->len && memcmp(next.text, row->text, next.len) == 0)
+		return;
+
+	wmove(mainwin, y, 0);
+	waddnstr(mainwin, next.text, next.len);
+	/* A row that fills the window leaves the cursor on the next one */
+	if (getcury(mainwin) == y)
+		wclrtoeol(mainwin);
+
+	/* The row now shows next, keep it in the frame */
+	tmp = *row;
+	*row = next;
+	next = tmp;
+}
+
+/*
+ * Move the rows of the frame from y on by n rows, down if n is positive.
+ * Rows moved in at either end are blank.
+ */
+static void shift_frame(int y, int n)
+{
+	Row tmp;
+	int i;
+
+	if (n > 0) {
+		for (i = nrows - 1; i >= y + n; i--) {
+			tmp = frame[i];
+			frame[i] = frame[i - n];
+			frame[i - n] = tmp;
+		}
+		for (i = y; i < y + n && i < nrows; i++)
+			frame[i].len = 0;
+	}
+	else {
+		for (i = y; i < nrows + n; i++) {
+			tmp = frame[i];
+			frame[i] = frame[i - n];
+			frame[i - n] = tmp;
+		}
+		for (i = nrows + n; i < nrows; i++)
+			if (i >= y)
+				frame[i].len = 0;
+	}
+}
+
+/*
+ * Make room for a line inserted at row y (dir is DOWN), or close the gap
+ * left by the line deleted from row y (dir is UP), by shifting the rows
+ * below in the terminal rather than painting them again.
+ */
+void shift_rows(int y, Direction dir)
+{
+	fit_frame();
+	if (y >= nrows)
+		return;
+	wmove(mainwin, y, 0);
+	winsdelln(mainwin, dir == DOWN ? 1 : -1);
+	shift_frame(y, dir == DOWN ? 1 : -1);
+}
+
+/*
+ * Bring the cursor of the current buffer into view by moving its leftmost
+ * column, by half the width of the window so that typing along a long
+ * line does not move it on every key. Return TRUE if it was moved.
+ */
+static bool follow_cursor()
+{
+	size_t width = getmaxx(mainwin);
+	size_t x = real2visual(curbuf, curbuf->x_pos);
+	size_t left = curbuf->left_col;
+
+	if (x >= left && x < left + width)
+		return FALSE;
+	left = (x < width) ? 0 : x - width / 2;
+	if (left == curbuf->left_col)
+		return FALSE;
+	curbuf->left_col = left;
+	return TRUE;
+}
+
+/*
+ * Return the column of mainwin the cursor of the current buffer is at.
+ * visual_x may be where the cursor is kept at going up and down rather
+ * than where it is, so it is worked out again.
+ */
+static int cursor_x()
+{
+	return real2visual(curbuf, curbuf->x_pos) - (int)curbuf->left_col;
+}
+
 /*
  * Display buffer starting from the topln
  */
@@ -64,31 +491,36 @@ void display_buffer()
 {
 	int tmp;
 
+	follow_cursor();
 	tmp = curbuf->y_pos;
 	curbuf->y_pos = 0;
 	print_buffer(curbuf->topln);
 	curbuf->y_pos = tmp;
-	position_cursor(mainwin, curbuf->y_pos, curbuf->visual_x);
+	position_cursor(mainwin, curbuf->y_pos, cursor_x());
 	update_statbar();
 }
 
 /*
- * print buffer on the virtual screen starting from beg line. First,we move 
- * the cursor to the beginning of the line and at the end, we place the cursor
- * at its original position.
+ * print buffer on the virtual screen starting from beg line, on the row of
+ * the cursor down to the bottom. Only rows that changed are painted. At
+ * the end, we place the cursor at its original position.
  */
 void print_buffer(Line *beg)
 {
-	Line *it;
-	size_t i;
+	Line *it = beg;
+	int y;
 
-	wmove(mainwin, curbuf->y_pos, 0);
-	wclrtobot(mainwin);
-	for (it = beg, i = curbuf->y_pos; it != NULL && 
-			i < (LINES - MAINWIN_OFFSET); it = it->next, i++) {
-		waddstr(mainwin, it->text);
+	if (follow_cursor()) {
+		display_buffer();
+		return;
+	}
+	fit_frame();
+	for (y = curbuf->y_pos; y < nrows; y++) {
+		paint_row(y, it);
+		if (it != NULL)
+			it = it->next;
 	}
-	wmove(mainwin, curbuf->y_pos, curbuf->visual_x);
+	wmove(mainwin, curbuf->y_pos, cursor_x());
 	wnoutrefresh(mainwin);
 }
 
@@ -125,9 +557,20 @@ void clear_line(WINDOW *win, int y)
  */
 void clear_win(WINDOW *win)
 {
+	int y;
+
 	wmove(win, 0, 0);
 	wclrtobot(win);
 	wnoutrefresh(win);
+	if (win == statbar) {
+		status.cols = 0;
+		status.dirty = TRUE;
+	}
+	if (win == mainwin) {
+		fit_frame();
+		for (y = 0; y < nrows; y++)
+			frame[y].len = 0;
+	}
 }
 
 /*
@@ -135,74 +578,213 @@ void clear_win(WINDOW *win)
  */
 void scrol(Direction dir)
 {
+	fit_frame();
 	scrollok(mainwin, TRUE);
 	wscrl(mainwin, dir);
 	scrollok(mainwin, FALSE);
+	shift_frame(0, -dir);
 }
 
 /*
- * print the line pointed by line.
+ * print the line pointed by line on the row of the cursor.
  */
 void print_line(Line *line)
 {
-	wmove(mainwin, curbuf->y_pos, 0);
-	waddstr(mainwin, line->text);
-	wmove(mainwin, curbuf->y_pos, curbuf->visual_x);
+	if (follow_cursor()) {
+		display_buffer();
+		return;
+	}
+	fit_frame();
+	paint_row(curbuf->y_pos, line);
+	wmove(mainwin, curbuf->y_pos, cursor_x());
 
 	wnoutrefresh(mainwin);
 }
 
 /*
- * Paint the background of statbar
+ * Set the k-th field of the status bar, which is then painted again if it
+ * changed.
  */
-void paint_statbar()
+static void set_field(int k, const char *fmt, ...)
 {
-	int i;
-	
-	wmove(statbar, 0, 0);
-	wclrtoeol(statbar);
-	for (i = 0; i < COLS; i++) {
-		waddch(statbar, ' ');
+	char text[STATUS_FIELD];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(text, sizeof(text), fmt, ap);
+	va_end(ap);
+	if (strcmp(text, status.field[k]) != 0) {
+		strcpy(status.field[k], text);
+		status.dirty = TRUE;
 	}
 }
 
 /*
- * Update and print the status bar
+ * Paint the fields of the status bar that changed, if any did. The
+ * cursor is left on win.
  */
-void update_statbar()
+static void paint_statbar(WINDOW *win)
 {
-	const char *buffer_path;
-	const char *buffer_state;
+	char *tmp;
+	int cols = getmaxx(statbar);
+	int len = 0;
+	int beg;
+	int end;
+	int k;
+
+	if (!status.dirty)
+		return;
+	status.dirty = FALSE;
+	if (cols != status.cols) {
+		status.next = charrealloc(status.next, cols + 1);
+		status.shown = charrealloc(status.shown, cols + 1);
+	}
 
-	buffer_path = (curbuf->path != NULL) ? curbuf->path : "[Untitled]";
-	buffer_state = curbuf->modified ? "[+]" : "   ";
+	/* The path, the state and the position are apart */
+	for (k = 0; k < FIELDS; k++) {
+		len += snprintf(status.next + len, cols + 1 - len, "%s%s",
+				(k > 0 && k <= FIELD_POS) ? " " : "", status.field[k]);
+		if (len >= cols) {
+			len = cols;
+			break;
+		}
+	}
+	memset(status.next + len, ' ', cols - len);
 
-	wattron(statbar, A_REVERSE);
+	if (cols != status.cols) {
+		beg = 0;
+		end = cols;
+	}
+	else {
+		for (beg = 0; beg < cols && status.next[beg] == status.shown[beg];
+				beg++)
+			;
+		for (end = cols; end > beg && status.next[end - 1] ==
+				status.shown[end - 1]; end--)
+			;
+	}
+	if (beg < end) {
+		wattron(statbar, A_REVERSE);
+		mvwaddnstr(statbar, 0, beg, status.next + beg, end - beg);
+		wattroff(statbar, A_REVERSE);
+		wnoutrefresh(statbar);
+		wnoutrefresh(win);
+	}
+
+	tmp = status.shown;
+	status.shown = status.next;
+	status.next = tmp;
+	status.cols = cols;
+}
 
-	paint_statbar();
-	mvwprintw(statbar, 0, 0, "%s %s %d-%d", 
-			buffer_path, buffer_state, curbuf->curln->line_no,
+/*
+ * Update the fields of the status bar, which is painted before the next
+ * update of the screen.
+ */
+void update_statbar()
+{
+	const char *buffer_path;
+	int percent;
+
+	if (curbuf->results != NULL)
+		buffer_path = "[Search results]";
+	else
+		buffer_path = (curbuf->path != NULL) ? curbuf->path : "[Untitled]";
+	set_field(FIELD_PATH, "%s", buffer_path);
+	set_field(FIELD_STATE, "%s", curbuf->modified ? "[+]" : "   ");
+	set_field(FIELD_POS, "%zu-%d", line_number(curbuf, curbuf->curln),
 			curbuf->visual_x + 1);
+	/* What the original text is made of */
+	set_field(FIELD_DOS, "%s", (curbuf->scan.crlf > 0 &&
+				curbuf->scan.crlf == curbuf->scan.lines) ? " [dos]" : "");
+	set_field(FIELD_NUL, "%s", (curbuf->scan.nuls > 0) ? " [nul]" : "");
+	if (curbuf->loader != NULL)
+		set_field(FIELD_LOADING, " [loading %d%%]", loader_progress(curbuf));
+	else
+		set_field(FIELD_LOADING, "%s", "");
+	if ((percent = findall_progress(curbuf)) >= 0)
+		set_field(FIELD_SEARCHING, " [searching %d%%]", percent);
+	else
+		set_field(FIELD_SEARCHING, "%s", "");
+}
 
-	wattroff(statbar, A_REVERSE);
+/*
+ * Send what changed to the terminal.
+ */
+void update_screen()
+{
+	long start = stats_clock();
 
-	wnoutrefresh(statbar);
-	switch_win(MAINWIN);
+	doupdate();
+	stats_add(STAT_UPDATE, start);
 }
 
-void do_prev_buf()
+/*
+ * Paint the histograms of stats.c on the second row of bottwin: for every
+ * kind of thing timed, the median and the 99th percentile and a bar per
+ * four buckets of the histogram, that is per factor of 16 in time, whose
+ * height is relative to the highest bar.
+ */
+static void paint_stats()
 {
-	if (curbuf != firstbuf) {
-		curbuf = curbuf->prev;
-		display_buffer();
+	static const char levels[] = " .:-=+*#%@";
+	size_t bars[STATS_BUCKETS / 4];
+	const Histogram *h;
+	char line[256];
+	size_t highest;
+	size_t bytes;
+	size_t n;
+	int len = 0;
+	int s;
+	int b;
+	int k;
+
+	for (s = 0; s < STAT_KINDS; s++) {
+		h = stats_histogram(s);
+		highest = 0;
+		for (b = 0; b < STATS_BUCKETS / 4; b++) {
+			bars[b] = 0;
+			for (k = 4 * b; k < 4 * b + 4; k++)
+				bars[b] += h->buckets[k];
+			if (bars[b] > highest)
+				highest = bars[b];
+		}
+		len += snprintf(line + len, sizeof(line) - len, "%s %lu/%luus [",
+				stats_name(s), stats_percentile(h, 50),
+				stats_percentile(h, 99));
+		/* What did not fit was cut off, line ends up full */
+		if (len > (int)sizeof(line) - 1)
+			len = sizeof(line) - 1;
+		for (b = 0; b < STATS_BUCKETS / 4 && len < (int)sizeof(line) - 1;
+				b++) {
+			line[len++] = (bars[b] == 0) ? levels[0] :
+				levels[1 + bars[b] * (sizeof(levels) - 3) / highest];
+		}
+		len += snprintf(line + len, sizeof(line) - len, "] ");
+		if (len > (int)sizeof(line) - 1)
+			len = sizeof(line) - 1;
 	}
+	n = stats_allocs(&bytes);
+	snprintf(line + len, sizeof(line) - len, "allocs %zu/%zuK", n,
+			bytes / 1024);
+
+	clear_line(bottwin, 1);
+	mvwaddnstr(bottwin, 1, 0, line, COLS);
+	wnoutrefresh(bottwin);
+	switch_win(MAINWIN);
 }
 
-void do_next_buf()
+/*
+ * Show or hide the histograms of stats.c, which are kept up to date with
+ * every key while they are shown.
+ */
+void do_stats()
 {
-	if (curbuf != lastbuf) {
-		curbuf = curbuf->next;
-		display_buffer();
+	stats_shown = !stats_shown;
+	if (!stats_shown) {
+		clear_line(bottwin, 1);
+		wnoutrefresh(bottwin);
+		switch_win(MAINWIN);
 	}
 }
 
@@ -221,3 +803,63 @@ void switch_win(Curwin cur)
 		wnoutrefresh(bottwin);
 }
 
+static int curses_rows()
+{
+	return LINES - MAINWIN_OFFSET;
+}
+
+/*
+ * The render functions only show the current buffer; the others are
+ * shown as they are once they are switched to.
+ */
+static void curses_line(Buffer *buf, Line *line)
+{
+	if (buf == curbuf)
+		print_line(line);
+}
+
+static void curses_from(Buffer *buf, Line *line)
+{
+	if (buf == curbuf)
+		print_buffer(line);
+}
+
+static void curses_shift(Buffer *buf, int y, Direction dir)
+{
+	if (buf == curbuf)
+		shift_rows(y, dir);
+}
+
+static void curses_scroll(Buffer *buf, Direction dir)
+{
+	if (buf == curbuf)
+		scrol(dir);
+}
+
+static void curses_cursor(Buffer *buf)
+{
+	if (buf != curbuf)
+		return;
+	/* Going past the edge of the window shows the other columns */
+	if (follow_cursor())
+		display_buffer();
+	else
+		position_cursor(mainwin, buf->y_pos, cursor_x());
+}
+
+static void curses_status(Buffer *buf)
+{
+	if (buf == curbuf)
+		update_statbar();
+}
+
+static void curses_all(Buffer *buf)
+{
+	if (buf == curbuf)
+		display_buffer();
+}
+
+static void curses_message(const char *msg)
+{
+	print_msg_prompt("%s", msg);
+}